@@ -1,16 +1,28 @@
 #include <algorithm>
 #include <cassert>
 #include <csignal>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <string>
 
+#include <getopt.h>
+
 typedef void (*sighandler_t)(int sig);
 
 #include "cereal/services.h"
+#include "cereal/messaging/bridge_batch.h"
 #include "cereal/messaging/impl_msgq.h"
 #include "cereal/messaging/impl_zmq.h"
 
+const double BATCH_STATS_INTERVAL = 5.0;  // seconds
+
+static inline uint64_t nanos_since(clockid_t clock) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
 std::atomic<bool> do_exit = false;
 static void set_do_exit(int sig) {
   do_exit = true;
@@ -34,15 +46,201 @@ static std::vector<std::string> get_services(std::string whitelist_str, bool zmq
   return service_list;
 }
 
+struct BatchOptions {
+  int window_ms = 20;
+  int compression_level = 0;
+  int max_kbps = 0;  // 0 is unlimited
+  int port = BRIDGE_BATCH_PORT;
+};
+
+// Sends everything published on this device as one zmq message per window
+static int batch_sender(const BatchOptions &opts) {
+  MSGQContext sub_context;
+  ZMQContext pub_context;
+  MSGQPoller poller;
+  ZMQPubSocket pub_sock;
+  if (pub_sock.connect(&pub_context, std::to_string(opts.port), false) != 0) {
+    std::cerr << "failed to bind port " << opts.port << std::endl;
+    return 1;
+  }
+
+  std::map<std::string, int> rates;
+  std::map<SubSocket*, std::string> sub2name;
+  for (auto name : get_services("", false)) {
+    SubSocket *sub_sock = new MSGQSubSocket();
+    sub_sock->connect(&sub_context, name, "127.0.0.1", false);
+    poller.registerSocket(sub_sock);
+    sub2name[sub_sock] = name;
+    rates[name] = services.at(name).frequency;
+  }
+
+  BatchQueue queue(rates);
+  BatchWriter writer(opts.compression_level);
+  // the budget is for the bytes on the wire, estimate how many records fit in it from the last batches
+  double compression_ratio = 1.0;
+  const double window_budget = opts.max_kbps * 1000.0 / 8 * opts.window_ms / 1000.0;
+  uint64_t raw_bytes = 0, wire_bytes = 0, batches = 0;
+
+  const uint64_t window_ns = opts.window_ms * 1000000ULL;
+  uint64_t window_end = nanos_since(CLOCK_BOOTTIME) + window_ns;
+  double last_stats = nanos_since(CLOCK_BOOTTIME) / 1e9;
+  while (!do_exit) {
+    uint64_t now = nanos_since(CLOCK_BOOTTIME);
+    if (now < window_end) {
+      for (auto sub_sock : poller.poll(std::max<int>(1, (window_end - now) / 1000000))) {
+        Message *msg;
+        while ((msg = sub_sock->receive(true)) != nullptr) {
+          queue.push(sub2name[sub_sock], msg->getData(), msg->getSize(), nanos_since(CLOCK_BOOTTIME));
+          delete msg;
+        }
+      }
+      continue;
+    }
+
+    window_end = now + window_ns;
+    const size_t budget = opts.max_kbps > 0 ? std::max(1.0, window_budget / compression_ratio) : 0;
+    queue.flush(writer, budget, now);
+    if (writer.count() > 0) {
+      const size_t raw_size = writer.size();
+      const std::string &batch = writer.finish(nanos_since(CLOCK_REALTIME));
+      compression_ratio = 0.9 * compression_ratio + 0.1 * ((double)batch.size() / std::max<size_t>(raw_size, 1));
+      // a slow link drops whole batches instead of queueing them up
+      if (pub_sock.send((char *)batch.data(), batch.size()) >= 0) {
+        raw_bytes += raw_size;
+        wire_bytes += batch.size();
+        batches++;
+      }
+    }
+
+    const double t = nanos_since(CLOCK_BOOTTIME) / 1e9;
+    if (t - last_stats >= BATCH_STATS_INTERVAL) {
+      printf("%.1f batches/s, %.1f KB/s on the wire, compression ratio %.2f\n", batches / (t - last_stats),
+             wire_bytes / (t - last_stats) / 1024., raw_bytes ? (double)wire_bytes / raw_bytes : 1.);
+      print_bridge_stats("queued", queue.stats, t - last_stats);
+      queue.stats = {};
+      raw_bytes = wire_bytes = batches = 0;
+      last_stats = t;
+    }
+  }
+
+  for (auto &[sub_sock, name] : sub2name) delete sub_sock;
+  return 0;
+}
+
+// Republishes the batches of a remote batch_sender as msgq. The latency is from the sender's
+// clock, it's only meaningful when both clocks are synced.
+static int batch_receiver(const BatchOptions &opts, const std::string &ip, const std::string &whitelist_str) {
+  ZMQContext sub_context;
+  MSGQContext pub_context;
+  ZMQSubSocket sub_sock;
+  if (sub_sock.connect(&sub_context, std::to_string(opts.port), ip, false, false) != 0) {
+    std::cerr << "failed to connect to " << ip << ":" << opts.port << std::endl;
+    return 1;
+  }
+  sub_sock.setTimeout(100);
+
+  std::map<std::string, PubSocket*> name2pub;
+  for (auto name : get_services(whitelist_str, true)) {
+    PubSocket *pub_sock = new MSGQPubSocket();
+    pub_sock->connect(&pub_context, name);
+    name2pub[name] = pub_sock;
+  }
+
+  BatchReader reader;
+  std::map<std::string, BridgeServiceStats> stats;
+  uint64_t bad_batches = 0;
+  double last_stats = nanos_since(CLOCK_BOOTTIME) / 1e9;
+  while (!do_exit) {
+    Message *msg = sub_sock.receive();
+    if (msg != nullptr) {
+      const uint64_t recv_time = nanos_since(CLOCK_REALTIME);
+      uint64_t send_time = 0;
+      bool ok = reader.read(msg->getData(), msg->getSize(), &send_time, [&](const std::string &name, const char *data, size_t size) {
+        auto it = name2pub.find(name);
+        if (it == name2pub.end()) return;
+
+        it->second->send((char *)data, size);
+        const double latency_ms = (recv_time - std::min(recv_time, send_time)) / 1e6;
+        BridgeServiceStats &s = stats[name];
+        s.msgs++;
+        s.bytes += size;
+        s.latency_sum_ms += latency_ms;
+        s.latency_max_ms = std::max(s.latency_max_ms, latency_ms);
+      });
+      bad_batches += !ok;
+      delete msg;
+    }
+
+    const double t = nanos_since(CLOCK_BOOTTIME) / 1e9;
+    if (t - last_stats >= BATCH_STATS_INTERVAL) {
+      if (bad_batches > 0) printf("%lu malformed batches\n", (unsigned long)bad_batches);
+      print_bridge_stats("received", stats, t - last_stats);
+      stats.clear();
+      bad_batches = 0;
+      last_stats = t;
+    }
+  }
+
+  for (auto &[name, pub_sock] : name2pub) delete pub_sock;
+  return 0;
+}
+
+static void batch_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [<ip> <whitelist>]\n"
+            << "       " << prog << " --batch [--window-ms N] [--compress none|zstd[:level]] [--max-kbps N] [--port N]\n"
+            << "       " << prog << " --batch [--port N] <ip> <whitelist>" << std::endl;
+}
+
 int main(int argc, char** argv) {
   signal(SIGPIPE, (sighandler_t)sigpipe_handler);
   signal(SIGINT, (sighandler_t)set_do_exit);
   signal(SIGTERM, (sighandler_t)set_do_exit);
 
+  const struct option long_options[] = {
+    {"batch", no_argument, nullptr, 'b'},
+    {"window-ms", required_argument, nullptr, 'w'},
+    {"compress", required_argument, nullptr, 'c'},
+    {"max-kbps", required_argument, nullptr, 'k'},
+    {"port", required_argument, nullptr, 'p'},
+    {nullptr, 0, nullptr, 0},
+  };
+  bool batch = false;
+  BatchOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'b': batch = true; break;
+      case 'w': opts.window_ms = std::max(1, atoi(optarg)); break;
+      case 'k': opts.max_kbps = std::max(0, atoi(optarg)); break;
+      case 'p': opts.port = atoi(optarg); break;
+      case 'c':
+        if (strcmp(optarg, "none") == 0) {
+          opts.compression_level = 0;
+        } else if (strncmp(optarg, "zstd", 4) == 0 && (optarg[4] == '\0' || optarg[4] == ':')) {
+          // negative levels are zstd's fast modes, as cheap as lz4 for about the same ratio
+          opts.compression_level = optarg[4] == ':' ? atoi(optarg + 5) : 1;
+          if (opts.compression_level == 0) opts.compression_level = 1;
+        } else {
+          batch_usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        batch_usage(argv[0]);
+        return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   bool zmq_to_msgq = argc > 2;
   std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
   std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
 
+  if (batch) {
+    return zmq_to_msgq ? batch_receiver(opts, ip, whitelist_str) : batch_sender(opts);
+  }
+
   Poller *poller;
   Context *pub_context;
   Context *sub_context;
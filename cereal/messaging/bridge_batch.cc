@@ -0,0 +1,181 @@
+#include "cereal/messaging/bridge_batch.h"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+BatchWriter::BatchWriter(int compression_level) : level_(compression_level) {
+  if (level_ != 0) {
+    cctx_ = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level_);
+  }
+}
+
+BatchWriter::~BatchWriter() {
+  ZSTD_freeCCtx(cctx_);
+}
+
+void BatchWriter::add(const std::string &service, const char *data, size_t size) {
+  assert(service.size() <= UINT8_MAX && size <= UINT32_MAX);
+  const uint8_t name_len = service.size();
+  const uint32_t data_len = size;
+  records_.append((const char *)&name_len, sizeof(name_len));
+  records_.append(service);
+  records_.append((const char *)&data_len, sizeof(data_len));
+  records_.append(data, size);
+  ++num_records_;
+}
+
+const std::string &BatchWriter::finish(uint64_t send_time) {
+  bridge_batch_header h = {
+    .magic = BRIDGE_BATCH_MAGIC,
+    .version = BRIDGE_BATCH_VERSION,
+    .compressed = 0,
+    .reserved = 0,
+    .raw_size = (uint32_t)records_.size(),
+    .num_records = num_records_,
+    .send_time = send_time,
+  };
+
+  out_.resize(sizeof(h) + (cctx_ ? ZSTD_compressBound(records_.size()) : records_.size()));
+  size_t size = records_.size();
+  if (cctx_) {
+    size = ZSTD_compress2(cctx_, out_.data() + sizeof(h), out_.size() - sizeof(h), records_.data(), records_.size());
+    h.compressed = !ZSTD_isError(size);
+  }
+  if (!h.compressed) {
+    size = records_.size();
+    memcpy(out_.data() + sizeof(h), records_.data(), size);
+  }
+  memcpy(out_.data(), &h, sizeof(h));
+  out_.resize(sizeof(h) + size);
+
+  records_.clear();
+  num_records_ = 0;
+  return out_;
+}
+
+BatchReader::~BatchReader() {
+  ZSTD_freeDCtx(dctx_);
+}
+
+bool BatchReader::read(const char *data, size_t size, uint64_t *send_time,
+                       const std::function<void(const std::string &service, const char *data, size_t size)> &f) {
+  bridge_batch_header h;
+  if (size < sizeof(h)) return false;
+
+  memcpy(&h, data, sizeof(h));
+  if (h.magic != BRIDGE_BATCH_MAGIC || h.version != BRIDGE_BATCH_VERSION) return false;
+
+  const char *p = data + sizeof(h);
+  size_t remaining = size - sizeof(h);
+  if (h.raw_size > BRIDGE_BATCH_MAX_SIZE) return false;
+  if (h.compressed) {
+    // the size comes from the network, it has to match what the frame says it holds
+    if (ZSTD_getFrameContentSize(p, remaining) != h.raw_size) return false;
+    if (!dctx_) dctx_ = ZSTD_createDCtx();
+    records_.resize(h.raw_size);
+    size_t n = ZSTD_decompressDCtx(dctx_, records_.data(), records_.size(), p, remaining);
+    if (ZSTD_isError(n) || n != h.raw_size) return false;
+    p = records_.data();
+    remaining = n;
+  } else if (remaining != h.raw_size) {
+    return false;
+  }
+
+  // check the whole batch before handing out any of it
+  const char *records = p;
+  const size_t records_size = remaining;
+  for (uint32_t i = 0; i < h.num_records; ++i) {
+    uint8_t name_len;
+    uint32_t data_len;
+    if (remaining < sizeof(name_len)) return false;
+    memcpy(&name_len, p, sizeof(name_len));
+    if (remaining - sizeof(name_len) < name_len + sizeof(data_len)) return false;
+    memcpy(&data_len, p + sizeof(name_len) + name_len, sizeof(data_len));
+    const size_t record_size = sizeof(name_len) + name_len + sizeof(data_len) + data_len;
+    if (remaining < record_size) return false;
+    p += record_size;
+    remaining -= record_size;
+  }
+  if (remaining != 0) return false;
+
+  p = records;
+  for (uint32_t i = 0; i < h.num_records; ++i) {
+    uint8_t name_len = *(const uint8_t *)p;
+    service_.assign(p + sizeof(name_len), name_len);
+    uint32_t data_len;
+    memcpy(&data_len, p + sizeof(name_len) + name_len, sizeof(data_len));
+    p += sizeof(name_len) + name_len + sizeof(data_len);
+    f(service_, p, data_len);
+    p += data_len;
+  }
+  assert(p == records + records_size);
+  if (send_time) *send_time = h.send_time;
+  return true;
+}
+
+BatchQueue::BatchQueue(const std::map<std::string, int> &service_rates) {
+  std::vector<std::pair<int, std::string>> order;
+  for (const auto &[name, rate] : service_rates) {
+    order.push_back({rate, name});
+  }
+  // the rarest messages are usually the ones that matter, e.g. events and state changes
+  std::sort(order.begin(), order.end());
+  for (const auto &[rate, name] : order) {
+    index_[name] = pending_.size();
+    pending_.push_back({name, {}, {}});
+    stats[name];
+  }
+}
+
+void BatchQueue::push(const std::string &service, const char *data, size_t size, uint64_t recv_time) {
+  auto it = index_.find(service);
+  if (it == index_.end()) return;
+
+  Pending &p = pending_[it->second];
+  p.data.append(data, size);
+  p.msgs.push_back({(uint32_t)size, recv_time});
+}
+
+void BatchQueue::flush(BatchWriter &writer, size_t budget, uint64_t now) {
+  budget = budget == 0 ? BRIDGE_BATCH_MAX_SIZE : std::min<size_t>(budget, BRIDGE_BATCH_MAX_SIZE);
+  size_t used = writer.size();
+  for (Pending &p : pending_) {
+    BridgeServiceStats &s = stats[p.name];
+    const char *data = p.data.data();
+    for (const auto &[size, recv_time] : p.msgs) {
+      const size_t record_size = 1 + p.name.size() + sizeof(uint32_t) + size;
+      if (used + record_size <= budget) {
+        writer.add(p.name, data, size);
+        used += record_size;
+        const double latency_ms = (now - std::min(now, recv_time)) / 1e6;
+        s.msgs++;
+        s.bytes += size;
+        s.latency_sum_ms += latency_ms;
+        s.latency_max_ms = std::max(s.latency_max_ms, latency_ms);
+      } else {
+        s.dropped++;
+      }
+      data += size;
+    }
+    p.data.clear();
+    p.msgs.clear();
+  }
+}
+
+void print_bridge_stats(const char *title, const std::map<std::string, BridgeServiceStats> &stats, double seconds) {
+  std::vector<std::pair<std::string, BridgeServiceStats>> sorted(stats.begin(), stats.end());
+  std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) { return a.second.bytes > b.second.bytes; });
+
+  printf("%s\n%-28s %8s %10s %8s %10s %10s\n", title, "service", "msgs/s", "KB/s", "dropped", "avg ms", "max ms");
+  for (const auto &[name, s] : sorted) {
+    if (s.msgs == 0 && s.dropped == 0) continue;
+    printf("%-28s %8.1f %10.1f %8lu %10.2f %10.2f\n", name.c_str(), s.msgs / seconds, s.bytes / seconds / 1024.,
+           (unsigned long)s.dropped, s.msgs ? s.latency_sum_ms / s.msgs : 0., s.latency_max_ms);
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#define BRIDGE_BATCH_MAGIC 0x54414243  // "CBAT"
+#define BRIDGE_BATCH_VERSION 1
+#define BRIDGE_BATCH_PORT 8200
+#define BRIDGE_BATCH_MAX_SIZE (64 * 1024 * 1024)  // of the records, readers reject larger batches
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+// A batch is this header, then for every message the length of its service name, the name,
+// the message size and the message. The records are zstd compressed as a whole if compressed is set.
+struct __attribute__((packed)) bridge_batch_header {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t compressed;
+  uint16_t reserved;
+  uint32_t raw_size;     // size of the records before compression
+  uint32_t num_records;
+  uint64_t send_time;    // CLOCK_REALTIME of the sender
+};
+
+class BatchWriter {
+public:
+  // 0 is no compression, otherwise a zstd level. Negative levels trade ratio for speed like lz4.
+  BatchWriter(int compression_level = 0);
+  ~BatchWriter();
+  void add(const std::string &service, const char *data, size_t size);
+  size_t size() const { return records_.size(); }
+  uint32_t count() const { return num_records_; }
+  // The batch to send. Clears the records for the next one
+  const std::string &finish(uint64_t send_time);
+
+private:
+  int level_;
+  ZSTD_CCtx_s *cctx_ = nullptr;
+  std::string records_;
+  std::string out_;
+  uint32_t num_records_ = 0;
+};
+
+class BatchReader {
+public:
+  ~BatchReader();
+  // Calls f for every message of the batch, false if it's malformed
+  bool read(const char *data, size_t size, uint64_t *send_time,
+            const std::function<void(const std::string &service, const char *data, size_t size)> &f);
+
+private:
+  ZSTD_DCtx_s *dctx_ = nullptr;
+  std::string records_;
+  std::string service_;
+};
+
+struct BridgeServiceStats {
+  uint64_t msgs = 0;
+  uint64_t bytes = 0;
+  uint64_t dropped = 0;
+  double latency_sum_ms = 0;
+  double latency_max_ms = 0;
+};
+
+// The messages received during a window, waiting to be batched. When the batch would go over
+// its budget, services with a lower configured rate go first and the rest are dropped.
+class BatchQueue {
+public:
+  BatchQueue(const std::map<std::string, int> &service_rates);
+  void push(const std::string &service, const char *data, size_t size, uint64_t recv_time);
+  // Moves the pending messages into the writer, at most budget bytes of them if budget isn't 0
+  // and never more than BRIDGE_BATCH_MAX_SIZE
+  void flush(BatchWriter &writer, size_t budget, uint64_t now);
+
+  std::map<std::string, BridgeServiceStats> stats;
+
+private:
+  struct Pending {
+    std::string name;
+    std::string data;
+    std::vector<std::pair<uint32_t, uint64_t>> msgs;  // size and receive time
+  };
+  std::vector<Pending> pending_;
+  std::map<std::string, size_t> index_;
+};
+
+// Prints a line per service, with the highest bandwidth first
+void print_bridge_stats(const char *title, const std::map<std::string, BridgeServiceStats> &stats, double seconds);
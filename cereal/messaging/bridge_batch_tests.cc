@@ -0,0 +1,185 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/bridge_batch.h"
+
+typedef std::vector<std::pair<std::string, std::string>> Records;
+
+static bool read_batch(BatchReader &reader, const std::string &batch, Records *records, uint64_t *send_time = nullptr) {
+  return reader.read(batch.data(), batch.size(), send_time, [&](const std::string &service, const char *data, size_t size) {
+    records->push_back({service, std::string(data, size)});
+  });
+}
+
+static bridge_batch_header get_header(const std::string &batch) {
+  bridge_batch_header h;
+  memcpy(&h, batch.data(), sizeof(h));
+  return h;
+}
+
+static std::string set_header(std::string batch, const bridge_batch_header &h) {
+  memcpy(batch.data(), &h, sizeof(h));
+  return batch;
+}
+
+TEST_CASE("BatchWriter and BatchReader round trip") {
+  const int level = GENERATE(0, 1, -5);
+  Records records = {
+    {"carState", std::string(200, 'a')},
+    {"empty", ""},
+    {std::string(255, 's'), "long service name"},
+    {"carState", std::string("\0\1\2\3", 4)},
+  };
+
+  BatchWriter writer(level);
+  size_t raw_size = 0;
+  for (const auto &[service, data] : records) {
+    writer.add(service, data.data(), data.size());
+    raw_size += 1 + service.size() + sizeof(uint32_t) + data.size();
+  }
+  REQUIRE(writer.count() == records.size());
+  REQUIRE(writer.size() == raw_size);
+
+  const std::string batch = writer.finish(1234567890123ULL);
+  REQUIRE(writer.count() == 0);
+  REQUIRE(writer.size() == 0);
+  const bridge_batch_header h = get_header(batch);
+  REQUIRE(h.magic == BRIDGE_BATCH_MAGIC);
+  REQUIRE(h.raw_size == raw_size);
+  REQUIRE(h.num_records == records.size());
+  REQUIRE((bool)h.compressed == (level != 0));
+  if (level != 0) {
+    REQUIRE(batch.size() < sizeof(h) + raw_size);
+  }
+
+  BatchReader reader;
+  Records read;
+  uint64_t send_time = 0;
+  REQUIRE(read_batch(reader, batch, &read, &send_time));
+  REQUIRE(read == records);
+  REQUIRE(send_time == 1234567890123ULL);
+
+  // the writer and reader are reused batch after batch
+  writer.add("next", "x", 1);
+  read.clear();
+  REQUIRE(read_batch(reader, writer.finish(1), &read));
+  REQUIRE(read == Records{{"next", "x"}});
+
+  // an empty batch is still a batch
+  read.clear();
+  REQUIRE(read_batch(reader, writer.finish(2), &read, &send_time));
+  REQUIRE(read.empty());
+  REQUIRE(send_time == 2);
+}
+
+TEST_CASE("BatchQueue drops the most frequent services over the budget") {
+  BatchQueue queue({{"fast", 100}, {"rare", 1}, {"medium", 20}});
+  const std::string msg(100, 'x');
+  for (int i = 0; i < 10; i++) {
+    queue.push("fast", msg.data(), msg.size(), 0);
+  }
+  queue.push("medium", msg.data(), msg.size(), 0);
+  queue.push("rare", msg.data(), msg.size(), 0);
+  queue.push("unknown", msg.data(), msg.size(), 0);
+
+  // room for the rare and medium messages, and one of the fast ones
+  auto record_size = [&](const std::string &service) { return 1 + service.size() + sizeof(uint32_t) + msg.size(); };
+  BatchWriter writer;
+  queue.flush(writer, record_size("rare") + record_size("medium") + record_size("fast"), 0);
+  REQUIRE(writer.count() == 3);
+
+  BatchReader reader;
+  Records read;
+  REQUIRE(read_batch(reader, writer.finish(0), &read));
+  REQUIRE(read == Records{{"rare", msg}, {"medium", msg}, {"fast", msg}});
+  REQUIRE(queue.stats["rare"].msgs == 1);
+  REQUIRE(queue.stats["medium"].msgs == 1);
+  REQUIRE(queue.stats["fast"].msgs == 1);
+  REQUIRE(queue.stats["fast"].dropped == 9);
+  REQUIRE(queue.stats.count("unknown") == 0);
+
+  // flushed messages are gone, dropped or not
+  queue.flush(writer, 0, 0);
+  REQUIRE(writer.count() == 0);
+
+  // without a budget everything goes
+  for (int i = 0; i < 10; i++) {
+    queue.push("fast", msg.data(), msg.size(), 0);
+  }
+  queue.flush(writer, 0, 0);
+  REQUIRE(writer.count() == 10);
+}
+
+TEST_CASE("BatchReader rejects malformed batches") {
+  const bool compressed = GENERATE(false, true);
+  BatchWriter writer(compressed ? 1 : 0);
+  writer.add("carState", "abcdefgh", 8);
+  writer.add("can", "0123456789", 10);
+  const std::string batch = writer.finish(1);
+  const bridge_batch_header h = get_header(batch);
+
+  BatchReader reader;
+  Records read;
+  auto rejected = [&](const std::string &bad) {
+    read.clear();
+    const bool ok = read_batch(reader, bad, &read);
+    // nothing of a malformed batch is handed out
+    return !ok && read.empty();
+  };
+  REQUIRE_FALSE(rejected(batch));
+
+  SECTION("truncated") {
+    REQUIRE(rejected(""));
+    REQUIRE(rejected(batch.substr(0, sizeof(h) - 1)));
+    REQUIRE(rejected(batch.substr(0, sizeof(h))));
+    REQUIRE(rejected(batch.substr(0, batch.size() - 1)));
+  }
+  SECTION("trailing bytes") {
+    REQUIRE(rejected(batch + "x"));
+  }
+  SECTION("bad magic or version") {
+    bridge_batch_header bad = h;
+    bad.magic++;
+    REQUIRE(rejected(set_header(batch, bad)));
+    bad = h;
+    bad.version++;
+    REQUIRE(rejected(set_header(batch, bad)));
+  }
+  SECTION("wrong raw size") {
+    bridge_batch_header bad = h;
+    bad.raw_size--;
+    REQUIRE(rejected(set_header(batch, bad)));
+    bad.raw_size = h.raw_size + 1;
+    REQUIRE(rejected(set_header(batch, bad)));
+    // a huge size isn't allocated before it's checked
+    bad.raw_size = UINT32_MAX;
+    REQUIRE(rejected(set_header(batch, bad)));
+  }
+  SECTION("wrong record count") {
+    bridge_batch_header bad = h;
+    bad.num_records--;
+    REQUIRE(rejected(set_header(batch, bad)));
+    bad.num_records = h.num_records + 1;
+    REQUIRE(rejected(set_header(batch, bad)));
+    bad.num_records = UINT32_MAX;
+    REQUIRE(rejected(set_header(batch, bad)));
+  }
+  SECTION("corrupt records") {
+    std::string bad = batch;
+    if (compressed) {
+      // flipping the header or the data of a zstd frame breaks it
+      for (size_t i = sizeof(h); i < bad.size(); i++) bad[i] = ~bad[i];
+      REQUIRE(rejected(bad));
+    } else {
+      // a name or message length running past the end
+      bad[sizeof(h)] = (char)0xff;
+      REQUIRE(rejected(bad));
+      bad = batch;
+      const uint32_t data_len = UINT32_MAX;
+      memcpy(bad.data() + sizeof(h) + 1 + strlen("carState"), &data_len, sizeof(data_len));
+      REQUIRE(rejected(bad));
+    }
+  }
+}
@@ -20,6 +20,15 @@ private:
   Event *recv_called = nullptr;
   Event *recv_ready = nullptr;
   EventState *state = nullptr;
+  bool in_view = false;
+
+  void wait_recv_ready() {
+    if (this->state->enabled && !in_view) {
+      this->recv_called->set();
+      this->recv_ready->wait();
+      this->recv_ready->clear();
+    }
+  }
 
 public:
   FakeSubSocket(): TSubSocket() {}
@@ -46,14 +55,19 @@ public:
   }
 
   Message *receive(bool non_blocking=false) override {
-    if (this->state->enabled) {
-      this->recv_called->set();
-      this->recv_ready->wait();
-      this->recv_ready->clear();
-    }
-
+    wait_recv_ready();
     return TSubSocket::receive(non_blocking);
   }
+
+  kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false) override {
+    wait_recv_ready();
+
+    // the fallback receiveView calls receive(), don't wait a second time
+    in_view = true;
+    auto words = TSubSocket::receiveView(non_blocking);
+    in_view = false;
+    return words;
+  }
 };
 
 class FakePoller: public Poller {
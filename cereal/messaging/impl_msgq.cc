@@ -80,7 +80,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
 }
 
 
-Message * MSGQSubSocket::receive(bool non_blocking){
+int MSGQSubSocket::recv(msgq_msg_t *msg, bool non_blocking, bool borrow){
   msgq_do_exit = 0;
 
   void (*prev_handler_sigint)(int);
@@ -90,11 +90,8 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     prev_handler_sigterm = std::signal(SIGTERM, sig_handler);
   }
 
-  msgq_msg_t msg;
-
-  MSGQMessage *r = NULL;
-
-  int rc = msgq_msg_recv(&msg, q);
+  auto recv_fn = borrow ? msgq_msg_recv_view : msgq_msg_recv;
+  int rc = recv_fn(msg, q);
 
   // Hack to implement blocking read with a poller. Don't use this
   while (!non_blocking && rc == 0 && msgq_do_exit == 0){
@@ -104,7 +101,7 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     int t = (timeout != -1) ? timeout : 100;
 
     int n = msgq_poll(items, 1, t);
-    rc = msgq_msg_recv(&msg, q);
+    rc = recv_fn(msg, q);
 
     // The poll indicated a message was ready, but the receive failed. Try again
     if (n == 1 && rc == 0){
@@ -123,6 +120,18 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   }
 
   errno = msgq_do_exit ? EINTR : 0;
+  return rc;
+}
+
+Message * MSGQSubSocket::receive(bool non_blocking){
+  if (view_held){
+    releaseView();
+  }
+
+  msgq_msg_t msg;
+  MSGQMessage *r = NULL;
+
+  int rc = recv(&msg, non_blocking, false);
 
   if (rc > 0){
     if (msgq_do_exit){
@@ -136,6 +145,33 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+kj::ArrayPtr<const capnp::word> MSGQSubSocket::receiveView(bool non_blocking){
+  if (view_held){
+    releaseView();
+  }
+
+  msgq_msg_t msg;
+  int rc = recv(&msg, non_blocking, true);
+
+  // On exit the read pointer was never advanced, the message is received again next time
+  if (rc <= 0 || msgq_do_exit){
+    return nullptr;
+  }
+
+  // Messages in the queue start 8 byte aligned and are padded to a multiple of 8 bytes
+  view_held = true;
+  return kj::ArrayPtr<const capnp::word>((const capnp::word*)msg.data, ALIGN(msg.size) / sizeof(capnp::word));
+}
+
+bool MSGQSubSocket::releaseView(){
+  if (!view_held){
+    return true;
+  }
+
+  view_held = false;
+  return msgq_msg_release_view(q);
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
@@ -181,10 +217,22 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+char *MSGQPubSocket::reserve(size_t size){
+  return msgq_msg_reserve(q, size);
+}
+
+int MSGQPubSocket::commit(size_t size){
+  return msgq_msg_commit(q, size);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
 
+bool MSGQPubSocket::has_readers() {
+  return msgq_has_readers(q);
+}
+
 MSGQPubSocket::~MSGQPubSocket(){
   if (q != NULL){
     msgq_close_queue(q);
@@ -35,11 +35,15 @@ class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
   int timeout;
+  bool view_held = false;
+  int recv(msgq_msg_t *msg, bool non_blocking, bool borrow);
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false);
+  bool releaseView();
   ~MSGQSubSocket();
 };
 
@@ -50,7 +54,10 @@ public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  char *reserve(size_t size);
+  int commit(size_t size);
   bool all_readers_updated();
+  bool has_readers();
   ~MSGQPubSocket();
 };
 
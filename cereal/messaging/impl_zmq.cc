@@ -130,6 +130,11 @@ bool ZMQPubSocket::all_readers_updated() {
   return false;
 }
 
+bool ZMQPubSocket::has_readers() {
+  assert(false); // TODO not implemented
+  return false;
+}
+
 ZMQPubSocket::~ZMQPubSocket(){
   zmq_close(sock);
 }
@@ -71,6 +71,28 @@ SubSocket * SubSocket::create(Context * context, std::string endpoint, std::stri
   }
 }
 
+kj::ArrayPtr<const capnp::word> SubSocket::receiveView(bool non_blocking){
+  // Backends without shared memory fall back to an aligned copy owned by the socket
+  Message *msg = receive(non_blocking);
+  if (msg == nullptr) return nullptr;
+
+  auto words = view_buf_.align(msg);
+  delete msg;
+  return words;
+}
+
+char *PubSocket::reserve(size_t size){
+  if (reserve_buf_.size() < size) {
+    reserve_buf_.resize(size);
+  }
+  return reserve_buf_.data();
+}
+
+int PubSocket::commit(size_t size){
+  assert(size <= reserve_buf_.size());
+  return send(reserve_buf_.data(), size);
+}
+
 PubSocket * PubSocket::create(){
   PubSocket * s;
   if (messaging_use_zmq()){
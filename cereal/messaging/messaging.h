@@ -37,15 +37,40 @@ public:
 };
 
 
+class AlignedBuffer {
+public:
+  kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
+    words_size = size / sizeof(capnp::word) + 1;
+    if (aligned_buf.size() < words_size) {
+      aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
+    }
+    memcpy(aligned_buf.begin(), data, size);
+    return aligned_buf.slice(0, words_size);
+  }
+  inline kj::ArrayPtr<const capnp::word> align(Message *m) {
+    return align(m->getData(), m->getSize());
+  }
+private:
+  kj::Array<capnp::word> aligned_buf;
+  size_t words_size;
+};
+
 class SubSocket {
 public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Borrow the next message without copying it. The view may be overwritten by the
+  // publisher at any time, only trust what was read from it if releaseView() returns true.
+  virtual kj::ArrayPtr<const capnp::word> receiveView(bool non_blocking=false);
+  virtual bool releaseView() { return true; }
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
   virtual ~SubSocket(){}
+
+private:
+  AlignedBuffer view_buf_;
 };
 
 class PubSocket {
@@ -54,10 +79,19 @@ public:
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
   virtual bool all_readers_updated() = 0;
+  virtual bool has_readers() = 0;
+  // Publish in place: write a message of up to size bytes at the returned pointer, then send the
+  // first size bytes of it with commit(). Backends without shared memory reserve a buffer owned
+  // by the socket and send it on commit.
+  virtual char *reserve(size_t size);
+  virtual int commit(size_t size);
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
   static PubSocket * create(Context * context, std::string endpoint, int port, bool check_endpoint=true);
   virtual ~PubSocket(){}
+
+private:
+  std::vector<char> reserve_buf_;
 };
 
 class Poller {
@@ -100,6 +134,9 @@ private:
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // Builds in the caller's zeroed first segment, which is zeroed again when done so it can be
+  // reused by the next message. Only messages that outgrow it allocate.
+  MessageBuilder(kj::ArrayPtr<capnp::word> first_segment) : capnp::MallocMessageBuilder(first_segment) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -136,27 +173,11 @@ class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
   inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
+  inline bool all_readers_updated(const char *name) { return sockets_.at(name)->all_readers_updated(); }
+  inline bool has_readers(const char *name) { return sockets_.at(name)->has_readers(); }
   int send(const char *name, MessageBuilder &msg);
   ~PubMaster();
 
 private:
   std::map<std::string, PubSocket *> sockets_;
 };
-
-class AlignedBuffer {
-public:
-  kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
-    words_size = size / sizeof(capnp::word) + 1;
-    if (aligned_buf.size() < words_size) {
-      aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
-    }
-    memcpy(aligned_buf.begin(), data, size);
-    return aligned_buf.slice(0, words_size);
-  }
-  inline kj::ArrayPtr<const capnp::word> align(Message *m) {
-    return align(m->getData(), m->getSize());
-  }
-private:
-  kj::Array<capnp::word> aligned_buf;
-  size_t words_size;
-};
@@ -11,16 +11,24 @@
 #include <random>
 #include <string>
 #include <limits>
+#include <utility>
+#include <vector>
 
 #include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <fcntl.h>
+#include <climits>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
 #include <stdio.h>
 
 #include "cereal/messaging/msgq.h"
@@ -29,6 +37,27 @@ void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
 }
 
+#ifdef __linux__
+static int futex_wait(std::atomic<uint32_t> *addr, uint32_t val, const struct timespec *ts) {
+  // Not FUTEX_PRIVATE, the word lives in shared memory and is woken by other processes
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, val, ts, NULL, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+static void msgq_notify(msgq_queue_t *q) {
+  (*q->notify_seq)++;
+
+  #ifdef __linux__
+    if (*q->notify_waiters > 0) {
+      futex_wake(q->notify_seq);
+    }
+  #endif
+}
+
 uint64_t msgq_get_uid(void){
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0, std::numeric_limits<uint32_t>::max());
@@ -83,8 +112,16 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
   return;
 }
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+static_assert(sizeof(msgq_header_t) == 3 * CACHE_LINE_SIZE);
+static_assert(sizeof(msgq_reader_t) == CACHE_LINE_SIZE);
+
+static size_t msgq_mem_size(size_t size, size_t num_readers){
+  return sizeof(msgq_header_t) + num_readers * sizeof(msgq_reader_t) + size;
+}
+
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t num_readers){
   assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
+  assert(num_readers > 0 && num_readers <= MAX_NUM_READERS);
   std::signal(SIGUSR2, sigusr2_handler);
 
   std::string full_path = "/dev/shm/";
@@ -94,39 +131,110 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   }
   full_path += path;
 
-  auto fd = open(full_path.c_str(), O_RDWR | O_CREAT, 0664);
-  if (fd < 0) {
-    std::cout << "Warning, could not open: " << full_path << std::endl;
-    return -1;
+  int fd = -1;
+  bool initialized = false;
+  while (true) {
+    fd = open(full_path.c_str(), O_RDWR | O_CREAT, 0664);
+    if (fd < 0) {
+      std::cout << "Warning, could not open: " << full_path << std::endl;
+      return -1;
+    }
+
+    // The first process to open the queue decides the size of the reader table,
+    // hold a lock so concurrent openers agree on it
+    flock(fd, LOCK_EX);
+
+    // A stale queue may have been replaced while we waited, the lock only counts on the file at the path
+    struct stat st, path_st;
+    if (fstat(fd, &st) != 0 || stat(full_path.c_str(), &path_st) != 0 || st.st_ino != path_st.st_ino) {
+      close(fd);
+      continue;
+    }
+
+    msgq_header_t existing = {};
+    initialized = (pread(fd, &existing, sizeof(existing), 0) == sizeof(existing)) &&
+                  (existing.version == MSGQ_VERSION) &&
+                  (existing.max_readers > 0 && existing.max_readers <= MAX_NUM_READERS) &&
+                  ((size_t)st.st_size == msgq_mem_size(size, existing.max_readers));
+
+    if (initialized) {
+      num_readers = existing.max_readers;
+    } else if (st.st_size == 0) {
+      // New queue, nobody has it mapped yet
+      if (ftruncate(fd, msgq_mem_size(size, num_readers)) < 0) {
+        close(fd);
+        return -1;
+      }
+    } else {
+      // Left behind with a different layout. Processes may still have it mapped, truncating it
+      // would SIGBUS them. Move a new, initialized queue in its place instead
+      std::string tmp_path = full_path + ".tmp" + std::to_string(getpid());
+      int new_fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664);
+      msgq_header_t header = {};
+      header.version = MSGQ_VERSION;
+      header.max_readers = num_readers;
+      bool ok = new_fd >= 0 && ftruncate(new_fd, msgq_mem_size(size, num_readers)) == 0 &&
+                pwrite(new_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                rename(tmp_path.c_str(), full_path.c_str()) == 0;
+      if (!ok) {
+        std::cout << "Warning, could not replace stale queue: " << full_path << std::endl;
+        if (new_fd >= 0) {
+          unlink(tmp_path.c_str());
+          close(new_fd);
+        }
+        close(fd);
+        return -1;
+      }
+      flock(new_fd, LOCK_EX);
+      close(fd);
+      fd = new_fd;
+      initialized = true;
+    }
+    break;
   }
 
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
-  if (rc < 0){
+  size_t mmap_size = msgq_mem_size(size, num_readers);
+  char * mem = (char*)mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (mem == MAP_FAILED){
     close(fd);
     return -1;
   }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  close(fd);
 
-  if (mem == NULL){
-    return -1;
+  msgq_header_t *header = (msgq_header_t *)mem;
+  if (!initialized){
+    header->max_readers = num_readers;
+    header->version = MSGQ_VERSION;
   }
-  q->mmap_p = mem;
 
-  msgq_header_t *header = (msgq_header_t *)mem;
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  q->mmap_p = mem;
+  q->mmap_size = mmap_size;
+  q->max_readers = num_readers;
 
   // Setup pointers to header segment
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
 
-  for (size_t i = 0; i < NUM_READERS; i++){
-    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
-    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
-    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
+  msgq_reader_t *readers = (msgq_reader_t *)(mem + sizeof(msgq_header_t));
+  q->read_pointers.resize(num_readers);
+  q->read_valids.resize(num_readers);
+  q->read_uids.resize(num_readers);
+  q->read_polling.resize(num_readers);
+  for (size_t i = 0; i < num_readers; i++){
+    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_pointer);
+    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_valid);
+    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_uid);
+    q->read_polling[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_polling);
   }
 
-  q->data = mem + sizeof(msgq_header_t);
+  q->notify_seq = reinterpret_cast<std::atomic<uint32_t>*>(&header->notify_seq);
+  q->notify_waiters = reinterpret_cast<std::atomic<uint32_t>*>(&header->notify_waiters);
+
+  q->data = (char *)(readers + num_readers);
   q->size = size;
   q->reader_id = -1;
 
@@ -138,7 +246,16 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
 
 void msgq_close_queue(msgq_queue_t *q){
   if (q->mmap_p != NULL){
-    munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
+    // Give our reader slot back, so it can be reused without evicting anyone
+    int id = q->reader_id;
+    if (id >= 0 && q->read_uid_local == *q->read_uids[id]){
+      *q->read_valids[id] = false;
+      *q->read_polling[id] = false;
+      uint64_t uid = q->read_uid_local;
+      std::atomic_compare_exchange_strong(q->read_uids[id], &uid, (uint64_t)0);
+    }
+
+    munmap(q->mmap_p, q->mmap_size);
   }
 }
 
@@ -150,12 +267,14 @@ void msgq_init_publisher(msgq_queue_t * q) {
   *q->write_uid = uid;
   *q->num_readers = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
+  for (size_t i = 0; i < q->max_readers; i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
+    *q->read_polling[i] = false;
   }
 
   q->write_uid_local = uid;
+  q->reserved_size = 0;
 }
 
 static void thread_signal(uint32_t tid) {
@@ -167,6 +286,163 @@ static void thread_signal(uint32_t tid) {
   #endif
 }
 
+static bool msgq_reader_alive(uint64_t uid) {
+  if (uid == 0) {
+    return false;
+  }
+
+  #ifdef __APPLE__
+    return true;
+  #else
+    // The lower half of the uid is the thread id of the reader
+    return !(kill(uid & 0xFFFFFFFF, 0) == -1 && errno == ESRCH);
+  #endif
+}
+
+#ifdef __linux__
+static msgq_poll_slot_t *msgq_poll_table(){
+  static msgq_poll_slot_t *table = []() -> msgq_poll_slot_t * {
+    std::string full_path = "/dev/shm/";
+    const char* prefix = std::getenv("OPENPILOT_PREFIX");
+    if (prefix) {
+      full_path += std::string(prefix) + "/";
+    }
+    full_path += "msgq_poll";
+
+    // Zeroed memory is an empty table
+    const size_t size = MSGQ_POLL_SLOTS * sizeof(msgq_poll_slot_t);
+    int fd = -1;
+    while (true) {
+      fd = open(full_path.c_str(), O_RDWR | O_CREAT, 0664);
+      if (fd < 0) {
+        return nullptr;
+      }
+      flock(fd, LOCK_EX);
+
+      // Replaced while we waited for the lock
+      struct stat st, path_st;
+      if (fstat(fd, &st) != 0 || stat(full_path.c_str(), &path_st) != 0 || st.st_ino != path_st.st_ino) {
+        close(fd);
+        continue;
+      }
+
+      if (st.st_size == 0) {
+        if (ftruncate(fd, size) != 0) {
+          close(fd);
+          return nullptr;
+        }
+      } else if ((size_t)st.st_size != size) {
+        // A table of another layout, processes may still have it mapped. Move an empty one in its place
+        std::string tmp_path = full_path + ".tmp" + std::to_string(getpid());
+        int new_fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664);
+        bool ok = new_fd >= 0 && ftruncate(new_fd, size) == 0 && rename(tmp_path.c_str(), full_path.c_str()) == 0;
+        if (!ok) {
+          if (new_fd >= 0) {
+            unlink(tmp_path.c_str());
+            close(new_fd);
+          }
+          close(fd);
+          return nullptr;
+        }
+        flock(new_fd, LOCK_EX);
+        close(fd);
+        fd = new_fd;
+      }
+      break;
+    }
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return mem == MAP_FAILED ? nullptr : (msgq_poll_slot_t *)mem;
+  }();
+  return table;
+}
+
+// The poll slot of this thread, claimed on its first multi-queue poll and freed when it exits
+struct msgq_poll_slot_owner {
+  ~msgq_poll_slot_owner() {
+    if (slot != nullptr) {
+      std::atomic_compare_exchange_strong(&slot->owner_uid, &uid, (uint64_t)0);
+    }
+  }
+
+  msgq_poll_slot_t *slot = nullptr;
+  uint64_t uid = 0;
+  // The readers of the last poll stay registered, polling them again only checks the ready bits
+  std::vector<std::pair<msgq_queue_t *, uint64_t>> readers;
+};
+
+static msgq_poll_slot_owner *msgq_thread_poll_slot(){
+  static thread_local msgq_poll_slot_owner owner;
+  // MSGQ_NO_POLL_SLOTS makes every multi-queue poll use the signal fallback, to compare against it
+  static const bool no_poll_slots = std::getenv("MSGQ_NO_POLL_SLOTS") != nullptr;
+  msgq_poll_slot_t *table = no_poll_slots ? nullptr : msgq_poll_table();
+  if (owner.slot != nullptr || table == nullptr) {
+    return owner.slot != nullptr ? &owner : nullptr;
+  }
+
+  uint64_t uid = msgq_get_uid();
+  for (size_t i = 0; i < MSGQ_POLL_SLOTS; i++) {
+    // Take a free slot, or one whose thread died
+    uint64_t old_uid = table[i].owner_uid;
+    if (!msgq_reader_alive(old_uid) && std::atomic_compare_exchange_strong(&table[i].owner_uid, &old_uid, uid)) {
+      for (auto &ready : table[i].ready) {
+        ready = 0;
+      }
+      owner.slot = &table[i];
+      owner.uid = uid;
+      return &owner;
+    }
+  }
+  return nullptr;
+}
+#endif
+
+// read_polling is the poll slot + 1 and the item of the queue in the poll. Without a slot
+// the upper half is zero and the poller is signaled instead
+static void msgq_wake_poller(uint64_t polling, uint64_t reader_uid){
+  #ifdef __linux__
+    uint64_t slot_id = (polling >> 32) - 1;
+    uint32_t item = polling & 0xFFFFFFFF;
+    msgq_poll_slot_t *table = msgq_poll_table();
+    if (table != nullptr && slot_id < MSGQ_POLL_SLOTS && item < MSGQ_POLL_ITEMS) {
+      msgq_poll_slot_t *slot = &table[slot_id];
+      slot->ready[item / 64].fetch_or(1ULL << (item % 64));
+      slot->seq++;
+      if (slot->waiters > 0) {
+        futex_wake(&slot->seq);
+      }
+      return;
+    }
+  #endif
+
+  thread_signal(reader_uid & 0xFFFFFFFF);
+}
+
+static bool msgq_reclaim_reader(msgq_queue_t * q, uint64_t uid) {
+  uint64_t num_readers = std::min((uint64_t)*q->num_readers, (uint64_t)q->max_readers);
+
+  for (uint64_t i = 0; i < num_readers; i++){
+    uint64_t old_uid = *q->read_uids[i];
+    if (msgq_reader_alive(old_uid)) {
+      continue;
+    }
+
+    // Claim the slot, another subscriber might be reclaiming it at the same time
+    if (std::atomic_compare_exchange_strong(q->read_uids[i], &old_uid, uid)){
+      q->reader_id = i;
+      q->read_uid_local = uid;
+
+      *q->read_valids[i] = false;
+      *q->read_pointers[i] = 0;
+      *q->read_polling[i] = false;
+      return true;
+    }
+  }
+
+  return false;
+}
+
 void msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
@@ -178,20 +454,29 @@ void msgq_init_subscriber(msgq_queue_t * q) {
     uint64_t cur_num_readers = *q->num_readers;
     uint64_t new_num_readers = cur_num_readers + 1;
 
-    // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
+    // No more slots available. Take over a slot that was closed or whose reader died
+    if (new_num_readers > q->max_readers && msgq_reclaim_reader(q, uid)){
+      break;
+    }
+
+    // Still nothing free. Reset all subscribers to kick out inactive ones
+    if (new_num_readers > q->max_readers){
       //std::cout << "Warning, evicting all subscribers!" << std::endl;
       *q->num_readers = 0;
 
-      for (size_t i = 0; i < NUM_READERS; i++){
+      for (size_t i = 0; i < q->max_readers; i++){
         *q->read_valids[i] = false;
 
         uint64_t old_uid = *q->read_uids[i];
         *q->read_uids[i] = 0;
 
         // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
+        uint64_t polling = q->read_polling[i]->exchange(0);
+        if (polling) {
+          msgq_wake_poller(polling, old_uid);
+        }
       }
+      msgq_notify(q);
 
       continue;
     }
@@ -208,6 +493,7 @@ void msgq_init_subscriber(msgq_queue_t * q) {
       // on the first read the read pointer will be synchronized with the write pointer
       *q->read_valids[cur_num_readers] = false;
       *q->read_pointers[cur_num_readers] = 0;
+      *q->read_polling[cur_num_readers] = false;
       *q->read_uids[cur_num_readers] = uid;
       break;
     }
@@ -217,15 +503,15 @@ void msgq_init_subscriber(msgq_queue_t * q) {
   msgq_reset_reader(q);
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+char *msgq_msg_reserve(msgq_queue_t *q, size_t size){
   // Die if we are no longer the active publisher
   if (q->write_uid_local != *q->write_uid){
     std::cout << "Killing old publisher: " << q->endpoint << std::endl;
     errno = EADDRINUSE;
-    return -1;
+    return nullptr;
   }
 
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+  uint64_t total_msg_size = ALIGN(size + sizeof(int64_t));
 
   // We need to fit at least three messages in the queue,
   // then we can always safely access the last message
@@ -268,7 +554,7 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
 
   // Invalidate readers that are in the area that will be written
   uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  uint64_t end = ALIGN(start + sizeof(int64_t) + size);
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
@@ -279,26 +565,51 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
     }
   }
 
+  q->reserved_size = size;
+  return p + sizeof(int64_t);
+}
 
-  // Write size tag
-  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
-  *size_p = msg->size;
+int msgq_msg_commit(msgq_queue_t *q, size_t size){
+  // The reserved area starts at the write pointer, readers don't look past it until it moves
+  assert(size <= q->reserved_size);
+  q->reserved_size = 0;
 
-  // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  // Write size tag
+  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(q->data + write_pointer);
+  *size_p = size;
   __sync_synchronize();
 
   // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
+  uint32_t new_ptr = ALIGN(write_pointer + size + sizeof(int64_t));
   PACK64(*q->write_pointer, write_cycles, new_ptr);
 
-  // Notify readers
+  // Notify readers. Single queue pollers block on the futex, only readers
+  // waiting on multiple queues at once still need to be signaled
+  msgq_notify(q);
   for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+    uint64_t polling = *q->read_polling[i];
+    if (polling) {
+      msgq_wake_poller(polling, *q->read_uids[i]);
+    }
   }
 
-  return msg->size;
+  return size;
+}
+
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  char *p = msgq_msg_reserve(q, msg->size);
+  if (p == nullptr){
+    return -1;
+  }
+
+  // Copy data
+  memcpy(p, msg->data, msg->size);
+  return msgq_msg_commit(q, msg->size);
 }
 
 
@@ -331,7 +642,7 @@ int msgq_msg_ready(msgq_queue_t * q){
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+static int msgq_msg_recv_impl(msgq_msg_t * msg, msgq_queue_t * q, bool borrow){
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
@@ -396,6 +707,16 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     }
   }
 
+  // Hand out a pointer into the ring. The read pointer stays on this message until
+  // the view is released, so the writer invalidates us if it gets overwritten
+  if (borrow){
+    msg->size = size;
+    msg->data = p + sizeof(int64_t);
+    PACK64(q->view_read_pointer, read_cycles, new_read_pointer);
+    __sync_synchronize();
+    return msg->size;
+  }
+
   // Copy message
   if (msgq_msg_init_size(msg, size) < 0)
     return -1;
@@ -418,11 +739,187 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   return msg->size;
 }
 
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  return msgq_msg_recv_impl(msg, q, false);
+}
+
+int msgq_msg_recv_view(msgq_msg_t * msg, msgq_queue_t * q){
+  return msgq_msg_recv_impl(msg, q, true);
+}
+
+bool msgq_msg_release_view(msgq_queue_t * q){
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  __sync_synchronize();
 
+  // Data is only intact if we were neither evicted nor invalidated while holding the view
+  if (q->read_uid_local != *q->read_uids[id] || !*q->read_valids[id]){
+    return false;
+  }
+
+  *q->read_pointers[id] = q->view_read_pointer;
+  return true;
+}
+
+#ifdef __linux__
+static int msgq_poll_futex(msgq_pollitem_t * item, int timeout){
+  msgq_queue_t *q = item->q;
+
+  // With an infinite timeout still wake up periodically, in case a wakeup was missed
+  int ms = (timeout == -1) ? 100 : timeout;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+
+  while (true) {
+    // Sample the futex word before checking, a send in between makes the wait return immediately
+    uint32_t seq = *q->notify_seq;
+    item->revents = msgq_msg_ready(q);
+    if (item->revents) {
+      return 1;
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      if (timeout != -1) {
+        return 0;
+      }
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+      continue;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = remaining / 1000000000;
+    ts.tv_nsec = remaining % 1000000000;
+
+    (*q->notify_waiters)++;
+    futex_wait(q->notify_seq, seq, &ts);
+    (*q->notify_waiters)--;
+  }
+}
+#endif
+
+static void msgq_set_polling(msgq_queue_t *q, uint64_t polling){
+  int id = q->reader_id;
+  if (id >= 0 && q->read_uid_local == *q->read_uids[id]) {
+    *q->read_polling[id] = polling;
+  }
+}
+
+static void msgq_set_polling(msgq_pollitem_t * items, size_t nitems, bool polling){
+  for (size_t i = 0; i < nitems; i++) {
+    msgq_set_polling(items[i].q, polling);
+  }
+}
+
+#ifdef __linux__
+static int msgq_poll_multi(msgq_pollitem_t * items, size_t nitems, int timeout, msgq_poll_slot_owner *owner){
+  msgq_poll_slot_t *slot = owner->slot;
+  const uint64_t slot_id = slot - msgq_poll_table();
+  auto polling = [=](size_t i) { return ((slot_id + 1) << 32) | (i % MSGQ_POLL_ITEMS); };
+
+  // Registered before checking, so a message sent in between sets its bit
+  auto check = [&](size_t i) {
+    msgq_queue_t *q = items[i].q;
+    uint64_t uid = q->read_uid_local;
+    msgq_set_polling(q, polling(i));
+    items[i].revents = msgq_msg_ready(q);
+    if (!items[i].revents && q->read_uid_local != uid) {
+      // Reconnected after an eviction, the new reader slot isn't registered yet
+      msgq_set_polling(q, polling(i));
+      items[i].revents = msgq_msg_ready(q);
+    }
+    return items[i].revents;
+  };
+  auto check_all = [&]() {
+    int n = 0;
+    for (size_t i = 0; i < nitems; i++) {
+      n += check(i);
+    }
+    return n;
+  };
+
+  int num = 0;
+  bool registered = owner->readers.size() == nitems;
+  for (size_t i = 0; i < nitems; i++) {
+    registered = registered && owner->readers[i] == std::pair{items[i].q, items[i].q->read_uid_local};
+    items[i].revents = 0;
+  }
+  if (!registered) {
+    // New readers, register them all and check everything once
+    for (auto &ready : slot->ready) {
+      ready = 0;
+    }
+    num = check_all();
+    owner->readers.resize(nitems);
+    for (size_t i = 0; i < nitems; i++) {
+      owner->readers[i] = {items[i].q, items[i].q->read_uid_local};
+    }
+  }
+
+  // Check everything when the timeout expires, in case a wakeup was missed. With an infinite
+  // timeout that's every 100ms
+  int ms = (timeout == -1) ? 100 : timeout;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+
+  while (num == 0) {
+    // Sample the futex word before taking the bits, a bit set after that makes the wait return immediately
+    uint32_t seq = slot->seq;
+    for (size_t w = 0; w < MSGQ_POLL_ITEMS / 64; w++) {
+      for (uint64_t bits = slot->ready[w].exchange(0); bits != 0; bits &= bits - 1) {
+        for (size_t i = w * 64 + __builtin_ctzll(bits); i < nitems; i += MSGQ_POLL_ITEMS) {
+          num += check(i);
+        }
+      }
+    }
+    if (num > 0) {
+      break;
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      num = check_all();
+      if (timeout != -1) {
+        break;
+      }
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+      continue;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = remaining / 1000000000;
+    ts.tv_nsec = remaining % 1000000000;
+
+    slot->waiters++;
+    futex_wait(&slot->seq, seq, &ts);
+    slot->waiters--;
+  }
+
+  // The caller might not drain the ready queues, look at them again next time
+  for (size_t i = 0; i < nitems; i++) {
+    if (items[i].revents) {
+      slot->ready[(i % MSGQ_POLL_ITEMS) / 64] |= 1ULL << (i % 64);
+    }
+  }
+  return num;
+}
+#endif
 
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+  #ifdef __linux__
+    if (nitems == 1) {
+      return msgq_poll_futex(items, timeout);
+    }
+    if (msgq_poll_slot_owner *owner = msgq_thread_poll_slot()) {
+      return msgq_poll_multi(items, nitems, timeout, owner);
+    }
+  #endif
+
+  // Fall back to signals, no futexes or no free poll slot
   int num = 0;
 
+  // Ask publishers to signal us before checking, so a message sent in between is not missed
+  msgq_set_polling(items, nitems, true);
+
   // Check if messages ready
   for (size_t i = 0; i < nitems; i++) {
     items[i].revents = msgq_msg_ready(items[i].q);
@@ -438,6 +935,9 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
   while (num == 0) {
     int ret;
 
+    // Readers might have been re-initialized by msgq_msg_ready
+    msgq_set_polling(items, nitems, true);
+
     ret = nanosleep(&ts, &ts);
 
     // Check if messages ready
@@ -454,6 +954,8 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
     }
   }
 
+  msgq_set_polling(items, nitems, false);
+
   return num;
 }
 
@@ -466,3 +968,13 @@ bool msgq_all_readers_updated(msgq_queue_t *q) {
   }
   return num_readers > 0;
 }
+
+bool msgq_has_readers(msgq_queue_t *q) {
+  uint64_t num_readers = *q->num_readers;
+  for (uint64_t i = 0; i < num_readers; i++) {
+    if (*q->read_valids[i]) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -4,37 +4,78 @@
 #include <cstring>
 #include <string>
 #include <atomic>
+#include <vector>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 12
+#define DEFAULT_NUM_READERS 32
+#define MAX_NUM_READERS 256
+#define CACHE_LINE_SIZE 64
+#define MSGQ_VERSION 2
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
 #define UNUSED(x) (void)x
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
 #define PACK64(output, higher, lower) output = ((uint64_t)higher << 32) | ((uint64_t)lower & 0xFFFFFFFF)
 
-struct  msgq_header_t {
-  uint64_t num_readers;
-  uint64_t write_pointer;
+// Shared memory layout: msgq_header_t, max_readers msgq_reader_t slots, then the data segment.
+// Fields are grouped by who writes them, so the writer and readers don't false-share a cache line.
+// Bump MSGQ_VERSION on layout changes, queues with another version are reinitialized on open
+struct msgq_header_t {
+  // Set once at creation
+  alignas(CACHE_LINE_SIZE) uint64_t version;
+  uint64_t max_readers;
+
+  // Written by the publisher
+  alignas(CACHE_LINE_SIZE) uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  uint32_t notify_seq; // futex word, bumped on every send
+
+  // Written by subscribers
+  alignas(CACHE_LINE_SIZE) uint64_t num_readers;
+  uint32_t notify_waiters; // number of readers blocked on notify_seq
+};
+
+// Each reader owns a full cache line, so readers advancing their pointer don't false-share
+struct alignas(CACHE_LINE_SIZE) msgq_reader_t {
+  uint64_t read_pointer;
+  uint64_t read_valid;
+  uint64_t read_uid;
+  uint64_t read_polling; // poll slot and item of a reader in a multi-queue poll, 0 if not polling
+};
+
+#define MSGQ_POLL_SLOTS 1024
+#define MSGQ_POLL_ITEMS 256
+
+// A thread in a multi-queue poll owns a slot of a table in shared memory. Publishers set the
+// bit of the item their queue has in the poll and wake the slot's futex, so the poller only
+// checks the queues that got a message.
+struct alignas(CACHE_LINE_SIZE) msgq_poll_slot_t {
+  std::atomic<uint64_t> owner_uid;
+  std::atomic<uint32_t> seq; // futex word, bumped when a bit is set
+  std::atomic<uint32_t> waiters;
+  std::atomic<uint64_t> ready[MSGQ_POLL_ITEMS / 64]; // item i is bit i % MSGQ_POLL_ITEMS
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::vector<std::atomic<uint64_t> *> read_pointers;
+  std::vector<std::atomic<uint64_t> *> read_valids;
+  std::vector<std::atomic<uint64_t> *> read_uids;
+  std::vector<std::atomic<uint64_t> *> read_polling;
+  std::atomic<uint32_t> *notify_seq;
+  std::atomic<uint32_t> *notify_waiters;
   char * mmap_p;
+  size_t mmap_size;
   char * data;
   size_t size;
+  size_t max_readers;
   int reader_id;
   uint64_t read_uid_local;
   uint64_t write_uid_local;
+  size_t reserved_size;
+  uint64_t view_read_pointer;
 
   bool read_conflate;
   std::string endpoint;
@@ -57,14 +98,21 @@ int msgq_msg_init_size(msgq_msg_t *msg, size_t size);
 int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t num_readers = DEFAULT_NUM_READERS);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
 void msgq_init_subscriber(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+// Publish in place: reserve room for a message of up to size bytes and write it at the returned
+// pointer, then commit the bytes actually written. nullptr if we're no longer the publisher.
+char *msgq_msg_reserve(msgq_queue_t *q, size_t size);
+int msgq_msg_commit(msgq_queue_t *q, size_t size);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+int msgq_msg_recv_view(msgq_msg_t *msg, msgq_queue_t *q);
+bool msgq_msg_release_view(msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
 bool msgq_all_readers_updated(msgq_queue_t *q);
+bool msgq_has_readers(msgq_queue_t *q);
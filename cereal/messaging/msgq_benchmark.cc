@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cereal/messaging/msgq.h"
+
+// Publish-to-receive latency of msgq wakeups.
+// A single queue poll blocks on the futex in the queue header, polling two queues
+// at once blocks on the futex of the thread's poll slot. The SIGUSR2 path is the
+// fallback when no poll slot is free, measured by polling two queues in a child
+// process run with MSGQ_NO_POLL_SLOTS.
+//
+// Throughput with several readers busy reading the same queue, which shows
+// contention on the shared header. The publisher waits for the readers every
+// batch, well within the ring, so nothing is lapped and every reader reads every message.
+//
+// loggerd's poll: one thread polling ~100 queues at once and draining the ready ones,
+// while a publisher sends to one queue at a time.
+
+const int NUM_MSGS = 5000;
+const int PUBLISH_INTERVAL_US = 1000;
+
+const int THROUGHPUT_NUM_MSGS = 1000000;
+const int THROUGHPUT_MSG_SIZE = 256;
+const int THROUGHPUT_BATCH = 1000;
+
+const int POLL_NUM_QUEUES = 100;
+const int POLL_NUM_MSGS = 20000;
+const int POLL_PUBLISH_INTERVAL_US = 100;
+
+static uint64_t nanos_since_boot() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void publisher_thread(const std::string &endpoint, std::atomic<bool> *ready) {
+  msgq_queue_t q;
+  int r = msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  assert(r == 0);
+  UNUSED(r);
+  msgq_init_publisher(&q);
+  ready->store(true);
+  msgq_wait_for_subscriber(&q);
+
+  for (int i = 0; i < NUM_MSGS; i++) {
+    std::this_thread::sleep_for(std::chrono::microseconds(PUBLISH_INTERVAL_US));
+
+    uint64_t t = nanos_since_boot();
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char *)&t, sizeof(t));
+    msgq_msg_send(&msg, &q);
+    msgq_msg_close(&msg);
+  }
+
+  msgq_close_queue(&q);
+}
+
+static std::vector<double> run(const std::string &name, bool multi_queue) {
+  std::string endpoint = "msgq_benchmark_" + name;
+  std::string idle_endpoint = endpoint + "_idle";
+
+  std::atomic<bool> ready = false;
+  std::thread publisher(publisher_thread, endpoint, &ready);
+  while (!ready) std::this_thread::yield();
+
+  msgq_queue_t q, idle_q;
+  int r = msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  r |= msgq_new_queue(&idle_q, idle_endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  assert(r == 0);
+  UNUSED(r);
+  msgq_init_subscriber(&q);
+  msgq_init_subscriber(&idle_q);
+
+  msgq_pollitem_t items[2];
+  items[0].q = &q;
+  items[1].q = &idle_q;
+
+  std::vector<double> latencies;
+  latencies.reserve(NUM_MSGS);
+  while ((int)latencies.size() < NUM_MSGS) {
+    int n = msgq_poll(items, multi_queue ? 2 : 1, 1000);
+    if (n == 0) break;
+
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &q) > 0) {
+      uint64_t t = *(uint64_t *)msg.data;
+      latencies.push_back((nanos_since_boot() - t) / 1e3);
+      msgq_msg_close(&msg);
+    }
+  }
+
+  publisher.join();
+  msgq_close_queue(&q);
+  msgq_close_queue(&idle_q);
+  return latencies;
+}
+
+// MSGQ_NO_POLL_SLOTS is read once per process, so the signal run gets its own
+static std::vector<double> run_signal() {
+  int fds[2];
+  int r = pipe(fds);
+  assert(r == 0);
+  UNUSED(r);
+
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    close(fds[0]);
+    setenv("MSGQ_NO_POLL_SLOTS", "1", 1);
+    std::vector<double> latencies = run("signal", true);
+    const char *p = (const char *)latencies.data();
+    size_t remaining = latencies.size() * sizeof(double);
+    while (remaining > 0) {
+      ssize_t n = write(fds[1], p, remaining);
+      if (n <= 0) _exit(1);
+      p += n;
+      remaining -= n;
+    }
+    _exit(0);
+  }
+
+  close(fds[1]);
+  std::vector<char> buf;
+  char chunk[4096];
+  ssize_t n;
+  while ((n = read(fds[0], chunk, sizeof(chunk))) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  close(fds[0]);
+  waitpid(pid, nullptr, 0);
+
+  std::vector<double> latencies(buf.size() / sizeof(double));
+  memcpy(latencies.data(), buf.data(), latencies.size() * sizeof(double));
+  return latencies;
+}
+
+static void report(const char *name, std::vector<double> latencies) {
+  if (latencies.empty()) {
+    printf("%-8s no messages received\n", name);
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+  printf("%-8s n=%zu p50=%.1fus p99=%.1fus max=%.1fus\n", name, latencies.size(), percentile(0.5), percentile(0.99), latencies.back());
+}
+
+static void reader_thread(const std::string &endpoint, std::atomic<int> *ready, std::atomic<bool> *done, uint64_t *received) {
+  msgq_queue_t q;
+  int r = msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  assert(r == 0);
+  UNUSED(r);
+  msgq_init_subscriber(&q);
+  (*ready)++;
+
+  msgq_msg_t msg;
+  while (!*done) {
+    while (msgq_msg_recv(&msg, &q) > 0) {
+      (*received)++;
+      msgq_msg_close(&msg);
+    }
+  }
+
+  msgq_close_queue(&q);
+}
+
+static void throughput(int num_readers) {
+  std::string endpoint = "msgq_benchmark_throughput_" + std::to_string(num_readers);
+
+  msgq_queue_t q;
+  int r = msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  assert(r == 0);
+  UNUSED(r);
+  msgq_init_publisher(&q);
+
+  std::atomic<int> ready = 0;
+  std::atomic<bool> done = false;
+  std::vector<uint64_t> received(num_readers);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < num_readers; i++) {
+    readers.emplace_back(reader_thread, endpoint, &ready, &done, &received[i]);
+  }
+  while (ready < num_readers) std::this_thread::yield();
+
+  std::vector<char> data(THROUGHPUT_MSG_SIZE);
+  msgq_msg_t msg;
+  msg.data = data.data();
+  msg.size = data.size();
+
+  uint64_t start = nanos_since_boot();
+  for (int i = 0; i < THROUGHPUT_NUM_MSGS; i++) {
+    msgq_msg_send(&msg, &q);
+    if ((i + 1) % THROUGHPUT_BATCH == 0) {
+      while (!msgq_all_readers_updated(&q)) std::this_thread::yield();
+    }
+  }
+  double seconds = (nanos_since_boot() - start) / 1e9;
+
+  done = true;
+  for (auto &t : readers) t.join();
+  msgq_close_queue(&q);
+
+  uint64_t total = 0;
+  for (auto n : received) total += n;
+  printf("%2d readers: send %.2f Mmsg/s, receive %.2f Mmsg/s per reader (%.1f%% received)\n",
+         num_readers, THROUGHPUT_NUM_MSGS / seconds / 1e6, total / num_readers / seconds / 1e6,
+         100.0 * total / num_readers / THROUGHPUT_NUM_MSGS);
+}
+
+static uint64_t thread_cpu_nanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void poll_publisher_thread(int num_queues, std::atomic<bool> *ready) {
+  std::vector<msgq_queue_t> queues(num_queues);
+  for (int i = 0; i < num_queues; i++) {
+    std::string endpoint = "msgq_benchmark_poll_" + std::to_string(i);
+    int r = msgq_new_queue(&queues[i], endpoint.c_str(), 1024 * 1024);
+    assert(r == 0);
+    UNUSED(r);
+    msgq_init_publisher(&queues[i]);
+  }
+  ready->store(true);
+  for (auto &q : queues) msgq_wait_for_subscriber(&q);
+
+  for (int i = 0; i < POLL_NUM_MSGS; i++) {
+    std::this_thread::sleep_for(std::chrono::microseconds(POLL_PUBLISH_INTERVAL_US));
+
+    uint64_t t = nanos_since_boot();
+    msgq_msg_t msg = {.size = sizeof(t), .data = (char *)&t};
+    msgq_msg_send(&msg, &queues[(i * 7) % num_queues]);
+  }
+
+  for (auto &q : queues) msgq_close_queue(&q);
+}
+
+static void poll_all(int num_queues) {
+  std::atomic<bool> ready = false;
+  std::thread publisher(poll_publisher_thread, num_queues, &ready);
+  while (!ready) std::this_thread::yield();
+
+  std::vector<msgq_queue_t> queues(num_queues);
+  std::vector<msgq_pollitem_t> items(num_queues);
+  for (int i = 0; i < num_queues; i++) {
+    std::string endpoint = "msgq_benchmark_poll_" + std::to_string(i);
+    int r = msgq_new_queue(&queues[i], endpoint.c_str(), 1024 * 1024);
+    assert(r == 0);
+    UNUSED(r);
+    msgq_init_subscriber(&queues[i]);
+    items[i].q = &queues[i];
+  }
+
+  std::vector<double> latencies;
+  latencies.reserve(POLL_NUM_MSGS);
+  uint64_t polls = 0, cpu_start = thread_cpu_nanos();
+  while ((int)latencies.size() < POLL_NUM_MSGS) {
+    int n = msgq_poll(items.data(), items.size(), 1000);
+    if (n == 0) break;
+
+    polls++;
+    for (auto &item : items) {
+      if (!item.revents) continue;
+
+      msgq_msg_t msg;
+      while (msgq_msg_recv(&msg, item.q) > 0) {
+        uint64_t t = *(uint64_t *)msg.data;
+        latencies.push_back((nanos_since_boot() - t) / 1e3);
+        msgq_msg_close(&msg);
+      }
+    }
+  }
+  double cpu_us = (thread_cpu_nanos() - cpu_start) / 1e3;
+
+  publisher.join();
+  for (auto &q : queues) msgq_close_queue(&q);
+
+  report("poll", latencies);
+  printf("%-8s %zu wakeups, poller cpu %.2fus per message\n", "", (size_t)polls, cpu_us / std::max<size_t>(1, latencies.size()));
+}
+
+int main() {
+  printf("publish-to-receive latency, %d msgs every %dus\n", NUM_MSGS, PUBLISH_INTERVAL_US);
+  // before this process polls, so the child doesn't inherit a poll slot
+  std::vector<double> signal_latencies = run_signal();
+  report("futex", run("futex", false));
+  report("slot", run("slot", true));
+  report("signal", signal_latencies);
+
+  printf("\nthroughput, %d msgs of %d bytes\n", THROUGHPUT_NUM_MSGS, THROUGHPUT_MSG_SIZE);
+  for (int num_readers : {1, 4, 12}) {
+    throughput(num_readers);
+  }
+
+  printf("\npoll on %d queues, %d msgs every %dus\n", POLL_NUM_QUEUES, POLL_NUM_MSGS, POLL_PUBLISH_INTERVAL_US);
+  poll_all(POLL_NUM_QUEUES);
+  return 0;
+}
@@ -0,0 +1,254 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/impl_msgq.h"
+#include "cereal/messaging/msgq.h"
+
+static std::string shm_path(const std::string &name) {
+  const char *prefix = std::getenv("OPENPILOT_PREFIX");
+  return "/dev/shm/" + (prefix ? std::string(prefix) + "/" : "") + name;
+}
+
+static ino_t shm_inode(const std::string &name) {
+  struct stat st = {};
+  REQUIRE(stat(shm_path(name).c_str(), &st) == 0);
+  return st.st_ino;
+}
+
+TEST_CASE("msgq_new_queue sizes the reader table from the header"){
+  const std::string name = "msgq_test_reader_table";
+  unlink(shm_path(name).c_str());
+
+  msgq_queue_t q1, q2;
+  REQUIRE(msgq_new_queue(&q1, name.c_str(), 1024, 4) == 0);
+  REQUIRE(q1.max_readers == 4);
+
+  // later openers take the size the queue was created with
+  REQUIRE(msgq_new_queue(&q2, name.c_str(), 1024) == 0);
+  REQUIRE(q2.max_readers == 4);
+  REQUIRE(q2.mmap_size == q1.mmap_size);
+  REQUIRE(q2.data - q2.mmap_p == q1.data - q1.mmap_p);
+
+  msgq_init_publisher(&q1);
+  msgq_init_subscriber(&q2);
+  msgq_msg_t msg = {.size = 5, .data = (char *)"hello"};
+  REQUIRE(msgq_msg_send(&msg, &q1) == 5);
+
+  msgq_msg_t recv;
+  REQUIRE(msgq_msg_recv(&recv, &q2) == 5);
+  REQUIRE(memcmp(recv.data, "hello", 5) == 0);
+  msgq_msg_close(&recv);
+
+  msgq_close_queue(&q1);
+  msgq_close_queue(&q2);
+  unlink(shm_path(name).c_str());
+}
+
+TEST_CASE("msgq_init_subscriber reclaims slots of gone readers"){
+  const std::string name = "msgq_test_reclaim";
+  unlink(shm_path(name).c_str());
+
+  msgq_queue_t pub, sub1, sub2;
+  REQUIRE(msgq_new_queue(&pub, name.c_str(), 1024, 2) == 0);
+  REQUIRE(msgq_new_queue(&sub1, name.c_str(), 1024) == 0);
+  REQUIRE(msgq_new_queue(&sub2, name.c_str(), 1024) == 0);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub1);
+  const uint64_t sub1_uid = sub1.read_uid_local;
+
+  SECTION("a reader that died"){
+    // the child's thread id is dead once it's reaped
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+      msgq_queue_t child;
+      msgq_new_queue(&child, name.c_str(), 1024);
+      msgq_init_subscriber(&child);
+      _exit(child.reader_id == 1 ? 0 : 1);
+    }
+    int status = 0;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(*pub.num_readers == 2);
+
+    msgq_init_subscriber(&sub2);
+    REQUIRE(sub2.reader_id == 1);
+  }
+
+  SECTION("a reader that closed the queue"){
+    msgq_queue_t closed;
+    REQUIRE(msgq_new_queue(&closed, name.c_str(), 1024) == 0);
+    msgq_init_subscriber(&closed);
+    REQUIRE(closed.reader_id == 1);
+    msgq_close_queue(&closed);
+
+    msgq_init_subscriber(&sub2);
+    REQUIRE(sub2.reader_id == 1);
+  }
+
+  // the live reader wasn't evicted to make room
+  REQUIRE(*pub.num_readers == 2);
+  REQUIRE(*sub1.read_uids[0] == sub1_uid);
+  msgq_msg_t msg = {.size = 3, .data = (char *)"abc"};
+  REQUIRE(msgq_msg_send(&msg, &pub) == 3);
+  for (msgq_queue_t *q : {&sub1, &sub2}) {
+    msgq_msg_t recv;
+    REQUIRE(msgq_msg_recv(&recv, q) == 3);
+    msgq_msg_close(&recv);
+  }
+
+  msgq_close_queue(&pub);
+  msgq_close_queue(&sub1);
+  msgq_close_queue(&sub2);
+  unlink(shm_path(name).c_str());
+}
+
+TEST_CASE("msgq_new_queue replaces a queue of another version"){
+  const std::string name = "msgq_test_version";
+  const std::string path = shm_path(name);
+  unlink(path.c_str());
+
+  msgq_queue_t old_q;
+  REQUIRE(msgq_new_queue(&old_q, name.c_str(), 1024, 4) == 0);
+  const ino_t old_inode = shm_inode(name);
+  msgq_header_t *old_header = (msgq_header_t *)old_q.mmap_p;
+
+  SECTION("same size, older version"){
+    old_header->version = MSGQ_VERSION - 1;
+  }
+  SECTION("same version, different size"){
+    // grown, shrinking it would SIGBUS our own mapping
+    REQUIRE(truncate(path.c_str(), old_q.mmap_size + 4096) == 0);
+  }
+
+  msgq_queue_t q;
+  REQUIRE(msgq_new_queue(&q, name.c_str(), 1024, 8) == 0);
+  REQUIRE(shm_inode(name) != old_inode);
+  REQUIRE(((msgq_header_t *)q.mmap_p)->version == MSGQ_VERSION);
+  REQUIRE(q.max_readers == 8);
+
+  // whoever still has the old queue mapped can keep touching it
+  old_header->write_pointer = 0;
+  REQUIRE(old_header->max_readers == 4);
+
+  msgq_close_queue(&old_q);
+  msgq_close_queue(&q);
+  unlink(path.c_str());
+}
+
+TEST_CASE("MSGQSubSocket::releaseView checks the view wasn't overwritten"){
+  const std::string name = "msgq_test_view";
+  unlink(shm_path(name).c_str());
+
+  MSGQContext ctx;
+  MSGQPubSocket pub;
+  MSGQSubSocket sub;
+  REQUIRE(pub.connect(&ctx, name, false) == 0);
+  REQUIRE(sub.connect(&ctx, name, "127.0.0.1", false, false) == 0);
+
+  const std::string msg(1024, 'a');
+  REQUIRE(pub.send((char *)msg.data(), msg.size()) == (int)msg.size());
+  auto view = sub.receiveView(true);
+  REQUIRE(view.size() * sizeof(capnp::word) == msg.size());
+  REQUIRE(memcmp(view.begin(), msg.data(), msg.size()) == 0);
+
+  SECTION("intact"){
+    REQUIRE(sub.releaseView());
+    // a released view isn't received again
+    REQUIRE(sub.receiveView(true).size() == 0);
+  }
+
+  SECTION("the publisher wrapped over it"){
+    const std::string big(1024 * 1024, 'b');
+    for (size_t sent = 0; sent <= DEFAULT_SEGMENT_SIZE; sent += big.size()) {
+      REQUIRE(pub.send((char *)big.data(), big.size()) == (int)big.size());
+    }
+    REQUIRE(!sub.releaseView());
+
+    // like any lapped reader, it skips ahead to the write pointer on its next read
+    REQUIRE(sub.receiveView(true).size() == 0);
+    REQUIRE(pub.send((char *)msg.data(), msg.size()) == (int)msg.size());
+    view = sub.receiveView(true);
+    REQUIRE(view.size() * sizeof(capnp::word) == msg.size());
+    REQUIRE(memcmp(view.begin(), msg.data(), msg.size()) == 0);
+    REQUIRE(sub.releaseView());
+  }
+
+  unlink(shm_path(name).c_str());
+}
+
+TEST_CASE("msgq_msg_reserve and msgq_msg_commit"){
+  const std::string name = "msgq_test_reserve";
+  unlink(shm_path(name).c_str());
+
+  const size_t queue_size = 1024;
+  msgq_queue_t pub, sub;
+  REQUIRE(msgq_new_queue(&pub, name.c_str(), queue_size) == 0);
+  REQUIRE(msgq_new_queue(&sub, name.c_str(), queue_size) == 0);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  auto publish = [&](size_t reserve, const std::string &data) {
+    char *p = msgq_msg_reserve(&pub, reserve);
+    REQUIRE(p != nullptr);
+    memcpy(p, data.data(), data.size());
+    return msgq_msg_commit(&pub, data.size());
+  };
+  auto receive = [&]() {
+    msgq_msg_t msg;
+    int r = msgq_msg_recv(&msg, &sub);
+    std::string data(r > 0 ? msg.data : "", r > 0 ? r : 0);
+    msgq_msg_close(&msg);
+    return data;
+  };
+
+  SECTION("committing less than was reserved"){
+    REQUIRE(publish(200, "short") == 5);
+    REQUIRE(publish(200, "next") == 4);
+    REQUIRE(receive() == "short");
+    REQUIRE(receive() == "next");
+    REQUIRE(receive() == "");
+  }
+
+  SECTION("a reserve that wraps around"){
+    // moves the write pointer close to the end, then reserves more than is left
+    const std::string filler(230, 'f');
+    for (int i = 0; i < 3; i++) {
+      REQUIRE(publish(filler.size(), filler) == (int)filler.size());
+      REQUIRE(receive() == filler);
+    }
+
+    const uint64_t cycles_before = *pub.write_pointer >> 32;
+    const std::string data(320, 'w');
+    char *p = msgq_msg_reserve(&pub, data.size());
+    REQUIRE(p == pub.data + sizeof(int64_t));
+    REQUIRE((*pub.write_pointer >> 32) == cycles_before + 1);
+    memcpy(p, data.data(), data.size());
+    REQUIRE(msgq_msg_commit(&pub, 10) == 10);
+    REQUIRE(receive() == data.substr(0, 10));
+  }
+
+  SECTION("a publisher that was replaced"){
+    msgq_queue_t new_pub;
+    REQUIRE(msgq_new_queue(&new_pub, name.c_str(), queue_size) == 0);
+    msgq_init_publisher(&new_pub);
+
+    errno = 0;
+    REQUIRE(msgq_msg_reserve(&pub, 10) == nullptr);
+    REQUIRE(errno == EADDRINUSE);
+    msgq_close_queue(&new_pub);
+  }
+
+  msgq_close_queue(&pub);
+  msgq_close_queue(&sub);
+  unlink(shm_path(name).c_str());
+}
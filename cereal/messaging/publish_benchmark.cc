@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+
+// Publish throughput by message size, serializing a MessageBuilder to a flat array and
+// sending that copy, against serializing it straight into the reserved queue slot.
+
+const size_t TOTAL_BYTES = 2ULL * 1024 * 1024 * 1024;
+const int MAX_NUM_MSGS = 200000;
+
+static uint64_t nanos_since_boot() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double throughput(PubMaster &pm, MessageBuilder &msg, int num_msgs, bool in_place) {
+  uint64_t start = nanos_since_boot();
+  for (int i = 0; i < num_msgs; i++) {
+    if (in_place) {
+      pm.send("thumbnail", msg);
+    } else {
+      auto bytes = msg.toBytes();
+      pm.send("thumbnail", bytes.begin(), bytes.size());
+    }
+  }
+  return num_msgs / ((nanos_since_boot() - start) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+  PubMaster pm({"thumbnail"});
+
+  printf("%10s %16s %16s %8s\n", "size", "copy (msg/s)", "in place (msg/s)", "speedup");
+  for (size_t size : {64, 1024, 16 * 1024, 256 * 1024, 1024 * 1024}) {
+    MessageBuilder msg;
+    auto data = msg.initEvent().initThumbnail().initThumbnail(size);
+    for (size_t i = 0; i < size; i++) {
+      data[i] = i;
+    }
+
+    const int num_msgs = std::min<size_t>(MAX_NUM_MSGS, TOTAL_BYTES / size);
+    double copy = throughput(pm, msg, num_msgs, false);
+    double in_place = throughput(pm, msg, num_msgs, true);
+    printf("%10zu %16.0f %16.0f %7.2fx\n", msg.getSerializedSize(), copy, in_place, in_place / copy);
+  }
+  return 0;
+}
@@ -46,7 +46,8 @@ struct SubMaster::SubMessage {
   void *allocated_msg_reader = nullptr;
   bool is_polled = false;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
-  AlignedBuffer aligned_buf;
+  AlignedBuffer aligned_buf[2];
+  int cur_buf = 0;
   cereal::Event::Reader event;
 };
 
@@ -91,16 +92,21 @@ void SubMaster::update(int timeout) {
   std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
 
   for (auto s : sockets) {
-    Message *msg = s->receive(true);
-    if (msg == nullptr) continue;
+    auto view = s->receiveView(true);
+    if (view.size() == 0) continue;
 
     SubMessage *m = messages_.at(s);
 
+    // The event is read until the next update, so copy it out of the queue once.
+    // Copy into the spare buffer, the current event stays intact if the view was overwritten
+    auto words = m->aligned_buf[m->cur_buf ^ 1].align((const char *)view.begin(), view.asBytes().size());
+    if (!s->releaseView()) continue;
+    m->cur_buf ^= 1;
+
     m->msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
+    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(words, options);
     messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
   }
 
@@ -201,8 +207,17 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
 }
 
 int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  // the segments are serialized straight into the queue, without a flat copy in between
+  PubSocket *socket = sockets_.at(name);
+  const size_t size = msg.getSerializedSize();
+  char *buf = socket->reserve(size);
+  if (buf == nullptr) {
+    return -1;
+  }
+  // serializeToBuffer() would compute the size again
+  kj::ArrayOutputStream out(kj::ArrayPtr<capnp::byte>((capnp::byte *)buf, size));
+  capnp::writeMessage(out, msg);
+  return socket->commit(size);
 }
 
 PubMaster::~PubMaster() {
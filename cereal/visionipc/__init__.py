@@ -1,6 +1,7 @@
-from cereal.visionipc.visionipc_pyx import VisionBuf, VisionIpcClient, VisionIpcServer, VisionStreamType, get_endpoint_name
+from cereal.visionipc.visionipc_pyx import VisionBuf, VisionIpcClient, VisionIpcMultiClient, VisionIpcServer, VisionStreamType, get_endpoint_name
 assert VisionBuf
 assert VisionIpcClient
+assert VisionIpcMultiClient
 assert VisionIpcServer
 assert VisionStreamType
 assert get_endpoint_name
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 
 constexpr int VISIONIPC_MAX_FDS = 128;
+constexpr int VISIONIPC_MAX_CLIENTS = 16;
 
 struct VisionIpcBufExtra {
   uint32_t frame_id;
@@ -15,5 +17,49 @@ struct VisionIpcBufExtra {
 struct VisionIpcPacket {
   uint64_t server_id;
   size_t idx;
+  uint64_t seq;        // the lease table seq of the buffer when it was sent
+  uint64_t send_time;  // CLOCK_BOOTTIME
   struct VisionIpcBufExtra extra;
 };
+
+// A client's slot in the lease table. The client leases the buffer it last received,
+// the server doesn't hand out leased buffers for writing unless all of them are leased.
+struct VisionIpcLeaseClient {
+  std::atomic<int32_t> pid;  // 0 when the slot is free
+  std::atomic<uint32_t> leased[VISIONIPC_MAX_FDS / 32];
+  std::atomic<uint64_t> frames;
+  std::atomic<uint64_t> dropped;      // the buffer was reused before the client could lease it
+  std::atomic<uint64_t> overwritten;  // the buffer was reused while leased
+  std::atomic<uint64_t> latency_sum_ns;
+  std::atomic<uint64_t> latency_max_ns;
+};
+
+// Shared by the server and the clients of a stream, the server passes its fd along with the buffers.
+struct VisionIpcLeaseTable {
+  std::atomic<uint64_t> seq[VISIONIPC_MAX_FDS];  // +2 every time the server hands out the buffer, odd while it checks the leases
+  std::atomic<uint64_t> skipped;      // leased buffers get_buffer passed over
+  std::atomic<uint64_t> overwritten;  // get_buffer calls that found every buffer leased
+  VisionIpcLeaseClient clients[VISIONIPC_MAX_CLIENTS];
+};
+
+struct VisionIpcClientStats {
+  int pid;
+  uint64_t frames;
+  uint64_t dropped;
+  uint64_t overwritten;
+  double latency_avg_ms;
+  double latency_max_ms;
+};
+
+struct VisionIpcLeaseStats {
+  uint64_t skipped;
+  uint64_t overwritten;
+  int num_clients;
+  VisionIpcClientStats clients[VISIONIPC_MAX_CLIENTS];
+};
+
+inline VisionIpcClientStats visionipc_client_stats(const VisionIpcLeaseClient &c) {
+  const uint64_t frames = c.frames;
+  return {c.pid, frames, c.dropped, c.overwritten,
+          frames ? c.latency_sum_ns / (double)frames / 1e6 : 0., c.latency_max_ns / 1e6};
+}
@@ -58,3 +58,18 @@ cdef extern from "cereal/visionipc/visionipc_client.h":
     bool is_connected()
     @staticmethod
     set[VisionStreamType] getAvailableStreams(string, bool)
+
+  cdef cppclass VisionIpcMultiClientStats:
+    uint64_t sets
+    vector[uint64_t] dropped
+    double latency_sum_ms
+    double latency_max_ms
+
+  cdef cppclass VisionIpcMultiClient:
+    VisionIpcMultiClientStats stats
+    VisionIpcMultiClient(string, vector[VisionStreamType], bool, uint64_t, void*, void*)
+    bool recv(VisionBuf **, VisionIpcBufExtra *, int)
+    bool connect(bool)
+    bool is_connected()
+    size_t size()
+    VisionIpcClient & client(size_t)
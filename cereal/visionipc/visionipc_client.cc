@@ -1,13 +1,22 @@
+#include <algorithm>
 #include <chrono>
 #include <cassert>
 #include <iostream>
 #include <thread>
 
+#include <sys/mman.h>
+
 #include "cereal/visionipc/ipc.h"
 #include "cereal/visionipc/visionipc_client.h"
 #include "cereal/visionipc/visionipc_server.h"
 #include "cereal/logger/logger.h"
 
+static uint64_t nanos_since_boot() {
+  struct timespec t;
+  clock_gettime(CLOCK_BOOTTIME, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
 static int connect_to_vipc_server(const std::string &name, bool blocking) {
   char* prefix = std::getenv("OPENPILOT_PREFIX");
   std::string path = "/tmp/";
@@ -33,6 +42,16 @@ VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool c
   poller->registerSocket(sock);
 }
 
+void VisionIpcClient::free_lease_table() {
+  if (lease_table) {
+    release();
+    lease_table->clients[lease_slot].pid = 0;
+    munmap(lease_table, sizeof(VisionIpcLeaseTable));
+  }
+  lease_table = nullptr;
+  lease_slot = -1;
+}
+
 // Connect is not thread safe. Do not use the buffers while calling connect
 bool VisionIpcClient::connect(bool blocking){
   connected = false;
@@ -45,6 +64,7 @@ bool VisionIpcClient::connect(bool blocking){
   }
 
   num_buffers = 0;
+  free_lease_table();
 
   int socket_fd = connect_to_vipc_server(name, blocking);
   if (socket_fd < 0) {
@@ -57,10 +77,40 @@ bool VisionIpcClient::connect(bool blocking){
   // Get FDs
   int fds[VISIONIPC_MAX_FDS];
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  int num_fds = 0;
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_fds);
+
+  // The server closes the connection without sending anything for a stream it doesn't have
+  if (num_fds == 0) {
+    LOGE("Server has no %s stream of type %d", name.c_str(), type);
+    close(socket_fd);
+    return false;
+  }
 
-  assert(num_buffers >= 0);
-  assert(r == sizeof(VisionBuf) * num_buffers);
+  assert(r >= 0 && r % sizeof(VisionBuf) == 0);
+  num_buffers = r / sizeof(VisionBuf);
+  assert(num_fds == num_buffers || num_fds == num_buffers + 1);
+
+  // Claim a slot in the lease table, the fd after the buffers. Without one, frames are received unleased like before
+  if (num_fds > num_buffers) {
+    lease_table = (VisionIpcLeaseTable *)mmap(NULL, sizeof(VisionIpcLeaseTable), PROT_READ | PROT_WRITE, MAP_SHARED, fds[num_buffers], 0);
+    assert(lease_table != MAP_FAILED);
+    close(fds[num_buffers]);
+  }
+  for (int i = 0; lease_table && i < VISIONIPC_MAX_CLIENTS && lease_slot < 0; i++) {
+    auto &c = lease_table->clients[i];
+    int32_t free_pid = 0;
+    if (c.pid.compare_exchange_strong(free_pid, getpid())) {
+      for (auto &l : c.leased) l = 0;
+      c.frames = c.dropped = c.overwritten = c.latency_sum_ns = c.latency_max_ns = 0;
+      lease_slot = i;
+    }
+  }
+  if (lease_table && lease_slot < 0) {
+    LOGE("No free lease slot, receiving %s frames without leases", name.c_str());
+    munmap(lease_table, sizeof(VisionIpcLeaseTable));
+    lease_table = nullptr;
+  }
 
   // Import buffers
   for (size_t i = 0; i < num_buffers; i++){
@@ -81,12 +131,35 @@ bool VisionIpcClient::connect(bool blocking){
   return true;
 }
 
+void VisionIpcClient::release() {
+  if (lease_table && leased_idx >= 0) {
+    auto &c = lease_table->clients[lease_slot];
+    if (lease_table->seq[leased_idx] != leased_seq) {
+      c.overwritten++;
+    }
+    c.leased[leased_idx / 32] &= ~(1u << (leased_idx % 32));
+  }
+  leased_idx = -1;
+}
+
+VisionIpcClientStats VisionIpcClient::stats() {
+  return lease_table ? visionipc_client_stats(lease_table->clients[lease_slot]) : VisionIpcClientStats{};
+}
+
 VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
+  // done with the previous frame, let the server reuse it while we wait
+  release();
+
   auto p = poller->poll(timeout_ms);
 
   if (!p.size()){
     return nullptr;
   }
+  return receive(extra);
+}
+
+VisionBuf * VisionIpcClient::receive(VisionIpcBufExtra * extra){
+  release();
 
   Message * r = sock->receive(true);
   if (r == nullptr){
@@ -106,6 +179,31 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  if (lease_table) {
+    auto &c = lease_table->clients[lease_slot];
+    const uint32_t bit = 1u << (packet->idx % 32);
+    c.leased[packet->idx / 32] |= bit;
+    // an odd seq is the server checking the leases before handing out the buffer, wait for the outcome
+    for (int i = 0; i < 1000 && (lease_table->seq[packet->idx] & 1); i++) {
+      std::this_thread::yield();
+    }
+    if (lease_table->seq[packet->idx] != packet->seq) {
+      // the server is already writing a newer frame to it
+      c.leased[packet->idx / 32] &= ~bit;
+      c.dropped++;
+      delete r;
+      return nullptr;
+    }
+    leased_idx = packet->idx;
+    leased_seq = packet->seq;
+
+    const uint64_t now = nanos_since_boot();
+    const uint64_t latency = now > packet->send_time ? now - packet->send_time : 0;
+    c.frames++;
+    c.latency_sum_ns += latency;
+    if (latency > c.latency_max_ns) c.latency_max_ns = latency;
+  }
+
   if (extra) {
     *extra = packet->extra;
   }
@@ -136,6 +234,8 @@ std::set<VisionStreamType> VisionIpcClient::getAvailableStreams(const std::strin
 }
 
 VisionIpcClient::~VisionIpcClient(){
+  free_lease_table();
+
   for (size_t i = 0; i < num_buffers; i++){
     if (buffers[i].free() != 0) {
       LOGE("Failed to free buffer %zu", i);
@@ -146,3 +246,112 @@ VisionIpcClient::~VisionIpcClient(){
   delete poller;
   delete msg_ctx;
 }
+
+
+VisionIpcMultiClient::VisionIpcMultiClient(std::string name, const std::vector<VisionStreamType> &types, bool conflate, uint64_t tolerance_ns,
+                                           cl_device_id device_id, cl_context ctx) : tolerance_ns(tolerance_ns) {
+  assert(!types.empty() && types.size() <= 32);
+  for (auto type : types) {
+    clients.emplace_back(new VisionIpcClient(name, type, conflate, device_id, ctx));
+  }
+  pending.resize(clients.size());
+  stats.dropped.resize(clients.size());
+}
+
+bool VisionIpcMultiClient::connect(bool blocking) {
+  for (auto &p : pending) p = {};
+  for (auto &c : clients) {
+    if (!c->connect(blocking)) return false;
+  }
+  return true;
+}
+
+bool VisionIpcMultiClient::is_connected() {
+  for (auto &c : clients) {
+    if (!c->connected) return false;
+  }
+  return true;
+}
+
+Poller * VisionIpcMultiClient::poller_for(uint32_t mask) {
+  auto &poller = pollers[mask];
+  if (!poller) {
+    poller.reset(Poller::create());
+    for (size_t i = 0; i < clients.size(); i++) {
+      if (mask & (1u << i)) poller->registerSocket(clients[i]->sock);
+    }
+  }
+  return poller.get();
+}
+
+bool VisionIpcMultiClient::matched() {
+  uint64_t min_sof = pending[0].extra.timestamp_sof, max_sof = min_sof;
+  bool same_frame_id = true;
+  for (auto &p : pending) {
+    min_sof = std::min(min_sof, p.extra.timestamp_sof);
+    max_sof = std::max(max_sof, p.extra.timestamp_sof);
+    same_frame_id &= p.extra.frame_id == pending[0].extra.frame_id;
+  }
+  return same_frame_id || max_sof - min_sof <= tolerance_ns;
+}
+
+bool VisionIpcMultiClient::recv(VisionBuf **bufs, VisionIpcBufExtra *extras, const int timeout_ms) {
+  // done with the last set, the frames still waiting for a match stay leased
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (!pending[i].buf) clients[i]->release();
+  }
+
+  const uint64_t deadline = nanos_since_boot() + timeout_ms * 1000000ULL;
+  while (true) {
+    uint32_t waiting = 0;
+    for (size_t i = 0; i < clients.size(); i++) {
+      if (!pending[i].buf) waiting |= 1u << i;
+    }
+
+    if (waiting == 0) {
+      if (matched()) break;
+
+      // the frames older than the newest one by more than the tolerance can't be matched anymore
+      uint64_t max_sof = 0;
+      for (auto &p : pending) max_sof = std::max(max_sof, p.extra.timestamp_sof);
+      for (size_t i = 0; i < clients.size(); i++) {
+        if (pending[i].extra.timestamp_sof + tolerance_ns < max_sof) {
+          pending[i] = {};
+          clients[i]->release();
+          stats.dropped[i]++;
+        }
+      }
+      continue;
+    }
+
+    const uint64_t now = nanos_since_boot();
+    if (now >= deadline) return false;
+
+    for (auto sock : poller_for(waiting)->poll((deadline - now + 999999) / 1000000)) {
+      for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i]->sock != sock) continue;
+
+        VisionBuf *buf = clients[i]->receive(&pending[i].extra);
+        if (!clients[i]->connected) return false;
+        if (buf) {
+          pending[i].buf = buf;
+          pending[i].recv_time = nanos_since_boot();
+        }
+      }
+    }
+  }
+
+  uint64_t first_recv_time = pending[0].recv_time;
+  for (size_t i = 0; i < clients.size(); i++) {
+    bufs[i] = pending[i].buf;
+    if (extras) extras[i] = pending[i].extra;
+    first_recv_time = std::min(first_recv_time, pending[i].recv_time);
+    pending[i] = {};
+  }
+
+  const double latency_ms = (nanos_since_boot() - first_recv_time) / 1e6;
+  stats.sets++;
+  stats.latency_sum_ms += latency_ms;
+  stats.latency_max_ms = std::max(stats.latency_max_ms, latency_ms);
+  return true;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -19,6 +21,15 @@ private:
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
+  VisionIpcLeaseTable *lease_table = nullptr;
+  int lease_slot = -1;
+  int leased_idx = -1;
+  uint64_t leased_seq = 0;
+  void free_lease_table();
+  VisionBuf * receive(VisionIpcBufExtra * extra);
+
+  friend class VisionIpcMultiClient;
+
 public:
   bool connected = false;
   VisionStreamType type;
@@ -26,8 +37,51 @@ public:
   VisionBuf buffers[VISIONIPC_MAX_FDS];
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
+  // The buffer is leased until the next recv() or release(), the server doesn't reuse it
+  // unless it runs out of buffers. Returns nullptr if it was reused before it could be leased.
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  void release();
+  VisionIpcClientStats stats();
   bool connect(bool blocking=true);
   bool is_connected() { return connected; }
   static std::set<VisionStreamType> getAvailableStreams(const std::string &name, bool blocking = true);
 };
+
+struct VisionIpcMultiClientStats {
+  uint64_t sets = 0;
+  std::vector<uint64_t> dropped;  // per stream, frames that had no match in the other streams
+  // from receiving the first frame of a set to delivering it
+  double latency_sum_ms = 0;
+  double latency_max_ms = 0;
+};
+
+// Receives several streams of a server with one poller and delivers them as sets of frames
+// of the same frame_id, or with a timestamp_sof within the tolerance.
+class VisionIpcMultiClient {
+private:
+  struct Pending {
+    VisionBuf *buf = nullptr;
+    VisionIpcBufExtra extra = {};
+    uint64_t recv_time = 0;
+  };
+
+  std::vector<std::unique_ptr<VisionIpcClient>> clients;
+  std::vector<Pending> pending;
+  std::map<uint32_t, std::unique_ptr<Poller>> pollers;  // by the mask of the streams waited for
+  uint64_t tolerance_ns;
+
+  bool matched();
+  Poller * poller_for(uint32_t mask);
+
+public:
+  VisionIpcMultiClientStats stats;
+
+  VisionIpcMultiClient(std::string name, const std::vector<VisionStreamType> &types, bool conflate, uint64_t tolerance_ns=10000000,
+                       cl_device_id device_id=nullptr, cl_context ctx=nullptr);
+  // Fills bufs and extras in the order of the streams. The frames are leased until the next recv().
+  bool recv(VisionBuf **bufs, VisionIpcBufExtra *extras=nullptr, const int timeout_ms=100);
+  bool connect(bool blocking=true);
+  bool is_connected();
+  size_t size() const { return clients.size(); }
+  VisionIpcClient & client(size_t i) { return *clients[i]; }
+};
@@ -9,10 +9,13 @@ from libc.string cimport memcpy
 from libc.stdint cimport uint32_t, uint64_t
 from libcpp cimport bool
 from libcpp.string cimport string
+from libcpp.vector cimport vector
 
 from .visionipc cimport VisionIpcServer as cppVisionIpcServer
 from .visionipc cimport VisionIpcClient as cppVisionIpcClient
+from .visionipc cimport VisionIpcMultiClient as cppVisionIpcMultiClient
 from .visionipc cimport VisionBuf as cppVisionBuf
+from .visionipc cimport VisionStreamType as cppVisionStreamType
 from .visionipc cimport VisionIpcBufExtra
 from .visionipc cimport get_endpoint_name as cpp_get_endpoint_name
 
@@ -166,3 +169,60 @@ cdef class VisionIpcClient:
   @staticmethod
   def available_streams(string name, bool block):
     return cppVisionIpcClient.getAvailableStreams(name, block)
+
+
+cdef class VisionIpcMultiClient:
+  cdef cppVisionIpcMultiClient * client
+  cdef vector[cppVisionBuf *] bufs
+  cdef vector[VisionIpcBufExtra] extras
+
+  def __cinit__(self, string name, list streams, bool conflate, uint64_t tolerance_ns=10000000, CLContext context = None):
+    cdef vector[cppVisionStreamType] types
+    for stream in streams:
+      types.push_back(<cppVisionStreamType><int>stream)
+    if context:
+      self.client = new cppVisionIpcMultiClient(name, types, conflate, tolerance_ns, context.device_id, context.context)
+    else:
+      self.client = new cppVisionIpcMultiClient(name, types, conflate, tolerance_ns, NULL, NULL)
+    self.bufs.resize(types.size())
+    self.extras.resize(types.size())
+
+  def __dealloc__(self):
+    del self.client
+
+  def buffer_len(self, int i):
+    return self.client.client(i).buffers[0].len if self.client.client(i).num_buffers else None
+
+  def width(self, int i):
+    return self.client.client(i).buffers[0].width if self.client.client(i).num_buffers else None
+
+  def height(self, int i):
+    return self.client.client(i).buffers[0].height if self.client.client(i).num_buffers else None
+
+  def frame_id(self, int i):
+    return self.extras[i].frame_id
+
+  def timestamp_sof(self, int i):
+    return self.extras[i].timestamp_sof
+
+  def timestamp_eof(self, int i):
+    return self.extras[i].timestamp_eof
+
+  @property
+  def dropped(self):
+    return list(self.client.stats.dropped)
+
+  @property
+  def latency_max_ms(self):
+    return self.client.stats.latency_max_ms
+
+  def recv(self, int timeout_ms=100):
+    if not self.client.recv(self.bufs.data(), self.extras.data(), timeout_ms):
+      return None
+    return [VisionBuf.create(self.bufs[i]) for i in range(self.bufs.size())]
+
+  def connect(self, bool blocking):
+    return self.client.connect(blocking)
+
+  def is_connected(self):
+    return self.client.is_connected()
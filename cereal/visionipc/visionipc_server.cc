@@ -4,7 +4,10 @@
 #include <random>
 #include <limits>
 
+#include <fcntl.h>
 #include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -22,6 +25,34 @@ std::string get_endpoint_name(std::string name, VisionStreamType type){
   }
 }
 
+static VisionIpcLeaseTable *create_lease_table(int *fd) {
+  static std::atomic<int> counter = 0;
+  char full_path[0x100];
+#ifdef __APPLE__
+  snprintf(full_path, sizeof(full_path)-1, "/tmp/visionipc_lease_%d_%d", getpid(), counter++);
+#else
+  snprintf(full_path, sizeof(full_path)-1, "/dev/shm/visionipc_lease_%d_%d", getpid(), counter++);
+#endif
+
+  *fd = open(full_path, O_RDWR | O_CREAT | O_EXCL, 0664);
+  assert(*fd >= 0);
+  unlink(full_path);
+
+  // a new file is zeroed, which is the empty table
+  int ret = ftruncate(*fd, sizeof(VisionIpcLeaseTable));
+  assert(ret == 0);
+  void *addr = mmap(NULL, sizeof(VisionIpcLeaseTable), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  assert(addr != MAP_FAILED);
+  return (VisionIpcLeaseTable *)addr;
+}
+
+static bool is_leased(VisionIpcLeaseTable *table, size_t idx) {
+  for (auto &c : table->clients) {
+    if (c.pid != 0 && (c.leased[idx / 32] & (1u << (idx % 32)))) return true;
+  }
+  return false;
+}
+
 VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_context ctx) : name(name), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
 
@@ -68,6 +99,7 @@ void VisionIpcServer::create_buffers_with_sizes(VisionStreamType type, size_t nu
   }
 
   cur_idx[type] = 0;
+  leases[type] = create_lease_table(&lease_fds[type]);
 
   // Create msgq publisher for each of the `name` + type combos
   // TODO: compute port number directly if using zmq
@@ -94,6 +126,8 @@ void VisionIpcServer::listener(){
   assert(sock >= 0);
 
   while (!should_exit){
+    reclaim_leases();
+
     // Wait for incoming connection
     struct pollfd polls[1] = {{0}};
     polls[0].fd = sock;
@@ -153,7 +187,10 @@ void VisionIpcServer::listener(){
       bufs[i].server_id = server_id;
     }
 
-    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds, nullptr);
+    // the lease table goes after the buffers
+    fds[num_fds] = lease_fds[type];
+
+    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds + 1, nullptr);
 
     close(fd);
   }
@@ -165,11 +202,62 @@ void VisionIpcServer::listener(){
 
 
 
+// Frees the leases of clients that exited without releasing them
+void VisionIpcServer::reclaim_leases() {
+  for (auto &[type, table] : leases) {
+    for (auto &c : table->clients) {
+      int pid = c.pid;
+      if (pid != 0 && kill(pid, 0) != 0 && errno == ESRCH) {
+        for (auto &l : c.leased) l = 0;
+        c.pid.compare_exchange_strong(pid, 0);
+      }
+    }
+  }
+}
+
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  return b[cur_idx[type]++ % b.size()];
+  auto &b = buffers[type];
+  VisionIpcLeaseTable *table = leases[type];
+
+  for (size_t i = 0; i < b.size(); i++) {
+    size_t idx = cur_idx[type]++ % b.size();
+    if (is_leased(table, idx)) {
+      table->skipped++;
+      continue;
+    }
+    // a client leases by setting its bit and then checking the seq, if it
+    // did so after the check above one of us sees the other's write. The seq
+    // is odd until we know, and only moves on for the buffer that's returned
+    table->seq[idx]++;
+    if (is_leased(table, idx)) {
+      table->seq[idx]--;
+      table->skipped++;
+      continue;
+    }
+    table->seq[idx]++;
+    return b[idx];
+  }
+
+  size_t idx = cur_idx[type]++ % b.size();
+  table->overwritten++;
+  table->seq[idx] += 2;
+  return b[idx];
+}
+
+VisionIpcLeaseStats VisionIpcServer::lease_stats(VisionStreamType type) {
+  assert(leases.count(type));
+  VisionIpcLeaseTable *table = leases[type];
+
+  VisionIpcLeaseStats stats = {};
+  stats.skipped = table->skipped;
+  stats.overwritten = table->overwritten;
+  for (auto &c : table->clients) {
+    if (c.pid != 0) {
+      stats.clients[stats.num_clients++] = visionipc_client_stats(c);
+    }
+  }
+  return stats;
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
@@ -182,9 +270,14 @@ void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync
   assert(buf->idx < buffers[buf->type].size());
 
   // Send over correct msgq socket
+  struct timespec t;
+  clock_gettime(CLOCK_BOOTTIME, &t);
+
   VisionIpcPacket packet = {0};
   packet.server_id = server_id;
   packet.idx = buf->idx;
+  packet.seq = leases[buf->type]->seq[buf->idx];
+  packet.send_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
   packet.extra = *extra;
 
   sockets[buf->type]->send((char*)&packet, sizeof(packet));
@@ -204,6 +297,11 @@ VisionIpcServer::~VisionIpcServer(){
     }
   }
 
+  for (auto const& [type, table] : leases) {
+    munmap(table, sizeof(VisionIpcLeaseTable));
+    close(lease_fds[type]);
+  }
+
   // Messaging cleanup
   for (auto const& [type, sock] : sockets) {
     delete sock;
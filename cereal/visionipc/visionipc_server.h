@@ -23,17 +23,23 @@ class VisionIpcServer {
 
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
+  std::map<VisionStreamType, VisionIpcLeaseTable*> leases;
+  std::map<VisionStreamType, int> lease_fds;
 
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
   void listener(void);
+  void reclaim_leases();
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcServer();
 
+  // The next buffer to write a frame to. Buffers leased by a client are skipped unless
+  // every buffer is leased, that's counted in lease_stats() as overwritten.
   VisionBuf * get_buffer(VisionStreamType type);
+  VisionIpcLeaseStats lease_stats(VisionStreamType type);
 
   void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
   void create_buffers_with_sizes(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height, size_t size, size_t stride, size_t uv_offset);
@@ -22,6 +22,16 @@ TEST_CASE("Connecting"){
   REQUIRE(client.connected);
 }
 
+TEST_CASE("Connecting to a missing stream"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_WIDE_ROAD, false);
+  REQUIRE(!client.connect());
+  REQUIRE(!client.connected);
+}
+
 TEST_CASE("getAvailableStreams"){
   VisionIpcServer server("camerad");
   server.create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
@@ -146,3 +156,96 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Leased buffers are not reused"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+  VisionBuf * recv_buf = client.recv(&extra);
+  REQUIRE(recv_buf != nullptr);
+  REQUIRE(recv_buf->idx == buf->idx);
+
+  // the other buffer is handed out until the client is done with this one
+  REQUIRE(server.get_buffer(VISION_STREAM_ROAD)->idx != buf->idx);
+  REQUIRE(server.get_buffer(VISION_STREAM_ROAD)->idx != buf->idx);
+  REQUIRE(server.lease_stats(VISION_STREAM_ROAD).skipped == 1);
+
+  client.release();
+  REQUIRE(server.get_buffer(VISION_STREAM_ROAD)->idx == buf->idx);
+  REQUIRE(server.lease_stats(VISION_STREAM_ROAD).overwritten == 0);
+}
+
+TEST_CASE("Reused buffers are dropped"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+  server.get_buffer(VISION_STREAM_ROAD);
+  REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == buf);
+
+  REQUIRE(client.recv(&extra) == nullptr);
+  VisionIpcClientStats stats = client.stats();
+  REQUIRE(stats.frames == 0);
+  REQUIRE(stats.dropped == 1);
+
+  auto lease_stats = server.lease_stats(VISION_STREAM_ROAD);
+  REQUIRE(lease_stats.num_clients == 1);
+  REQUIRE(lease_stats.clients[0].pid == getpid());
+}
+
+TEST_CASE("Multi client synchronizes streams"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 4, false, 100, 100);
+  server.create_buffers(VISION_STREAM_WIDE_ROAD, 4, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcMultiClient client("camerad", {VISION_STREAM_ROAD, VISION_STREAM_WIDE_ROAD}, false, 10000000);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  auto send = [&](VisionStreamType type, uint32_t frame_id, uint64_t timestamp_sof) {
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = frame_id;
+    extra.timestamp_sof = timestamp_sof;
+    server.send(server.get_buffer(type), &extra);
+  };
+
+  // the wide camera dropped frame 1, and its frame ids are off by 100
+  send(VISION_STREAM_ROAD, 1, 50000000);
+  send(VISION_STREAM_ROAD, 2, 100000000);
+  send(VISION_STREAM_WIDE_ROAD, 102, 101000000);
+
+  VisionBuf *bufs[2] = {};
+  VisionIpcBufExtra extras[2] = {};
+  REQUIRE(client.recv(bufs, extras));
+  REQUIRE(bufs[0] != nullptr);
+  REQUIRE(bufs[1] != nullptr);
+  REQUIRE(extras[0].frame_id == 2);
+  REQUIRE(extras[1].frame_id == 102);
+  REQUIRE(client.stats.sets == 1);
+  REQUIRE(client.stats.dropped[0] == 1);
+  REQUIRE(client.stats.dropped[1] == 0);
+
+  // waits for the other stream
+  send(VISION_STREAM_ROAD, 3, 150000000);
+  REQUIRE_FALSE(client.recv(bufs, extras, 10));
+  send(VISION_STREAM_WIDE_ROAD, 103, 150000000);
+  REQUIRE(client.recv(bufs, extras));
+  REQUIRE(extras[0].frame_id == 3);
+  REQUIRE(extras[1].frame_id == 103);
+}
@@ -1,5 +1,157 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include "opendbc/can/common.h"
 
+// Byte kernels for the XOR and additive checksums, dispatched at runtime
+
+static inline uint8_t fold_xor64(uint64_t x) {
+  x ^= x >> 32;
+  x ^= x >> 16;
+  x ^= x >> 8;
+  return x;
+}
+
+static uint8_t xor_bytes_scalar(const uint8_t *d, size_t size) {
+  uint64_t x = 0;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w;
+    memcpy(&w, d + i, sizeof(w));
+    x ^= w;
+  }
+  for (; i < size; i++) {
+    x ^= d[i];
+  }
+  return fold_xor64(x);
+}
+
+static unsigned int sum_bytes_scalar(const uint8_t *d, size_t size) {
+  unsigned int s = 0;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w;
+    memcpy(&w, d + i, sizeof(w));
+    // add byte pairs into 16 bit lanes, then add up the lanes with one multiply
+    w = (w & 0x00FF00FF00FF00FFULL) + ((w >> 8) & 0x00FF00FF00FF00FFULL);
+    s += (w * 0x0001000100010001ULL) >> 48;
+  }
+  for (; i < size; i++) {
+    s += d[i];
+  }
+  return s;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse2")))
+static uint8_t xor_bytes_sse2(const uint8_t *d, size_t size) {
+  __m128i x = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)(d + i)));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, x);
+  return fold_xor64(lanes[0] ^ lanes[1]) ^ xor_bytes_scalar(d + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static unsigned int sum_bytes_sse2(const uint8_t *d, size_t size) {
+  // psadbw against zero sums each group of 8 bytes into a 64 bit lane
+  __m128i s = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    s = _mm_add_epi64(s, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(d + i)), _mm_setzero_si128()));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, s);
+  return lanes[0] + lanes[1] + sum_bytes_scalar(d + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t xor_bytes_avx2(const uint8_t *d, size_t size) {
+  __m256i x = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    x = _mm256_xor_si256(x, _mm256_loadu_si256((const __m256i *)(d + i)));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, x);
+  return fold_xor64(lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3]) ^ xor_bytes_sse2(d + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned int sum_bytes_avx2(const uint8_t *d, size_t size) {
+  __m256i s = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    s = _mm256_add_epi64(s, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(d + i)), _mm256_setzero_si256()));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, s);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_bytes_sse2(d + i, size - i);
+}
+#endif
+
+static bool checksum_kernel_supported(ChecksumKernel kernel) {
+#if defined(__x86_64__)
+  if (kernel == CHECKSUM_KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+  if (kernel == CHECKSUM_KERNEL_SSE2) return __builtin_cpu_supports("sse2");
+#endif
+  return kernel == CHECKSUM_KERNEL_SCALAR;
+}
+
+static ChecksumKernel best_checksum_kernel() {
+  for (ChecksumKernel kernel : {CHECKSUM_KERNEL_AVX2, CHECKSUM_KERNEL_SSE2}) {
+    if (checksum_kernel_supported(kernel)) return kernel;
+  }
+  return CHECKSUM_KERNEL_SCALAR;
+}
+
+static ChecksumKernel checksum_kernel = CHECKSUM_KERNEL_SCALAR;
+static bool checksum_kernel_set = false;
+static uint8_t (*xor_bytes_impl)(const uint8_t *d, size_t size) = xor_bytes_scalar;
+static unsigned int (*sum_bytes_impl)(const uint8_t *d, size_t size) = sum_bytes_scalar;
+
+bool set_checksum_kernel(ChecksumKernel kernel) {
+  if (!checksum_kernel_supported(kernel)) return false;
+
+  checksum_kernel = kernel;
+  checksum_kernel_set = true;
+  switch (kernel) {
+#if defined(__x86_64__)
+    case CHECKSUM_KERNEL_AVX2:
+      xor_bytes_impl = xor_bytes_avx2;
+      sum_bytes_impl = sum_bytes_avx2;
+      break;
+    case CHECKSUM_KERNEL_SSE2:
+      xor_bytes_impl = xor_bytes_sse2;
+      sum_bytes_impl = sum_bytes_sse2;
+      break;
+#endif
+    default:
+      xor_bytes_impl = xor_bytes_scalar;
+      sum_bytes_impl = sum_bytes_scalar;
+      break;
+  }
+  return true;
+}
+
+ChecksumKernel get_checksum_kernel() {
+  return checksum_kernel;
+}
+
+uint8_t xor_bytes(const uint8_t *d, size_t size) {
+  return xor_bytes_impl(d, size);
+}
+
+unsigned int sum_bytes(const uint8_t *d, size_t size) {
+  return sum_bytes_impl(d, size);
+}
+
 
 unsigned int honda_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
   int s = 0;
@@ -19,7 +171,7 @@ unsigned int honda_checksum(uint32_t address, const Signal &sig, const std::vect
 unsigned int toyota_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
   unsigned int s = d.size();
   while (address) { s += address & 0xFF; address >>= 8; }
-  for (int i = 0; i < d.size() - 1; i++) { s += d[i]; }
+  if (!d.empty()) s += sum_bytes(d.data(), d.size() - 1);
 
   return s & 0xFF;
 }
@@ -29,7 +181,7 @@ unsigned int subaru_checksum(uint32_t address, const Signal &sig, const std::vec
   while (address) { s += address & 0xFF; address >>= 8; }
 
   // skip checksum in first byte
-  for (int i = 1; i < d.size(); i++) { s += d[i]; }
+  if (d.size() > 1) s += sum_bytes(d.data() + 1, d.size() - 1);
 
   return s & 0xFF;
 }
@@ -68,6 +220,7 @@ unsigned int chrysler_checksum(uint32_t address, const Signal &sig, const std::v
 // Static lookup table for fast computation of CRCs
 uint8_t crc8_lut_8h2f[256]; // CRC8 poly 0x2F, aka 8H2F/AUTOSAR
 uint16_t crc16_lut_xmodem[256]; // CRC16 poly 0x1021, aka XMODEM
+uint16_t crc16_lut_xmodem_2[256]; // CRC16 XMODEM of a byte followed by a zero byte, for two bytes per step
 
 void gen_crc_lookup_table_8(uint8_t poly, uint8_t crc_lut[]) {
   uint8_t crc;
@@ -106,6 +259,15 @@ void init_crc_lookup_tables() {
   // At init time, set up static lookup tables for fast CRC computation.
   gen_crc_lookup_table_8(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
   gen_crc_lookup_table_16(0x1021, crc16_lut_xmodem);    // CRC-16 XMODEM for HKG CAN FD
+  for (int i = 0; i < 256; i++) {
+    uint16_t crc = crc16_lut_xmodem[i];
+    crc16_lut_xmodem_2[i] = (crc << 8) ^ crc16_lut_xmodem[crc >> 8];
+  }
+
+  // pick the fastest checksum kernel, unless one was already chosen
+  if (!checksum_kernel_set) {
+    set_checksum_kernel(best_checksum_kernel());
+  }
 }
 
 unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
@@ -190,14 +352,12 @@ unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const
 }
 
 unsigned int xor_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
-  uint8_t checksum = 0;
   int checksum_byte = sig.start_bit / 8;
 
   // Simple XOR over the payload, except for the byte where the checksum lives.
-  for (int i = 0; i < d.size(); i++) {
-    if (i != checksum_byte) {
-      checksum ^= d[i];
-    }
+  uint8_t checksum = xor_bytes(d.data(), d.size());
+  if (checksum_byte < d.size()) {
+    checksum ^= d[checksum_byte];
   }
 
   return checksum;
@@ -224,7 +384,12 @@ unsigned int pedal_checksum(uint32_t address, const Signal &sig, const std::vect
 unsigned int hkg_can_fd_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
   uint16_t crc = 0;
 
-  for (int i = 2; i < d.size(); i++) {
+  // CRC is linear, so two bytes are folded in per step with independent lookups
+  int i = 2;
+  for (; i + 2 <= d.size(); i += 2) {
+    crc = crc16_lut_xmodem_2[(crc >> 8) ^ d[i]] ^ crc16_lut_xmodem[(crc & 0xFF) ^ d[i + 1]];
+  }
+  for (; i < d.size(); i++) {
     crc = (crc << 8) ^ crc16_lut_xmodem[(crc >> 8) ^ d[i]];
   }
 
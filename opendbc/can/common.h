@@ -1,9 +1,10 @@
 #pragma once
 
+#include <cstring>
 #include <map>
 #include <string>
-#include <utility>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <capnp/dynamic.h>
@@ -25,6 +26,42 @@
 
 void init_crc_lookup_tables();
 
+// Byte kernels used by the XOR and additive checksums. The best one the cpu
+// supports is selected at startup, set_checksum_kernel() overrides it.
+enum ChecksumKernel {CHECKSUM_KERNEL_SCALAR, CHECKSUM_KERNEL_SSE2, CHECKSUM_KERNEL_AVX2};
+
+bool set_checksum_kernel(ChecksumKernel kernel);
+ChecksumKernel get_checksum_kernel();
+uint8_t xor_bytes(const uint8_t *d, size_t size);
+unsigned int sum_bytes(const uint8_t *d, size_t size);
+
+int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig);
+
+// Reads the signal with a single unaligned load using the descriptor precompiled at DBC load.
+// Only valid if sig.decode_fast, msg needs 8 readable bytes at sig.decode_byte.
+inline int64_t decode_raw_value(const uint8_t *msg, const Signal &sig) {
+  uint64_t v;
+  memcpy(&v, msg + sig.decode_byte, sizeof(v));
+  if (!sig.is_little_endian) {
+    v = __builtin_bswap64(v);
+  }
+  return (v >> sig.decode_shift) & sig.decode_mask;
+}
+
+// Inverse of decode_raw_value, a single load and store of 8 bytes at sig.decode_byte.
+inline void encode_raw_value(uint8_t *msg, const Signal &sig, uint64_t ival) {
+  uint64_t v;
+  memcpy(&v, msg + sig.decode_byte, sizeof(v));
+  if (!sig.is_little_endian) {
+    v = __builtin_bswap64(v);
+  }
+  v = (v & ~(sig.decode_mask << sig.decode_shift)) | ((ival & sig.decode_mask) << sig.decode_shift);
+  if (!sig.is_little_endian) {
+    v = __builtin_bswap64(v);
+  }
+  memcpy(msg + sig.decode_byte, &v, sizeof(v));
+}
+
 // Car specific functions
 unsigned int honda_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
 unsigned int toyota_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
@@ -43,6 +80,7 @@ public:
 
   std::vector<Signal> parse_sigs;
   std::vector<double> vals;
+  std::vector<double> tmp_vals;
   std::vector<std::vector<double>> all_vals;
 
   uint64_t last_seen_nanos;
@@ -54,6 +92,9 @@ public:
   bool ignore_checksum = false;
   bool ignore_counter = false;
 
+  uint32_t sig_id = 0;  // SignalColumns id of parse_sigs[0]
+  bool updated = false;  // parsed since the last update_columns
+
   bool parse(uint64_t nanos, const std::vector<uint8_t> &dat);
   bool update_counter_generic(int64_t v, int cnt_size);
 };
@@ -64,7 +105,16 @@ private:
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+  std::vector<MessageState> message_states;
+  AddressTable state_index;  // address -> index into message_states
+  std::vector<uint8_t> dat_buf;
+  std::vector<int> updated_states;  // message_states parsed since the last update_columns
+
+  void init_columns();
+  void mark_updated(int state_idx);
+  #ifndef DYNAMIC_CAPNP
+  void update_event(kj::ArrayPtr<const capnp::word> words, bool sendcan);
+  #endif
 
 public:
   bool can_valid = false;
@@ -74,29 +124,54 @@ public:
   uint64_t last_nonempty_nanos = 0;
   uint64_t bus_timeout_threshold = 0;
   uint64_t can_invalid_cnt = CAN_INVALID_CNT;
+  SignalColumns columns;
 
   CANParser(int abus, const std::string& dbc_name,
             const std::vector<std::pair<uint32_t, int>> &messages);
   CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter);
   #ifndef DYNAMIC_CAPNP
   void update_string(const std::string &data, bool sendcan);
+  uint64_t update_batch(const std::vector<std::string> &data, bool sendcan);
   void update_strings(const std::vector<std::string> &data, std::vector<SignalValue> &vals, bool sendcan);
+  void update_columns(const std::vector<std::string> &data, bool sendcan);
   void UpdateCans(uint64_t nanos, const capnp::List<cereal::CanData>::Reader& cans);
   #endif
   void UpdateCans(uint64_t nanos, const capnp::DynamicStruct::Reader& cans);
   void UpdateValid(uint64_t nanos);
   void query_latest(std::vector<SignalValue> &vals, uint64_t last_ts = 0);
+  void query_columns();
 };
 
 class CANPacker {
 private:
+  // everything pack needs about a message, resolved once in the constructor
+  struct MessageTemplate {
+    const Msg *msg;
+    const Signal *counter_sig = nullptr;
+    const Signal *checksum_sig = nullptr;
+    uint32_t counter = 0;
+  };
+  struct SignalHandle {
+    int msg_handle;
+    const Signal *sig;
+  };
+
   const DBC *dbc = NULL;
-  std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
+  std::vector<MessageTemplate> messages;  // indexed by message handle, same order as dbc->msgs
+  std::vector<SignalHandle> signal_handles;  // indexed by signal handle
+  std::vector<std::unordered_map<std::string, int>> signal_lookup;  // signal name -> handle, per message handle
+  std::vector<uint8_t> pack_buf;
   std::map<uint32_t, Msg> message_lookup;
-  std::map<uint32_t, uint32_t> counters;
 
 public:
   CANPacker(const std::string& dbc_name);
   std::vector<uint8_t> pack(uint32_t address, const std::vector<SignalPackValue> &values);
   Msg* lookup_message(uint32_t address);
+
+  // Handle based API, resolve names once and pack without lookups or allocations.
+  // Handles are -1 if the message or signal doesn't exist.
+  int lookup_message_handle(uint32_t address) const;
+  int lookup_signal_handle(uint32_t address, const std::string &name) const;
+  // Packs the message into out, returns its size or -1 on a bad handle or a too small buffer.
+  int pack(int msg_handle, const SignalHandleValue *values, size_t num_values, uint8_t *out, size_t out_size);
 };
@@ -60,6 +60,23 @@ cdef extern from "common_dbc.h":
     string name
     double value
 
+  cdef struct SignalHandleValue:
+    int handle
+    double value
+
+  cdef enum:
+    ALL_VALUES_DEPTH
+
+  cdef struct SignalColumns:
+    vector[uint32_t] address
+    vector[string] name
+    vector[uint64_t] ts_nanos
+    vector[double] value
+    vector[double] all_values
+    uint32_t all_values_depth
+    vector[uint32_t] all_values_count
+    vector[uint32_t] updated
+
 
 cdef extern from "common.h":
   cdef const DBC* dbc_lookup(const string) except +
@@ -67,9 +84,14 @@ cdef extern from "common.h":
   cdef cppclass CANParser:
     bool can_valid
     bool bus_timeout
+    SignalColumns columns
     CANParser(int, string, vector[pair[uint32_t, int]]) except +
     void update_strings(vector[string]&, vector[SignalValue]&, bool) except +
+    void update_columns(vector[string]&, bool) except +
 
   cdef cppclass CANPacker:
    CANPacker(string)
    vector[uint8_t] pack(uint32_t, vector[SignalPackValue]&)
+   int lookup_message_handle(uint32_t)
+   int lookup_signal_handle(uint32_t, string)
+   int pack(int, const SignalHandleValue*, size_t, uint8_t*, size_t)
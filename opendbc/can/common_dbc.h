@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
 struct SignalPackValue {
@@ -10,6 +11,11 @@ struct SignalPackValue {
   double value;
 };
 
+struct SignalHandleValue {
+  int handle;  // from CANPacker::lookup_signal_handle
+  double value;
+};
+
 struct SignalValue {
   uint32_t address;
   uint64_t ts_nanos;
@@ -18,6 +24,21 @@ struct SignalValue {
   std::vector<double> all_values;  // all values from this cycle
 };
 
+#define ALL_VALUES_DEPTH 32  // initial slots per signal, grown when an update has more values
+
+// Columnar alternative to SignalValue, indexed by signal id. Ids, addresses and names
+// are assigned once when the parser is built, every update only rewrites the updated ids.
+struct SignalColumns {
+  std::vector<uint32_t> address;
+  std::vector<std::string> name;
+  std::vector<uint64_t> ts_nanos;
+  std::vector<double> value;  // latest value
+  std::vector<double> all_values;  // all_values_depth slots per signal id
+  uint32_t all_values_depth = ALL_VALUES_DEPTH;
+  std::vector<uint32_t> all_values_count;  // number of slots used, the values of this cycle
+  std::vector<uint32_t> updated;  // ids updated by the last update_columns
+};
+
 enum SignalType {
   DEFAULT,
   COUNTER,
@@ -39,6 +60,12 @@ struct Signal {
   bool is_little_endian;
   SignalType type;
   unsigned int (*calc_checksum)(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+
+  // precompiled at DBC load: the raw value is (load64(dat + decode_byte) >> decode_shift) & decode_mask,
+  // with the load in the signal's byte order. decode_fast is false if the signal spans more than 8 bytes
+  bool decode_fast;
+  uint8_t decode_byte, decode_last_byte, decode_shift;
+  uint64_t decode_mask;
 };
 
 struct Msg {
@@ -55,10 +82,42 @@ struct Val {
   std::vector<Signal> sigs;
 };
 
+// Maps CAN addresses to a small index. 11-bit addresses index a direct table,
+// 29-bit addresses go to an open addressed table with linear probing.
+class AddressTable {
+public:
+  AddressTable() : std_ids(0x800, -1) {}
+  void insert(uint32_t address, int index);
+
+  inline int find(uint32_t address) const {
+    if (address < std_ids.size()) {
+      return std_ids[address];
+    }
+    if (ext_ids.empty()) {
+      return -1;
+    }
+    for (size_t i = hash(address);; i = (i + 1) & (ext_ids.size() - 1)) {
+      if (ext_ids[i].first == address) return ext_ids[i].second;
+      if (ext_ids[i].first == EMPTY) return -1;
+    }
+  }
+
+private:
+  static constexpr uint32_t EMPTY = 0xFFFFFFFF;  // not a valid 29-bit address
+  inline size_t hash(uint32_t address) const {
+    return (address * 0x9E3779B1u) & (ext_ids.size() - 1);
+  }
+
+  std::vector<int> std_ids;
+  std::vector<std::pair<uint32_t, int>> ext_ids;
+  size_t num_ext = 0;
+};
+
 struct DBC {
   std::string name;
   std::vector<Msg> msgs;
   std::vector<Val> vals;
+  AddressTable msg_index;  // address -> index into msgs
 };
 
 typedef struct ChecksumState {
@@ -71,7 +130,12 @@ typedef struct ChecksumState {
   unsigned int (*calc_checksum)(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
 } ChecksumState;
 
+ChecksumState* get_checksum(const std::string& dbc_name);
+void compile_signal(Signal& s);
 DBC* dbc_parse(const std::string& dbc_path);
 DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, ChecksumState *checksum = nullptr, bool allow_duplicate_msg_name=false);
+// loads a DBC from the binary cache in cache_dir, parsing it and filling the cache if that is missing or stale
+DBC* dbc_load(const std::string& dbc_path, const std::string& cache_dir);
+const std::string get_dbc_cache_path();
 const DBC* dbc_lookup(const std::string& dbc_name);
 std::vector<std::string> get_dbc_names();
@@ -0,0 +1,24 @@
+#include <cstdio>
+#include <string>
+
+#include "opendbc/can/common_dbc.h"
+
+// Fills the binary DBC cache at build time, so no process has to parse a DBC on startup.
+// usage: compile_dbc <cache dir> <dbc files...>
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <cache dir> <dbc files...>\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = 2; i < argc; i++) {
+    DBC *dbc = dbc_load(argv[i], argv[1]);
+    if (!dbc) {
+      printf("can't read %s\n", argv[i]);
+      return 1;
+    }
+    delete dbc;
+  }
+  return 0;
+}
@@ -71,6 +71,50 @@ ChecksumState* get_checksum(const std::string& dbc_name) {
   return s;
 }
 
+void AddressTable::insert(uint32_t address, int index) {
+  if (address < std_ids.size()) {
+    std_ids[address] = index;
+    return;
+  }
+
+  // keep the load factor at or below 1/2
+  if (2 * (num_ext + 1) > ext_ids.size()) {
+    auto old_ids = std::move(ext_ids);
+    ext_ids.assign(std::max<size_t>(16, 2 * old_ids.size()), {EMPTY, -1});
+    num_ext = 0;
+    for (const auto& [addr, idx] : old_ids) {
+      if (addr != EMPTY) insert(addr, idx);
+    }
+  }
+
+  size_t i = hash(address);
+  while (ext_ids[i].first != EMPTY && ext_ids[i].first != address) {
+    i = (i + 1) & (ext_ids.size() - 1);
+  }
+  num_ext += ext_ids[i].first == EMPTY;
+  ext_ids[i] = {address, index};
+}
+
+void compile_signal(Signal& s) {
+  const int lsb_byte = s.lsb / 8, msb_byte = s.msb / 8;
+  int shift;
+  if (s.is_little_endian) {
+    // bit b of byte k ends up at bit 8k + b of the little endian load at lsb_byte
+    s.decode_byte = lsb_byte;
+    s.decode_last_byte = msb_byte;
+    shift = s.lsb % 8;
+    s.decode_fast = shift + s.size <= 64;
+  } else {
+    // bit b of byte k ends up at bit 56 - 8k + b of the big endian load at msb_byte
+    s.decode_byte = msb_byte;
+    s.decode_last_byte = lsb_byte;
+    shift = 56 - 8 * (lsb_byte - msb_byte) + (s.lsb % 8);
+    s.decode_fast = shift >= 0;
+  }
+  s.decode_shift = s.decode_fast ? shift : 0;
+  s.decode_mask = s.size >= 64 ? ~0ULL : ((1ULL << s.size) - 1);
+}
+
 void set_signal_type(Signal& s, ChecksumState* chk, const std::string& dbc_name, int line_num) {
   s.calc_checksum = nullptr;
   if (chk) {
@@ -168,6 +212,7 @@ DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, Ch
         sig.msb = sig.start_bit;
       }
       DBC_ASSERT(sig.lsb < (64 * 8) && sig.msb < (64 * 8), "Signal out of bounds: " << line);
+      compile_signal(sig);
 
       // Check for duplicate signal names
       DBC_ASSERT(signal_name_sets[address].find(sig.name) == signal_name_sets[address].end(), "Duplicate signal name: " << sig.name);
@@ -198,8 +243,10 @@ DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, Ch
     }
   }
 
-  for (auto& m : dbc->msgs) {
+  for (int i = 0; i < dbc->msgs.size(); i++) {
+    auto& m = dbc->msgs[i];
     m.sigs = signals[m.address];
+    dbc->msg_index.insert(m.address, i);
   }
   for (auto& v : dbc->vals) {
     v.sigs = signals[v.address];
@@ -226,6 +273,15 @@ const std::string get_dbc_root_path() {
   }
 }
 
+const std::string get_dbc_cache_path() {
+  char *cache_path = std::getenv("DBC_CACHE_PATH");
+  if (cache_path != NULL) {
+    return cache_path;
+  } else {
+    return get_dbc_root_path() + "/can/dbc_cache";
+  }
+}
+
 const DBC* dbc_lookup(const std::string& dbc_name) {
   static std::mutex lock;
   static std::map<std::string, DBC*> dbcs;
@@ -238,7 +294,7 @@ const DBC* dbc_lookup(const std::string& dbc_name) {
   std::unique_lock lk(lock);
   auto it = dbcs.find(dbc_name);
   if (it == dbcs.end()) {
-    it = dbcs.insert(it, {dbc_name, dbc_parse(dbc_file_path)});
+    it = dbcs.insert(it, {dbc_name, dbc_load(dbc_file_path, get_dbc_cache_path())});
   }
   return it->second;
 }
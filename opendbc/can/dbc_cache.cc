@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "opendbc/can/common.h"
+#include "opendbc/can/common_dbc.h"
+
+// Binary DBC cache. The parsed DBC is written as fixed size records plus a table of
+// NUL terminated strings, so loading it is a handful of copies instead of regex parsing.
+// The header holds a hash of the .dbc source, a cache with a different hash or version
+// is ignored and rewritten. Bump DBC_CACHE_VERSION when parsing or this layout changes.
+
+#define DBC_CACHE_MAGIC 0x42434244  // "DBCB"
+#define DBC_CACHE_VERSION 1
+
+struct DBCCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint32_t num_msgs;
+  uint32_t num_sigs;
+  uint32_t num_vals;
+  uint32_t strings_size;
+};
+
+struct DBCCacheMsg {
+  uint32_t name;  // offset into the string table
+  uint32_t address;
+  uint32_t size;
+  uint32_t num_sigs;
+};
+
+struct DBCCacheSignal {
+  uint32_t name;
+  int32_t start_bit, msb, lsb, size;
+  uint8_t is_signed;
+  uint8_t is_little_endian;
+  uint8_t type;
+  uint8_t has_calc_checksum;
+  double factor, offset;
+};
+
+struct DBCCacheVal {
+  uint32_t name;
+  uint32_t address;
+  uint32_t def_val;
+};
+
+static uint64_t fnv1a_hash(const std::string &data) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : data) {
+    hash = (hash ^ c) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static unsigned int (*checksum_function(SignalType type))(uint32_t, const Signal &, const std::vector<uint8_t> &) {
+  switch (type) {
+    case HONDA_CHECKSUM: return &honda_checksum;
+    case TOYOTA_CHECKSUM: return &toyota_checksum;
+    case PEDAL_CHECKSUM: return &pedal_checksum;
+    case VOLKSWAGEN_MQB_CHECKSUM: return &volkswagen_mqb_checksum;
+    case XOR_CHECKSUM: return &xor_checksum;
+    case SUBARU_CHECKSUM: return &subaru_checksum;
+    case CHRYSLER_CHECKSUM: return &chrysler_checksum;
+    case HKG_CAN_FD_CHECKSUM: return &hkg_can_fd_checksum;
+    default: return nullptr;
+  }
+}
+
+static DBC *dbc_cache_read(const std::string &cache_path, const std::string &dbc_name, uint64_t source_hash) {
+  int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  void *mem = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(DBCCacheHeader)) {
+    mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) return nullptr;
+
+  const size_t file_size = st.st_size;
+  const char *p = (const char *)mem;
+  DBCCacheHeader h;
+  memcpy(&h, p, sizeof(h));
+
+  const size_t records_size = (size_t)h.num_msgs * sizeof(DBCCacheMsg) + (size_t)h.num_sigs * sizeof(DBCCacheSignal) +
+                              (size_t)h.num_vals * sizeof(DBCCacheVal);
+  const bool valid = h.magic == DBC_CACHE_MAGIC && h.version == DBC_CACHE_VERSION && h.source_hash == source_hash &&
+                     h.strings_size > 0 && sizeof(h) + records_size + h.strings_size == file_size &&
+                     p[file_size - 1] == '\0';
+  if (!valid) {
+    munmap(mem, file_size);
+    return nullptr;
+  }
+
+  const char *msgs = p + sizeof(h);
+  const char *sigs = msgs + h.num_msgs * sizeof(DBCCacheMsg);
+  const char *vals = sigs + h.num_sigs * sizeof(DBCCacheSignal);
+  const char *strings = vals + h.num_vals * sizeof(DBCCacheVal);
+  auto get_string = [&](uint32_t offset) { return std::string(strings + std::min(offset, h.strings_size - 1)); };
+
+  DBC *dbc = new DBC;
+  dbc->name = dbc_name;
+  dbc->msgs.resize(h.num_msgs);
+  uint32_t sig_idx = 0;
+  for (uint32_t i = 0; i < h.num_msgs; i++) {
+    DBCCacheMsg m;
+    memcpy(&m, msgs + i * sizeof(m), sizeof(m));
+    if (m.num_sigs > h.num_sigs - sig_idx) {
+      delete dbc;
+      munmap(mem, file_size);
+      return nullptr;
+    }
+
+    Msg &msg = dbc->msgs[i];
+    msg.name = get_string(m.name);
+    msg.address = m.address;
+    msg.size = m.size;
+    msg.sigs.resize(m.num_sigs);
+    for (Signal &sig : msg.sigs) {
+      DBCCacheSignal s;
+      memcpy(&s, sigs + sig_idx++ * sizeof(s), sizeof(s));
+      sig.name = get_string(s.name);
+      sig.start_bit = s.start_bit;
+      sig.msb = s.msb;
+      sig.lsb = s.lsb;
+      sig.size = s.size;
+      sig.is_signed = s.is_signed;
+      sig.factor = s.factor;
+      sig.offset = s.offset;
+      sig.is_little_endian = s.is_little_endian;
+      sig.type = (SignalType)s.type;
+      sig.calc_checksum = s.has_calc_checksum ? checksum_function(sig.type) : nullptr;
+      compile_signal(sig);
+    }
+    dbc->msg_index.insert(msg.address, i);
+  }
+
+  dbc->vals.resize(h.num_vals);
+  for (uint32_t i = 0; i < h.num_vals; i++) {
+    DBCCacheVal v;
+    memcpy(&v, vals + i * sizeof(v), sizeof(v));
+
+    Val &val = dbc->vals[i];
+    val.name = get_string(v.name);
+    val.address = v.address;
+    val.def_val = get_string(v.def_val);
+    const int msg_idx = dbc->msg_index.find(val.address);
+    if (msg_idx >= 0) {
+      val.sigs = dbc->msgs[msg_idx].sigs;
+    }
+  }
+
+  munmap(mem, file_size);
+  return dbc;
+}
+
+static bool dbc_cache_write(const std::string &cache_path, const DBC &dbc, uint64_t source_hash) {
+  std::string strings;
+  auto add_string = [&](const std::string &s) {
+    uint32_t offset = strings.size();
+    strings.append(s.c_str(), s.size() + 1);
+    return offset;
+  };
+
+  std::vector<DBCCacheMsg> msgs;
+  std::vector<DBCCacheSignal> sigs;
+  std::vector<DBCCacheVal> vals;
+  for (const auto &msg : dbc.msgs) {
+    msgs.push_back({add_string(msg.name), msg.address, msg.size, (uint32_t)msg.sigs.size()});
+    for (const auto &sig : msg.sigs) {
+      DBCCacheSignal s = {};
+      s.name = add_string(sig.name);
+      s.start_bit = sig.start_bit;
+      s.msb = sig.msb;
+      s.lsb = sig.lsb;
+      s.size = sig.size;
+      s.is_signed = sig.is_signed;
+      s.is_little_endian = sig.is_little_endian;
+      s.type = sig.type;
+      s.has_calc_checksum = sig.calc_checksum != nullptr;
+      s.factor = sig.factor;
+      s.offset = sig.offset;
+      sigs.push_back(s);
+    }
+  }
+  for (const auto &val : dbc.vals) {
+    vals.push_back({add_string(val.name), val.address, add_string(val.def_val)});
+  }
+  if (strings.empty()) {
+    strings.push_back('\0');
+  }
+
+  DBCCacheHeader h = {
+    .magic = DBC_CACHE_MAGIC,
+    .version = DBC_CACHE_VERSION,
+    .source_hash = source_hash,
+    .num_msgs = (uint32_t)msgs.size(),
+    .num_sigs = (uint32_t)sigs.size(),
+    .num_vals = (uint32_t)vals.size(),
+    .strings_size = (uint32_t)strings.size(),
+  };
+
+  // several processes may fill the cache at once, write a private file and rename it into place
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), ec);
+  const std::string tmp_path = cache_path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+    f.write((const char *)&h, sizeof(h));
+    f.write((const char *)msgs.data(), msgs.size() * sizeof(DBCCacheMsg));
+    f.write((const char *)sigs.data(), sigs.size() * sizeof(DBCCacheSignal));
+    f.write((const char *)vals.data(), vals.size() * sizeof(DBCCacheVal));
+    f.write(strings.data(), strings.size());
+    if (!f.good()) {
+      f.close();
+      unlink(tmp_path.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+DBC* dbc_load(const std::string& dbc_path, const std::string& cache_dir) {
+  std::ifstream infile(dbc_path, std::ios::binary);
+  if (!infile) return nullptr;
+  const std::string source((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+
+  const std::filesystem::path path(dbc_path);
+  const std::string dbc_name = path.filename();
+  const std::string cache_path = cache_dir + "/" + path.stem().string() + ".bin";
+  const uint64_t source_hash = fnv1a_hash(source);
+
+  DBC *dbc = dbc_cache_read(cache_path, dbc_name, source_hash);
+  if (!dbc) {
+    std::istringstream stream(source);
+    std::unique_ptr<ChecksumState> checksum(get_checksum(dbc_name));
+    dbc = dbc_parse_from_stream(dbc_name, stream, checksum.get());
+    dbc_cache_write(cache_path, *dbc, source_hash);
+  }
+  return dbc;
+}
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <map>
 #include <stdexcept>
 #include <utility>
@@ -8,14 +9,14 @@
 #include "opendbc/can/common.h"
 
 
-void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
+void set_value(uint8_t *msg, size_t msg_size, const Signal &sig, int64_t ival) {
   int i = sig.lsb / 8;
   int bits = sig.size;
   if (sig.size < 64) {
     ival &= ((1ULL << sig.size) - 1);
   }
 
-  while (i >= 0 && i < msg.size() && bits > 0) {
+  while (i >= 0 && i < msg_size && bits > 0) {
     int shift = (int)(sig.lsb / 8) == i ? sig.lsb % 8 : 0;
     int size = std::min(bits, 8 - shift);
 
@@ -32,63 +33,116 @@ CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
 
-  for (const auto& msg : dbc->msgs) {
+  for (int i = 0; i < dbc->msgs.size(); i++) {
+    const auto& msg = dbc->msgs[i];
     message_lookup[msg.address] = msg;
+
+    MessageTemplate &m = messages.emplace_back();
+    m.msg = &msg;
+    auto &names = signal_lookup.emplace_back();
+    names.reserve(msg.sigs.size());
     for (const auto& sig : msg.sigs) {
-      signal_lookup[std::make_pair(msg.address, sig.name)] = sig;
+      names.emplace(sig.name, signal_handles.size());
+      signal_handles.push_back({i, &sig});
+      if (sig.name == "COUNTER") {
+        m.counter_sig = &sig;
+      } else if (sig.name == "CHECKSUM" && sig.calc_checksum != nullptr) {
+        m.checksum_sig = &sig;
+      }
     }
   }
+  pack_buf.reserve(64 + 8);
   init_crc_lookup_tables();
 }
 
-std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals) {
-  std::vector<uint8_t> ret(message_lookup[address].size, 0);
+int CANPacker::lookup_message_handle(uint32_t address) const {
+  return dbc->msg_index.find(address);
+}
+
+int CANPacker::lookup_signal_handle(uint32_t address, const std::string &name) const {
+  const int msg_handle = lookup_message_handle(address);
+  if (msg_handle < 0) return -1;
+  auto it = signal_lookup[msg_handle].find(name);
+  return it != signal_lookup[msg_handle].end() ? it->second : -1;
+}
+
+int CANPacker::pack(int msg_handle, const SignalHandleValue *values, size_t num_values, uint8_t *out, size_t out_size) {
+  if (msg_handle < 0 || msg_handle >= messages.size()) return -1;
+  MessageTemplate &m = messages[msg_handle];
+  const size_t size = m.msg->size;
+  if (out_size < size) return -1;
+
+  // zero padded, so any signal within the message is written with one 8 byte store
+  pack_buf.assign(size + 8, 0);
 
   // set all values for all given signal/value pairs
   bool counter_set = false;
-  for (const auto& sigval : signals) {
-    auto sig_it = signal_lookup.find(std::make_pair(address, sigval.name));
-    if (sig_it == signal_lookup.end()) {
-      // TODO: do something more here. invalid flag like CANParser?
-      WARN("undefined signal %s - %d\n", sigval.name.c_str(), address);
+  for (size_t i = 0; i < num_values; i++) {
+    const int handle = values[i].handle;
+    if (handle < 0 || handle >= signal_handles.size() || signal_handles[handle].msg_handle != msg_handle) {
+      WARN("undefined signal handle %d - %d\n", handle, m.msg->address);
       continue;
     }
-    const auto &sig = sig_it->second;
+    const Signal &sig = *signal_handles[handle].sig;
 
-    int64_t ival = (int64_t)(round((sigval.value - sig.offset) / sig.factor));
+    int64_t ival = (int64_t)(round((values[i].value - sig.offset) / sig.factor));
     if (ival < 0) {
       ival = (1ULL << sig.size) + ival;
     }
-    set_value(ret, sig, ival);
+    if (sig.decode_fast && sig.decode_last_byte < size) {
+      encode_raw_value(pack_buf.data(), sig, ival);
+    } else {
+      set_value(pack_buf.data(), size, sig, ival);
+    }
 
-    counter_set = counter_set || (sigval.name == "COUNTER");
-    if (counter_set) {
-      counters[address] = sigval.value;
+    if (&sig == m.counter_sig) {
+      counter_set = true;
+      m.counter = values[i].value;
     }
   }
+  pack_buf.resize(size);
 
   // set message counter
-  auto sig_it_counter = signal_lookup.find(std::make_pair(address, "COUNTER"));
-  if (!counter_set && sig_it_counter != signal_lookup.end()) {
-    const auto& sig = sig_it_counter->second;
-
-    if (counters.find(address) == counters.end()) {
-      counters[address] = 0;
-    }
-    set_value(ret, sig, counters[address]);
-    counters[address] = (counters[address] + 1) % (1 << sig.size);
+  if (!counter_set && m.counter_sig != nullptr) {
+    set_value(pack_buf.data(), size, *m.counter_sig, m.counter);
+    m.counter = (m.counter + 1) % (1 << m.counter_sig->size);
   }
 
   // set message checksum
-  auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
-    const auto &sig = sig_it_checksum->second;
-    if (sig.calc_checksum != nullptr) {
-      unsigned int checksum = sig.calc_checksum(address, sig, ret);
-      set_value(ret, sig, checksum);
+  if (m.checksum_sig != nullptr) {
+    unsigned int checksum = m.checksum_sig->calc_checksum(m.msg->address, *m.checksum_sig, pack_buf);
+    set_value(pack_buf.data(), size, *m.checksum_sig, checksum);
+  }
+
+  memcpy(out, pack_buf.data(), size);
+  return size;
+}
+
+std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals) {
+  const int msg_handle = lookup_message_handle(address);
+
+  // the message is looked up once, each signal is a hash lookup in it
+  std::vector<SignalHandleValue> values;
+  values.reserve(signals.size());
+  for (const auto& sigval : signals) {
+    int handle = -1;
+    if (msg_handle >= 0) {
+      auto it = signal_lookup[msg_handle].find(sigval.name);
+      if (it != signal_lookup[msg_handle].end()) handle = it->second;
+    }
+    if (handle < 0) {
+      // TODO: do something more here. invalid flag like CANParser?
+      WARN("undefined signal %s - %d\n", sigval.name.c_str(), address);
+      continue;
     }
+    values.push_back({handle, sigval.value});
+  }
+  if (msg_handle < 0) {
+    return {};
   }
 
+  std::vector<uint8_t> ret(messages[msg_handle].msg->size);
+  pack(msg_handle, values.data(), values.size(), ret.data(), ret.size());
   return ret;
 }
 
@@ -1,13 +1,13 @@
 # distutils: language = c++
 # cython: c_string_encoding=ascii, language_level=3
 
-from libc.stdint cimport uint8_t
+from libc.stdint cimport uint8_t, uint32_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
 
 from .common cimport CANPacker as cpp_CANPacker
-from .common cimport dbc_lookup, SignalPackValue, DBC
+from .common cimport dbc_lookup, SignalHandleValue, DBC
 
 
 cdef class CANPacker:
@@ -15,6 +15,8 @@ cdef class CANPacker:
     cpp_CANPacker *packer
     const DBC *dbc
     map[string, int] name_to_address
+    dict signal_handles
+    vector[SignalHandleValue] values_buf
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -25,18 +27,16 @@ cdef class CANPacker:
     for i in range(self.dbc[0].msgs.size()):
       msg = self.dbc[0].msgs[i]
       self.name_to_address[string(msg.name)] = msg.address
+    self.signal_handles = {}
 
-  cdef vector[uint8_t] pack(self, addr, values):
-    cdef vector[SignalPackValue] values_thing
-    values_thing.reserve(len(values))
-    cdef SignalPackValue spv
-
-    for name, value in values.iteritems():
-      spv.name = name.encode("utf8")
-      spv.value = value
-      values_thing.push_back(spv)
-
-    return self.packer.pack(addr, values_thing)
+  cdef int signal_handle(self, uint32_t addr, name):
+    # names are resolved to handles once per packer
+    key = (addr, name)
+    handle = self.signal_handles.get(key)
+    if handle is None:
+      handle = self.packer.lookup_signal_handle(addr, name.encode("utf8"))
+      self.signal_handles[key] = handle
+    return handle
 
   cpdef make_can_msg(self, name_or_addr, bus, values):
     cdef int addr
@@ -45,5 +45,15 @@ cdef class CANPacker:
     else:
       addr = self.name_to_address[name_or_addr.encode("utf8")]
 
-    cdef vector[uint8_t] val = self.pack(addr, values)
-    return [addr, 0, (<char *>&val[0])[:val.size()], bus]
+    cdef SignalHandleValue shv
+    self.values_buf.clear()
+    for name, value in values.items():
+      shv.handle = self.signal_handle(addr, name)
+      shv.value = value
+      self.values_buf.push_back(shv)
+
+    cdef uint8_t dat[64]
+    cdef int size = self.packer.pack(self.packer.lookup_message_handle(addr), self.values_buf.data(), self.values_buf.size(), dat, sizeof(dat))
+    if size < 0:
+      size = 0
+    return [addr, 0, (<char *>dat)[:size], bus]
@@ -34,14 +34,20 @@ int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
 
 
 bool MessageState::parse(uint64_t nanos, const std::vector<uint8_t> &dat) {
-  std::vector<double> tmp_vals(parse_sigs.size());
+  // zero padded copy, so any signal can be read with one 8 byte load
+  uint8_t padded[64 + 8] = {};
+  memcpy(padded, dat.data(), std::min(dat.size(), (size_t)64));
+
+  tmp_vals.resize(parse_sigs.size());
   bool checksum_failed = false;
   bool counter_failed = false;
 
   for (int i = 0; i < parse_sigs.size(); i++) {
     const auto &sig = parse_sigs[i];
 
-    int64_t tmp = get_raw_value(dat, sig);
+    // fall back to walking the bytes for signals wider than 8 bytes or past the end of a short message
+    const bool fast = sig.decode_fast && sig.decode_last_byte < dat.size();
+    int64_t tmp = fast ? decode_raw_value(padded, sig) : get_raw_value(dat, sig);
     if (sig.is_signed) {
       tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
     }
@@ -101,15 +107,17 @@ CANParser::CANParser(int abus, const std::string& dbc_name, const std::vector<st
 
   bus_timeout_threshold = std::numeric_limits<uint64_t>::max();
 
+  message_states.reserve(messages.size());
   for (const auto& [address, frequency] : messages) {
     // disallow duplicate message checks
-    if (message_states.find(address) != message_states.end()) {
+    if (state_index.find(address) >= 0) {
       std::stringstream is;
       is << "Duplicate Message Check: " << address;
       throw std::runtime_error(is.str());
     }
 
-    MessageState &state = message_states[address];
+    state_index.insert(address, message_states.size());
+    MessageState &state = message_states.emplace_back();
     state.address = address;
     // state.check_frequency = op.check_frequency,
 
@@ -121,13 +129,8 @@ CANParser::CANParser(int abus, const std::string& dbc_name, const std::vector<st
       bus_timeout_threshold = std::min(bus_timeout_threshold, state.check_threshold);
     }
 
-    const Msg* msg = NULL;
-    for (const auto& m : dbc->msgs) {
-      if (m.address == address) {
-        msg = &m;
-        break;
-      }
-    }
+    const int msg_idx = dbc->msg_index.find(address);
+    const Msg* msg = msg_idx >= 0 ? &dbc->msgs[msg_idx] : NULL;
     if (!msg) {
       fprintf(stderr, "CANParser: could not find message 0x%X in DBC %s\n", address, dbc_name.c_str());
       assert(false);
@@ -142,6 +145,8 @@ CANParser::CANParser(int abus, const std::string& dbc_name, const std::vector<st
     state.vals.resize(msg->sigs.size());
     state.all_vals.resize(msg->sigs.size());
   }
+
+  init_columns();
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -167,21 +172,53 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
       state.all_vals.push_back({});
     }
 
-    message_states[state.address] = state;
+    state_index.insert(state.address, message_states.size());
+    message_states.push_back(state);
   }
+
+  init_columns();
 }
 
-#ifndef DYNAMIC_CAPNP
-void CANParser::update_string(const std::string &data, bool sendcan) {
-  // format for board, make copy due to alignment issues.
-  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
-  if (aligned_buf.size() < buf_size) {
-    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+void CANParser::init_columns() {
+  for (auto &state : message_states) {
+    state.sig_id = columns.address.size();
+    for (const auto &sig : state.parse_sigs) {
+      columns.address.push_back(state.address);
+      columns.name.push_back(sig.name);
+    }
   }
-  memcpy(aligned_buf.begin(), data.data(), data.length());
 
+  const size_t num_sigs = columns.address.size();
+  columns.ts_nanos.assign(num_sigs, 0);
+  columns.value.assign(num_sigs, 0);
+  columns.all_values.assign(num_sigs * columns.all_values_depth, 0);
+  columns.all_values_count.assign(num_sigs, 0);
+  columns.updated.reserve(num_sigs);
+  updated_states.reserve(message_states.size());
+
+  // the first update reports every signal, so callers start out with their defaults
+  for (int i = 0; i < message_states.size(); i++) {
+    mark_updated(i);
+  }
+}
+
+void CANParser::mark_updated(int state_idx) {
+  MessageState &state = message_states[state_idx];
+  if (!state.updated) {
+    state.updated = true;
+    updated_states.push_back(state_idx);
+  }
+}
+
+#ifndef DYNAMIC_CAPNP
+static bool is_word_aligned(const std::string &data) {
+  return reinterpret_cast<uintptr_t>(data.data()) % alignof(capnp::word) == 0 &&
+         data.length() % sizeof(capnp::word) == 0;
+}
+
+void CANParser::update_event(kj::ArrayPtr<const capnp::word> words, bool sendcan) {
   // extract the messages
-  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  capnp::FlatArrayMessageReader cmsg(words);
   cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
 
   if (first_nanos == 0) {
@@ -195,23 +232,65 @@ void CANParser::update_string(const std::string &data, bool sendcan) {
   UpdateValid(last_nanos);
 }
 
-void CANParser::update_strings(const std::vector<std::string> &data, std::vector<SignalValue> &vals, bool sendcan) {
-  uint64_t current_nanos = 0;
+void CANParser::update_string(const std::string &data, bool sendcan) {
+  // format for board, make copy due to alignment issues.
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
+
+  update_event(aligned_buf.slice(0, buf_size), sendcan);
+}
+
+uint64_t CANParser::update_batch(const std::vector<std::string> &data, bool sendcan) {
+  // Events that are already word aligned are read in place, the rest are packed
+  // back to back into aligned_buf, which is grown at most once per batch.
+  size_t buf_size = 0;
   for (const auto &d : data) {
-    update_string(d, sendcan);
-    if (current_nanos == 0) {
-      current_nanos = last_nanos;
+    if (!is_word_aligned(d)) {
+      buf_size += (d.length() / sizeof(capnp::word)) + 1;
     }
   }
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+
+  // returns the time of the first event, like update_strings always used
+  uint64_t first_event_nanos = 0;
+  size_t offset = 0;
+  for (const auto &d : data) {
+    if (is_word_aligned(d)) {
+      update_event(kj::arrayPtr((const capnp::word *)d.data(), d.length() / sizeof(capnp::word)), sendcan);
+    } else {
+      const size_t size = (d.length() / sizeof(capnp::word)) + 1;
+      memcpy(aligned_buf.begin() + offset, d.data(), d.length());
+      update_event(aligned_buf.slice(offset, offset + size), sendcan);
+      offset += size;
+    }
+    if (first_event_nanos == 0) {
+      first_event_nanos = last_nanos;
+    }
+  }
+  return first_event_nanos;
+}
+
+void CANParser::update_strings(const std::vector<std::string> &data, std::vector<SignalValue> &vals, bool sendcan) {
+  uint64_t current_nanos = update_batch(data, sendcan);
   query_latest(vals, current_nanos);
 }
 
+void CANParser::update_columns(const std::vector<std::string> &data, bool sendcan) {
+  update_batch(data, sendcan);
+  query_columns();
+}
+
 void CANParser::UpdateCans(uint64_t nanos, const capnp::List<cereal::CanData>::Reader& cans) {
   //DEBUG("got %d messages\n", cans.size());
 
   bool bus_empty = true;
 
-  // parse the messages
+  // parse the messages, checking the bus before doing any address lookup
   for (const auto cmsg : cans) {
     if (cmsg.getSrc() != bus) {
       // DEBUG("skip %d: wrong bus\n", cmsg.getAddress());
@@ -219,11 +298,12 @@ void CANParser::UpdateCans(uint64_t nanos, const capnp::List<cereal::CanData>::R
     }
     bus_empty = false;
 
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
+    const int state_idx = state_index.find(cmsg.getAddress());
+    if (state_idx < 0) {
       // DEBUG("skip %d: not specified\n", cmsg.getAddress());
       continue;
     }
+    MessageState &state = message_states[state_idx];
 
     auto dat = cmsg.getDat();
 
@@ -233,14 +313,15 @@ void CANParser::UpdateCans(uint64_t nanos, const capnp::List<cereal::CanData>::R
     }
 
     // TODO: this actually triggers for some cars. fix and enable this
-    //if (dat.size() != state_it->second.size) {
-    //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state_it->second.size, dat.size(), cmsg.getAddress());
+    //if (dat.size() != state.size) {
+    //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state.size, dat.size(), cmsg.getAddress());
     //  continue;
     //}
 
-    std::vector<uint8_t> data(dat.size(), 0);
-    memcpy(data.data(), dat.begin(), dat.size());
-    state_it->second.parse(nanos, data);
+    dat_buf.assign(dat.begin(), dat.end());
+    if (state.parse(nanos, dat_buf)) {
+      mark_updated(state_idx);
+    }
   }
 
   // update bus timeout
@@ -260,17 +341,18 @@ void CANParser::UpdateCans(uint64_t nanos, const capnp::DynamicStruct::Reader& c
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
+  const int state_idx = state_index.find(cmsg.get("address").as<uint32_t>());
+  if (state_idx < 0) {
     DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
     return;
   }
 
   auto dat = cmsg.get("dat").as<capnp::Data>();
   if (dat.size() > 64) return; // shouldn't ever happen
-  std::vector<uint8_t> data(dat.size(), 0);
-  memcpy(data.data(), dat.begin(), dat.size());
-  state_it->second.parse(nanos, data);
+  dat_buf.assign(dat.begin(), dat.end());
+  if (message_states[state_idx].parse(nanos, dat_buf)) {
+    mark_updated(state_idx);
+  }
 }
 
 void CANParser::UpdateValid(uint64_t nanos) {
@@ -278,9 +360,7 @@ void CANParser::UpdateValid(uint64_t nanos) {
 
   bool _valid = true;
   bool _counters_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
-
+  for (const auto& state : message_states) {
     if (state.counter_fail >= MAX_BAD_COUNTER) {
       _counters_valid = false;
     }
@@ -306,8 +386,7 @@ void CANParser::query_latest(std::vector<SignalValue> &vals, uint64_t last_ts) {
   if (last_ts == 0) {
     last_ts = last_nanos;
   }
-  for (auto& kv : message_states) {
-    auto& state = kv.second;
+  for (auto& state : message_states) {
     if (last_ts != 0 && state.last_seen_nanos < last_ts) {
       continue;
     }
@@ -324,3 +403,44 @@ void CANParser::query_latest(std::vector<SignalValue> &vals, uint64_t last_ts) {
     }
   }
 }
+
+void CANParser::query_columns() {
+  // only messages parsed since the last call are touched
+  columns.updated.clear();
+
+  // grow the slots to the most values a signal got in this update, so none are dropped
+  size_t depth = columns.all_values_depth;
+  for (int state_idx : updated_states) {
+    for (const auto &all : message_states[state_idx].all_vals) {
+      depth = std::max(depth, all.size());
+    }
+  }
+  if (depth > columns.all_values_depth) {
+    // move every signal's values to its wider slot, they stay valid up to all_values_count
+    std::vector<double> all_values(columns.address.size() * depth, 0);
+    for (size_t id = 0; id < columns.address.size(); id++) {
+      const auto begin = columns.all_values.begin() + id * columns.all_values_depth;
+      std::copy(begin, begin + columns.all_values_count[id], all_values.begin() + id * depth);
+    }
+    columns.all_values.swap(all_values);
+    columns.all_values_depth = depth;
+  }
+
+  for (int state_idx : updated_states) {
+    auto &state = message_states[state_idx];
+    for (int i = 0; i < state.parse_sigs.size(); i++) {
+      const uint32_t id = state.sig_id + i;
+      auto &all = state.all_vals[i];
+      const size_t n = all.size();
+
+      columns.ts_nanos[id] = state.last_seen_nanos;
+      columns.value[id] = state.vals[i];
+      std::copy(all.begin(), all.end(), columns.all_values.begin() + id * columns.all_values_depth);
+      columns.all_values_count[id] = n;
+      columns.updated.push_back(id);
+      all.clear();
+    }
+    state.updated = false;
+  }
+  updated_states.clear();
+}
@@ -1,7 +1,6 @@
 # distutils: language = c++
 # cython: c_string_encoding=ascii, language_level=3
 
-from cython.operator cimport dereference as deref, preincrement as preinc
 from libcpp.pair cimport pair
 from libcpp.string cimport string
 from libcpp.vector cimport vector
@@ -9,7 +8,7 @@ from libcpp.unordered_set cimport unordered_set
 from libc.stdint cimport uint32_t
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport dbc_lookup, SignalValue, DBC
+from .common cimport dbc_lookup, SignalColumns, DBC
 
 import numbers
 from collections import defaultdict
@@ -19,7 +18,7 @@ cdef class CANParser:
   cdef:
     cpp_CANParser *can
     const DBC *dbc
-    vector[SignalValue] can_values
+    list sig_names
 
   cdef readonly:
     dict vl
@@ -64,6 +63,10 @@ cdef class CANParser:
       self.ts_nanos[name] = self.ts_nanos[address]
 
     self.can = new cpp_CANParser(bus, dbc_name, message_v)
+
+    # signal ids are fixed, so names only need converting once
+    self.sig_names = [name.decode("utf8") for name in self.can.columns.name]
+    # the first update fills in every signal with its default
     self.update_strings([])
 
   def update_strings(self, strings, sendcan=False):
@@ -71,21 +74,20 @@ cdef class CANParser:
       for l in v.values():  # no-cython-lint
         l.clear()
 
-    cdef vector[SignalValue] new_vals
     cdef unordered_set[uint32_t] updated_addrs
-
-    self.can.update_strings(strings, new_vals, sendcan)
-    cdef vector[SignalValue].iterator it = new_vals.begin()
-    cdef SignalValue* cv
-    while it != new_vals.end():
-      cv = &deref(it)
-      # Cast char * directly to unicode
-      cv_name = <unicode>cv.name
-      self.vl[cv.address][cv_name] = cv.value
-      self.vl_all[cv.address][cv_name] = cv.all_values
-      self.ts_nanos[cv.address][cv_name] = cv.ts_nanos
-      updated_addrs.insert(cv.address)
-      preinc(it)
+    cdef uint32_t i, j, sig_id, address, offset
+
+    self.can.update_columns(strings, sendcan)
+    cdef SignalColumns *cols = &self.can.columns
+    for i in range(cols.updated.size()):
+      sig_id = cols.updated[i]
+      address = cols.address[sig_id]
+      name = self.sig_names[sig_id]
+      offset = sig_id * cols.all_values_depth
+      self.vl[address][name] = cols.value[sig_id]
+      self.vl_all[address][name] = [cols.all_values[offset + j] for j in range(cols.all_values_count[sig_id])]
+      self.ts_nanos[address][name] = cols.ts_nanos[sig_id]
+      updated_addrs.insert(address)
 
     return updated_addrs
 
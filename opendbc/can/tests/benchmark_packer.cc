@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opendbc/can/common.h"
+
+// Packs every message of a DBC with all of its signals. The name based pack is compared
+// against the implementation it replaced, a map lookup per signal into a fresh vector,
+// and against the handle based pack.
+// usage: benchmark_packer <dbc name>
+
+// CANPacker::pack(address, values) before signal handles, kept as the reference
+class ReferencePacker {
+public:
+  ReferencePacker(const DBC *dbc) {
+    for (const auto &msg : dbc->msgs) {
+      message_lookup[msg.address] = msg;
+      for (const auto &sig : msg.sigs) {
+        signal_lookup[std::make_pair(msg.address, sig.name)] = sig;
+      }
+    }
+  }
+
+  std::vector<uint8_t> pack(uint32_t address, const std::vector<SignalPackValue> &signals) {
+    std::vector<uint8_t> ret(message_lookup[address].size, 0);
+
+    bool counter_set = false;
+    for (const auto &sigval : signals) {
+      auto sig_it = signal_lookup.find(std::make_pair(address, sigval.name));
+      if (sig_it == signal_lookup.end()) continue;
+      const auto &sig = sig_it->second;
+
+      int64_t ival = (int64_t)(round((sigval.value - sig.offset) / sig.factor));
+      if (ival < 0) {
+        ival = (1ULL << sig.size) + ival;
+      }
+      set_value(ret, sig, ival);
+
+      counter_set = counter_set || (sigval.name == "COUNTER");
+      if (counter_set) {
+        counters[address] = sigval.value;
+      }
+    }
+
+    auto sig_it_counter = signal_lookup.find(std::make_pair(address, "COUNTER"));
+    if (!counter_set && sig_it_counter != signal_lookup.end()) {
+      const auto &sig = sig_it_counter->second;
+      if (counters.find(address) == counters.end()) {
+        counters[address] = 0;
+      }
+      set_value(ret, sig, counters[address]);
+      counters[address] = (counters[address] + 1) % (1 << sig.size);
+    }
+
+    auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
+    if (sig_it_checksum != signal_lookup.end()) {
+      const auto &sig = sig_it_checksum->second;
+      if (sig.calc_checksum != nullptr) {
+        unsigned int checksum = sig.calc_checksum(address, sig, ret);
+        set_value(ret, sig, checksum);
+      }
+    }
+    return ret;
+  }
+
+private:
+  static void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
+    int i = sig.lsb / 8;
+    int bits = sig.size;
+    if (sig.size < 64) {
+      ival &= ((1ULL << sig.size) - 1);
+    }
+
+    while (i >= 0 && i < (int)msg.size() && bits > 0) {
+      int shift = (int)(sig.lsb / 8) == i ? sig.lsb % 8 : 0;
+      int size = std::min(bits, 8 - shift);
+
+      msg[i] &= ~(((1ULL << size) - 1) << shift);
+      msg[i] |= (ival & ((1ULL << size) - 1)) << shift;
+
+      bits -= size;
+      ival >>= size;
+      i = sig.is_little_endian ? i+1 : i-1;
+    }
+  }
+
+  std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
+  std::map<uint32_t, Msg> message_lookup;
+  std::map<uint32_t, uint32_t> counters;
+};
+
+static double millis_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <dbc name>\n", argv[0]);
+    return 1;
+  }
+
+  const DBC *dbc = dbc_lookup(argv[1]);
+  if (!dbc) {
+    printf("can't find DBC %s\n", argv[1]);
+    return 1;
+  }
+
+  ReferencePacker reference(dbc);
+  CANPacker by_name(argv[1]), by_handle(argv[1]);
+
+  // the same values for all of them, resolved to handles up front
+  std::vector<std::vector<SignalPackValue>> named_values;
+  std::vector<std::pair<int, std::vector<SignalHandleValue>>> handle_values;
+  size_t num_signals = 0;
+  for (const auto &msg : dbc->msgs) {
+    auto &named = named_values.emplace_back();
+    auto &[msg_handle, handles] = handle_values.emplace_back();
+    msg_handle = by_handle.lookup_message_handle(msg.address);
+    for (const auto &sig : msg.sigs) {
+      const double value = sig.offset + sig.factor * (num_signals % 7);
+      named.push_back({sig.name, value});
+      handles.push_back({by_handle.lookup_signal_handle(msg.address, sig.name), value});
+      num_signals++;
+    }
+  }
+  printf("%zu messages, %zu signals\n", dbc->msgs.size(), num_signals);
+
+  const int iterations = 10000;
+  uint64_t checksum[3] = {};
+
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < dbc->msgs.size(); i++) {
+      std::vector<uint8_t> dat = reference.pack(dbc->msgs[i].address, named_values[i]);
+      for (uint8_t b : dat) checksum[0] += b;
+    }
+  }
+  const double reference_ms = millis_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < dbc->msgs.size(); i++) {
+      std::vector<uint8_t> dat = by_name.pack(dbc->msgs[i].address, named_values[i]);
+      for (uint8_t b : dat) checksum[1] += b;
+    }
+  }
+  const double name_ms = millis_since(start);
+
+  uint8_t dat[64];
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    for (const auto &[msg_handle, handles] : handle_values) {
+      const int size = by_handle.pack(msg_handle, handles.data(), handles.size(), dat, sizeof(dat));
+      for (int j = 0; j < size; j++) checksum[2] += dat[j];
+    }
+  }
+  const double handle_ms = millis_since(start);
+
+  const double total_msgs = (double)dbc->msgs.size() * iterations;
+  printf("reference: %8.2f ms, %6.1f ns/message\n", reference_ms, reference_ms * 1e6 / total_msgs);
+  printf("by name:   %8.2f ms, %6.1f ns/message, %.2fx\n", name_ms, name_ms * 1e6 / total_msgs, reference_ms / name_ms);
+  printf("by handle: %8.2f ms, %6.1f ns/message, %.2fx\n", handle_ms, handle_ms * 1e6 / total_msgs, reference_ms / handle_ms);
+  if (checksum[0] != checksum[1] || checksum[0] != checksum[2]) {
+    printf("packed messages differ!\n");
+    return 1;
+  }
+  return 0;
+}
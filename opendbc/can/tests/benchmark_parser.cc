@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <capnp/serialize.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "opendbc/can/common.h"
+
+// Replays the can events of an uncompressed rlog (bunzip2 it first) through the parser.
+// Reports the signal decoders, the checksum kernels and the parser's frames/sec.
+// usage: benchmark_parser <rlog> <dbc name> [bus]
+
+struct Frame {
+  uint32_t address;
+  std::vector<uint8_t> dat;
+};
+
+static double millis_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void read_can_events(const std::string &path, int bus, std::vector<Frame> &frames, std::vector<std::string> &events) {
+  std::ifstream f(path, std::ios::binary);
+  std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+  kj::Array<capnp::word> buf = kj::heapArray<capnp::word>(raw.size() / sizeof(capnp::word));
+  memcpy(buf.begin(), raw.data(), buf.size() * sizeof(capnp::word));
+
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+
+  kj::ArrayPtr<const capnp::word> words = buf;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words, options);
+    auto event = reader.getRoot<cereal::Event>();
+    if (event.which() == cereal::Event::CAN) {
+      events.emplace_back((const char *)words.begin(), (const char *)reader.getEnd());
+      for (const auto c : event.getCan()) {
+        if (c.getSrc() == bus && c.getDat().size() <= 64) {
+          frames.push_back({c.getAddress(), {c.getDat().begin(), c.getDat().end()}});
+        }
+      }
+    }
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("usage: %s <rlog> <dbc name> [bus]\n", argv[0]);
+    return 1;
+  }
+  const int bus = argc > 3 ? atoi(argv[3]) : 0;
+
+  const DBC *dbc = dbc_lookup(argv[2]);
+  if (!dbc) {
+    printf("can't find DBC %s\n", argv[2]);
+    return 1;
+  }
+  std::map<uint32_t, const Msg *> msgs;
+  for (const auto &m : dbc->msgs) {
+    msgs[m.address] = &m;
+  }
+
+  std::vector<Frame> frames;
+  std::vector<std::string> events;
+  read_can_events(argv[1], bus, frames, events);
+
+  std::vector<std::pair<const Msg *, const Frame *>> known;
+  size_t num_signals = 0;
+  for (const auto &f : frames) {
+    auto it = msgs.find(f.address);
+    if (it != msgs.end()) {
+      known.push_back({it->second, &f});
+      num_signals += it->second->sigs.size();
+    }
+  }
+  printf("%zu frames on bus %d, %zu in DBC, %zu signals\n", frames.size(), bus, known.size(), num_signals);
+  if (known.empty()) return 0;
+
+  const int iterations = 20;
+  int64_t checksum[2] = {};
+
+  // byte walking decode, with a vector copy per frame like the parser used to do
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    for (const auto &[msg, frame] : known) {
+      std::vector<uint8_t> data(frame->dat.size(), 0);
+      memcpy(data.data(), frame->dat.data(), frame->dat.size());
+      for (const auto &sig : msg->sigs) {
+        checksum[0] += get_raw_value(data, sig);
+      }
+    }
+  }
+  double legacy_ms = millis_since(start);
+
+  // precompiled single load decode
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    for (const auto &[msg, frame] : known) {
+      uint8_t padded[64 + 8] = {};
+      memcpy(padded, frame->dat.data(), frame->dat.size());
+      for (const auto &sig : msg->sigs) {
+        const bool fast = sig.decode_fast && sig.decode_last_byte < frame->dat.size();
+        checksum[1] += fast ? decode_raw_value(padded, sig) : get_raw_value(frame->dat, sig);
+      }
+    }
+  }
+  double compiled_ms = millis_since(start);
+
+  const double total_signals = (double)num_signals * iterations;
+  printf("byte walking: %8.2f ms, %6.1f ns/signal\n", legacy_ms, legacy_ms * 1e6 / total_signals);
+  printf("compiled:     %8.2f ms, %6.1f ns/signal\n", compiled_ms, compiled_ms * 1e6 / total_signals);
+  if (checksum[0] != checksum[1]) {
+    printf("decoded values differ!\n");
+    return 1;
+  }
+
+  // checksum kernels over every frame on the bus
+  init_crc_lookup_tables();
+  const ChecksumKernel default_kernel = get_checksum_kernel();
+  const std::pair<ChecksumKernel, const char *> kernels[] = {
+    {CHECKSUM_KERNEL_SCALAR, "scalar"}, {CHECKSUM_KERNEL_SSE2, "sse2"}, {CHECKSUM_KERNEL_AVX2, "avx2"},
+  };
+  uint64_t kernel_checksum = 0;
+  for (const auto &[kernel, name] : kernels) {
+    if (!set_checksum_kernel(kernel)) {
+      printf("%-6s checksum kernel not supported\n", name);
+      continue;
+    }
+    uint64_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++) {
+      for (const auto &f : frames) {
+        sum += xor_bytes(f.dat.data(), f.dat.size()) + sum_bytes(f.dat.data(), f.dat.size());
+      }
+    }
+    const double ms = millis_since(start);
+    printf("%-6s checksum kernel: %8.2f ms, %6.1f ns/frame%s\n", name, ms, ms * 1e6 / (frames.size() * iterations),
+           kernel == default_kernel ? " (default)" : "");
+    if (kernel_checksum != 0 && sum != kernel_checksum) {
+      printf("checksum kernels differ!\n");
+      return 1;
+    }
+    kernel_checksum = sum;
+  }
+  set_checksum_kernel(default_kernel);
+
+  // whole parser, one event per call and in batches like the python parser gets them
+  for (size_t batch_size : {(size_t)1, (size_t)100}) {
+    std::vector<std::vector<std::string>> batches;
+    for (size_t i = 0; i < events.size(); i += batch_size) {
+      batches.emplace_back(events.begin() + i, events.begin() + std::min(i + batch_size, events.size()));
+    }
+
+    CANParser parser(bus, argv[2], false, false);
+    start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++) {
+      for (const auto &batch : batches) {
+        parser.update_columns(batch, false);
+      }
+    }
+    const double ms = millis_since(start);
+    printf("parser, %3zu events per update: %8.2f ms, %.2f M frames/sec\n", batch_size, ms,
+           frames.size() * iterations / ms / 1e3);
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <random>
+#include <vector>
+
+#include "opendbc/can/common.h"
+
+// common.h's log macros collide with catch2's
+#undef INFO
+#undef WARN
+#include "catch2/catch.hpp"
+
+TEST_CASE("checksum kernels match the byte loops") {
+  std::mt19937 rng(0);
+  for (auto kernel : {CHECKSUM_KERNEL_SCALAR, CHECKSUM_KERNEL_SSE2, CHECKSUM_KERNEL_AVX2}) {
+    if (!set_checksum_kernel(kernel)) continue;
+
+    for (size_t size = 0; size <= 64; size++) {
+      std::vector<uint8_t> d(size);
+      for (auto &b : d) b = rng();
+
+      uint8_t x = 0;
+      unsigned int s = 0;
+      for (auto b : d) {
+        x ^= b;
+        s += b;
+      }
+      INFO("kernel " << (int)kernel << " size " << size);
+      REQUIRE(xor_bytes(d.data(), d.size()) == x);
+      REQUIRE(sum_bytes(d.data(), d.size()) == s);
+    }
+  }
+}
+
+TEST_CASE("checksums of short frames") {
+  const Signal sig = {};
+  const uint32_t address = 0x1A2;
+  const unsigned int address_sum = 0x01 + 0xA2;
+
+  SECTION("zero-length frame") {
+    const std::vector<uint8_t> d;
+    REQUIRE(subaru_checksum(address, sig, d) == address_sum);
+    REQUIRE(toyota_checksum(address, sig, d) == address_sum);
+  }
+  SECTION("only the checksum byte") {
+    const std::vector<uint8_t> d = {0x55};
+    REQUIRE(subaru_checksum(address, sig, d) == address_sum);
+    REQUIRE(toyota_checksum(address, sig, d) == address_sum + 1);
+  }
+  SECTION("checksum byte is skipped") {
+    const std::vector<uint8_t> d = {0xFF, 0x10, 0x20};
+    REQUIRE(subaru_checksum(address, sig, d) == ((address_sum + 0x30) & 0xFF));
+    REQUIRE(toyota_checksum(address, sig, {0x10, 0x20, 0xFF}) == ((address_sum + 3 + 0x30) & 0xFF));
+  }
+}
+
+// CRC-16 XMODEM a bit at a time, the HKG CAN FD checksum without any lookup table
+static uint16_t hkg_can_fd_reference(uint32_t address, const std::vector<uint8_t> &d) {
+  auto update = [](uint16_t crc, uint8_t b) {
+    crc ^= b << 8;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+  };
+
+  uint16_t crc = 0;
+  for (size_t i = 2; i < d.size(); i++) {
+    crc = update(crc, d[i]);
+  }
+  crc = update(crc, address & 0xFF);
+  crc = update(crc, (address >> 8) & 0xFF);
+
+  if (d.size() == 8) {
+    crc ^= 0x5f29;
+  } else if (d.size() == 16) {
+    crc ^= 0x041d;
+  } else if (d.size() == 24) {
+    crc ^= 0x819d;
+  } else if (d.size() == 32) {
+    crc ^= 0x9f5b;
+  }
+  return crc;
+}
+
+TEST_CASE("hkg_can_fd_checksum matches a per-byte CRC16") {
+  init_crc_lookup_tables();
+  const Signal sig = {};
+  std::mt19937 rng(0);
+
+  // the CAN FD lengths, and odd ones for the single byte tail
+  for (size_t size : {0, 1, 2, 3, 7, 8, 12, 16, 20, 24, 32, 48, 63, 64}) {
+    for (int n = 0; n < 100; n++) {
+      std::vector<uint8_t> d(size);
+      for (auto &b : d) b = rng();
+      const uint32_t address = rng() & 0x7FF;
+
+      INFO("size " << size << " address " << address);
+      REQUIRE(hkg_can_fd_checksum(address, sig, d) == hkg_can_fd_reference(address, d));
+    }
+  }
+}
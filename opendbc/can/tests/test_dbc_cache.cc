@@ -0,0 +1,161 @@
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "opendbc/can/common.h"
+#include "opendbc/can/common_dbc.h"
+
+// common.h's log macros collide with catch2's
+#undef INFO
+#undef WARN
+#include "catch2/catch.hpp"
+
+namespace fs = std::filesystem;
+
+static const std::string TEST_DBC = "honda_civic_touring_2016_can_generated";
+
+static std::string read_file(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path, const std::string &data) {
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write(data.data(), data.size());
+}
+
+static void require_same_signal(const Signal &a, const Signal &b) {
+  INFO("signal " << a.name);
+  REQUIRE(a.name == b.name);
+  REQUIRE(a.start_bit == b.start_bit);
+  REQUIRE(a.msb == b.msb);
+  REQUIRE(a.lsb == b.lsb);
+  REQUIRE(a.size == b.size);
+  REQUIRE(a.is_signed == b.is_signed);
+  REQUIRE(a.factor == b.factor);
+  REQUIRE(a.offset == b.offset);
+  REQUIRE(a.is_little_endian == b.is_little_endian);
+  REQUIRE(a.type == b.type);
+  REQUIRE(a.calc_checksum == b.calc_checksum);
+  REQUIRE(a.decode_fast == b.decode_fast);
+  REQUIRE(a.decode_byte == b.decode_byte);
+  REQUIRE(a.decode_last_byte == b.decode_last_byte);
+  REQUIRE(a.decode_shift == b.decode_shift);
+  REQUIRE(a.decode_mask == b.decode_mask);
+}
+
+static void require_same_dbc(const DBC &a, const DBC &b) {
+  REQUIRE(a.name == b.name);
+  REQUIRE(a.msgs.size() == b.msgs.size());
+  for (size_t i = 0; i < a.msgs.size(); i++) {
+    const Msg &ma = a.msgs[i], &mb = b.msgs[i];
+    INFO("msg " << ma.name);
+    REQUIRE(ma.name == mb.name);
+    REQUIRE(ma.address == mb.address);
+    REQUIRE(ma.size == mb.size);
+    REQUIRE(ma.sigs.size() == mb.sigs.size());
+    for (size_t j = 0; j < ma.sigs.size(); j++) {
+      require_same_signal(ma.sigs[j], mb.sigs[j]);
+    }
+    REQUIRE(b.msg_index.find(ma.address) == (int)i);
+  }
+
+  REQUIRE(a.vals.size() == b.vals.size());
+  for (size_t i = 0; i < a.vals.size(); i++) {
+    const Val &va = a.vals[i], &vb = b.vals[i];
+    INFO("val " << va.name);
+    REQUIRE(va.name == vb.name);
+    REQUIRE(va.address == vb.address);
+    REQUIRE(va.def_val == vb.def_val);
+    REQUIRE(va.sigs.size() == vb.sigs.size());
+    for (size_t j = 0; j < va.sigs.size(); j++) {
+      require_same_signal(va.sigs[j], vb.sigs[j]);
+    }
+  }
+}
+
+TEST_CASE("dbc cache") {
+  char tmpl[] = "/tmp/dbc_cache_test_XXXXXX";
+  REQUIRE(mkdtemp(tmpl) != nullptr);
+  const std::string dir = tmpl;
+  const std::string dbc_path = dir + "/" + TEST_DBC + ".dbc";
+  const std::string cache_dir = dir + "/cache";
+  const std::string cache_path = cache_dir + "/" + TEST_DBC + ".bin";
+  fs::copy_file(std::string(DBC_FILE_PATH) + "/" + TEST_DBC + ".dbc", dbc_path);
+
+  std::unique_ptr<DBC> parsed(dbc_parse(dbc_path));
+  REQUIRE(parsed != nullptr);
+  REQUIRE(!parsed->vals.empty());
+
+  // the first load parses and fills the cache
+  std::unique_ptr<DBC> first(dbc_load(dbc_path, cache_dir));
+  REQUIRE(first != nullptr);
+  require_same_dbc(*parsed, *first);
+  REQUIRE(fs::exists(cache_path));
+  const std::string cache = read_file(cache_path);
+
+  SECTION("round trip") {
+    const auto mtime = fs::last_write_time(cache_path);
+    std::unique_ptr<DBC> cached(dbc_load(dbc_path, cache_dir));
+    REQUIRE(cached != nullptr);
+    require_same_dbc(*parsed, *cached);
+    // read, not rewritten
+    REQUIRE(fs::last_write_time(cache_path) == mtime);
+    REQUIRE(read_file(cache_path) == cache);
+  }
+
+  // a rejected cache is parsed again and rewritten
+  SECTION("stale version") {
+    std::string bad = cache;
+    bad[4] ^= 0xff;  // DBCCacheHeader::version
+    write_file(cache_path, bad);
+
+    std::unique_ptr<DBC> dbc(dbc_load(dbc_path, cache_dir));
+    REQUIRE(dbc != nullptr);
+    require_same_dbc(*parsed, *dbc);
+    REQUIRE(read_file(cache_path) == cache);
+  }
+
+  SECTION("stale hash") {
+    std::string bad = cache;
+    bad[8] ^= 0xff;  // DBCCacheHeader::source_hash
+    write_file(cache_path, bad);
+
+    std::unique_ptr<DBC> dbc(dbc_load(dbc_path, cache_dir));
+    REQUIRE(dbc != nullptr);
+    require_same_dbc(*parsed, *dbc);
+    REQUIRE(read_file(cache_path) == cache);
+  }
+
+  SECTION("truncated") {
+    for (size_t size : {(size_t)0, (size_t)16, cache.size() / 2, cache.size() - 1}) {
+      INFO("size " << size);
+      write_file(cache_path, cache.substr(0, size));
+
+      std::unique_ptr<DBC> dbc(dbc_load(dbc_path, cache_dir));
+      REQUIRE(dbc != nullptr);
+      require_same_dbc(*parsed, *dbc);
+      REQUIRE(read_file(cache_path) == cache);
+    }
+  }
+
+  SECTION("changed source") {
+    std::string source = read_file(dbc_path);
+    const size_t pos = source.find("GAS_COMMAND:");
+    REQUIRE(pos != std::string::npos);
+    source.replace(pos, 11, "GAS_COMMAND_2");
+    write_file(dbc_path, source);
+
+    std::unique_ptr<DBC> changed(dbc_parse(dbc_path));
+    std::unique_ptr<DBC> dbc(dbc_load(dbc_path, cache_dir));
+    REQUIRE(dbc != nullptr);
+    require_same_dbc(*changed, *dbc);
+    REQUIRE(read_file(cache_path) != cache);
+  }
+
+  fs::remove_all(dir);
+}
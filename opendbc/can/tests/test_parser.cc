@@ -0,0 +1,45 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opendbc/can/common.h"
+
+// common.h's log macros collide with catch2's
+#undef INFO
+#undef WARN
+#include "catch2/catch.hpp"
+
+TEST_CASE("CANParser reports every signal on the first update") {
+  const std::string dbc_name = "honda_civic_touring_2016_can_generated";
+  const DBC *dbc = dbc_lookup(dbc_name);
+  REQUIRE(dbc != nullptr);
+
+  const std::vector<std::pair<uint32_t, int>> messages = {{0x13c, 0}, {0x1a4, 0}, {0x1d0, 0}};
+  CANParser parser(0, dbc_name, messages);
+
+  std::vector<std::pair<uint32_t, std::string>> expected;
+  for (const auto &[address, freq] : messages) {
+    const Msg &msg = dbc->msgs[dbc->msg_index.find(address)];
+    for (const auto &sig : msg.sigs) {
+      expected.push_back({address, sig.name});
+    }
+  }
+
+  // nothing is parsed yet, every requested signal still comes out with its default
+  parser.query_columns();
+  const SignalColumns &columns = parser.columns;
+  REQUIRE(columns.updated.size() == expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    const uint32_t id = columns.updated[i];
+    INFO(expected[i].second);
+    REQUIRE(columns.address[id] == expected[i].first);
+    REQUIRE(columns.name[id] == expected[i].second);
+    REQUIRE(columns.value[id] == 0);
+    REQUIRE(columns.ts_nanos[id] == 0);
+    REQUIRE(columns.all_values_count[id] == 0);
+  }
+
+  // after that, only what was parsed since
+  parser.query_columns();
+  REQUIRE(columns.updated.empty());
+}
@@ -7,6 +7,7 @@
 #include <cassert>
 #include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <future>
 #include <memory>
 #include <thread>
@@ -43,6 +44,9 @@
 #define MIN_IR_POWER 0.0f
 #define CUTOFF_IL 400
 #define SATURATE_IL 1000
+
+// first segment of the can message, enough for the busiest rounds
+#define CAN_MSG_ARENA_WORDS (16 * 1024)
 using namespace std::chrono_literals;
 
 std::atomic<bool> ignition(false);
@@ -241,7 +245,13 @@ void can_recv_thread(std::vector<Panda *> pandas) {
 
   // run at 100Hz
   RateKeeper rk("boardd_can_recv", 100);
+
+  // the frames and the message are reused every round. there's room for every panda's
+  // receive buffer full of empty frames, so nothing is allocated after the first few rounds.
   std::vector<can_frame> raw_can_data;
+  raw_can_data.reserve(pandas.size() * (RECV_SIZE + CANPACKET_DATA_SIZE_MAX) / sizeof(can_header));
+  kj::Array<capnp::word> arena = kj::heapArray<capnp::word>(CAN_MSG_ARENA_WORDS);
+  memset(arena.begin(), 0, arena.asBytes().size());
 
   while (!do_exit && check_all_connected(pandas)) {
     bool comms_healthy = true;
@@ -250,14 +260,14 @@ void can_recv_thread(std::vector<Panda *> pandas) {
       comms_healthy &= panda->can_receive(raw_can_data);
     }
 
-    MessageBuilder msg;
+    MessageBuilder msg(arena);
     auto evt = msg.initEvent();
     evt.setValid(comms_healthy);
     auto canData = evt.initCan(raw_can_data.size());
     for (uint i = 0; i<raw_can_data.size(); i++) {
       canData[i].setAddress(raw_can_data[i].address);
       canData[i].setBusTime(raw_can_data[i].busTime);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
+      canData[i].setDat(kj::arrayPtr(raw_can_data[i].dat, raw_can_data[i].len));
       canData[i].setSrc(raw_can_data[i].src);
     }
     pm.send("can", msg);
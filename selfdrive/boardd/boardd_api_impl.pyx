@@ -3,13 +3,15 @@
 from libcpp.vector cimport vector
 from libcpp.string cimport string
 from libcpp cimport bool
+from libc.string cimport memcpy
 
 cdef extern from "panda.h":
   cdef struct can_frame:
     long address
-    string dat
     long busTime
     long src
+    unsigned char len
+    unsigned char dat[64]
 
 cdef extern from "can_list_to_can_capnp.cc":
   void can_list_to_can_capnp_cpp(const vector[can_frame] &can_list, string &out, bool sendCan, bool valid)
@@ -19,10 +21,15 @@ def can_list_to_can_capnp(can_msgs, msgtype='can', valid=True):
   can_list.reserve(len(can_msgs))
 
   cdef can_frame f
+  cdef string dat
   for can_msg in can_msgs:
+    dat = can_msg[2]
+    if dat.size() > sizeof(f.dat):
+      raise ValueError(f"CAN data of {dat.size()} bytes, more than {sizeof(f.dat)}")
     f.address = can_msg[0]
     f.busTime = can_msg[1]
-    f.dat = can_msg[2]
+    f.len = dat.size()
+    memcpy(f.dat, dat.data(), dat.size())
     f.src = can_msg[3]
     can_list.push_back(f)
   cdef string out
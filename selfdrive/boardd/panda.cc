@@ -274,7 +274,7 @@ void Panda::can_reset_communications() {
 bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_frame> &out_vec) {
   int pos = 0;
 
-  while (pos <= size - sizeof(can_header)) {
+  while (pos + sizeof(can_header) <= size) {
     can_header header;
     memcpy(&header, &data[pos], sizeof(can_header));
 
@@ -284,6 +284,12 @@ bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_fra
       break;
     }
 
+    if (calculate_checksum(&data[pos], sizeof(can_header) + data_len) != 0) {
+      LOGE("Panda CAN checksum failed");
+      size = 0;
+      return false;
+    }
+
     can_frame &canData = out_vec.emplace_back();
     canData.busTime = 0;
     canData.address = header.addr;
@@ -294,20 +300,17 @@ bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_fra
     if (header.returned) {
       canData.src += CAN_RETURNED_BUS_OFFSET;
     }
-
-    if (calculate_checksum(&data[pos], sizeof(can_header) + data_len) != 0) {
-      LOGE("Panda CAN checksum failed");
-      size = 0;
-      return false;
-    }
-
-    canData.dat.assign((char *)&data[pos + sizeof(can_header)], data_len);
+    canData.len = data_len;
+    memcpy(canData.dat, &data[pos + sizeof(can_header)], data_len);
 
     pos += sizeof(can_header) + data_len;
   }
 
-  // move the overflowing data to the beginning of the buffer for the next round
-  memmove(data, &data[pos], size - pos);
+  // move the overflowing data to the beginning of the buffer for the next round,
+  // at most one partial message and usually nothing
+  if (pos < size) {
+    memmove(data, &data[pos], size - pos);
+  }
   size -= pos;
 
   return true;
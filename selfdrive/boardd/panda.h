@@ -34,11 +34,13 @@ struct __attribute__((packed)) can_header {
   uint8_t checksum : 8;
 };
 
+// plain old data with the payload inline, so a vector of them that's cleared and refilled doesn't allocate
 struct can_frame {
   long address;
-  std::string dat;
   long busTime;
   long src;
+  uint8_t len;
+  uint8_t dat[CANPACKET_DATA_SIZE_MAX];
 };
 
 
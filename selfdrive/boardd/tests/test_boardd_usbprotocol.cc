@@ -11,6 +11,7 @@ struct PandaTest : public Panda {
   void test_can_send();
   void test_can_recv(uint32_t chunk_size = 0);
   void test_chunked_can_recv();
+  void benchmark_can_recv();
 
   std::map<int, std::string> test_data;
   int can_list_size = 0;
@@ -96,12 +97,42 @@ void PandaTest::test_can_recv(uint32_t rx_chunk_size) {
   REQUIRE(frames.size() == can_list_size);
   for (int i = 0; i < frames.size(); ++i) {
     REQUIRE(frames[i].address == i);
-    REQUIRE(test_data.find(frames[i].dat.size()) != test_data.end());
-    const std::string &dat = test_data[frames[i].dat.size()];
-    REQUIRE(memcmp(dat.data(), frames[i].dat.data(), dat.size()) == 0);
+    REQUIRE(test_data.find(frames[i].len) != test_data.end());
+    const std::string &dat = test_data[frames[i].len];
+    REQUIRE(memcmp(dat.data(), frames[i].dat, dat.size()) == 0);
   }
 }
 
+void PandaTest::benchmark_can_recv() {
+  // one receive worth of packets, as it comes off the bus
+  std::vector<uint8_t> packed;
+  this->pack_can_buffer(can_data_list, [&](uint8_t *data, size_t size) {
+    packed.insert(packed.end(), data, &data[size]);
+  });
+  REQUIRE(packed.size() <= RECV_SIZE);
+
+  std::vector<can_frame> frames;
+  frames.reserve(can_list_size);
+  BENCHMARK("unpack_can_buffer") {
+    frames.clear();
+    uint32_t size = packed.size();
+    this->unpack_can_buffer(packed.data(), size, frames);
+    return frames.size();
+  };
+  BENCHMARK("unpack_can_buffer 64 byte chunks") {
+    frames.clear();
+    this->receive_buffer_size = 0;
+    for (uint32_t pos = 0; pos < packed.size(); pos += USBPACKET_MAX_SIZE) {
+      uint32_t chunk_size = std::min<uint32_t>(USBPACKET_MAX_SIZE, packed.size() - pos);
+      memcpy(&this->receive_buffer[this->receive_buffer_size], &packed[pos], chunk_size);
+      this->receive_buffer_size += chunk_size;
+      this->unpack_can_buffer(this->receive_buffer, this->receive_buffer_size, frames);
+    }
+    return frames.size();
+  };
+  REQUIRE(frames.size() == can_list_size);
+}
+
 TEST_CASE("send/recv CAN 2.0 packets") {
   auto bus_offset = GENERATE(0, 4);
   auto can_list_size = GENERATE(1, 3, 5, 10, 30, 60, 100, 200);
@@ -133,3 +164,9 @@ TEST_CASE("send/recv CAN FD packets") {
     test.test_can_recv(0x40);
   }
 }
+
+TEST_CASE("CAN receive benchmark", "[.][benchmark]") {
+  auto hw_type = GENERATE(cereal::PandaState::PandaType::DOS, cereal::PandaState::PandaType::RED_PANDA);
+  PandaTest test(0, 200, hw_type);
+  test.benchmark_can_recv();
+}
@@ -8,7 +8,7 @@ from pathlib import Path
 from typing import Dict, Optional
 from setproctitle import setproctitle
 from cereal.messaging import PubMaster, SubMaster
-from cereal.visionipc import VisionIpcClient, VisionStreamType, VisionBuf
+from cereal.visionipc import VisionIpcClient, VisionIpcMultiClient, VisionStreamType, VisionBuf
 from openpilot.common.swaglog import cloudlog
 from openpilot.common.params import Params
 from openpilot.common.realtime import DT_MDL
@@ -37,9 +37,9 @@ class FrameMeta:
   timestamp_sof: int = 0
   timestamp_eof: int = 0
 
-  def __init__(self, vipc=None):
+  def __init__(self, vipc=None, idx=0):
     if vipc is not None:
-      self.frame_id, self.timestamp_sof, self.timestamp_eof = vipc.frame_id, vipc.timestamp_sof, vipc.timestamp_eof
+      self.frame_id, self.timestamp_sof, self.timestamp_eof = vipc.frame_id(idx), vipc.timestamp_sof(idx), vipc.timestamp_eof(idx)
 
 class ModelState:
   frame: ModelFrame
@@ -133,18 +133,17 @@ def main():
     time.sleep(.1)
 
   vipc_client_main_stream = VisionStreamType.VISION_STREAM_WIDE_ROAD if main_wide_camera else VisionStreamType.VISION_STREAM_ROAD
-  vipc_client_main = VisionIpcClient("camerad", vipc_client_main_stream, True, cl_context)
-  vipc_client_extra = VisionIpcClient("camerad", VisionStreamType.VISION_STREAM_WIDE_ROAD, False, cl_context)
+  vipc_streams = [vipc_client_main_stream] + ([VisionStreamType.VISION_STREAM_WIDE_ROAD] if use_extra_client else [])
+  # the road and wide frames are delivered together, matched by frame id or within 10ms
+  vipc_client = VisionIpcMultiClient("camerad", vipc_streams, True, 10000000, cl_context)
   cloudlog.warning(f"vision stream set up, main_wide_camera: {main_wide_camera}, use_extra_client: {use_extra_client}")
 
-  while not vipc_client_main.connect(False):
-    time.sleep(0.1)
-  while use_extra_client and not vipc_client_extra.connect(False):
+  while not vipc_client.connect(False):
     time.sleep(0.1)
 
-  cloudlog.warning(f"connected main cam with buffer size: {vipc_client_main.buffer_len} ({vipc_client_main.width} x {vipc_client_main.height})")
+  cloudlog.warning(f"connected main cam with buffer size: {vipc_client.buffer_len(0)} ({vipc_client.width(0)} x {vipc_client.height(0)})")
   if use_extra_client:
-    cloudlog.warning(f"connected extra cam with buffer size: {vipc_client_extra.buffer_len} ({vipc_client_extra.width} x {vipc_client_extra.height})")
+    cloudlog.warning(f"connected extra cam with buffer size: {vipc_client.buffer_len(1)} ({vipc_client.width(1)} x {vipc_client.height(1)})")
 
   # messaging
   pm = PubMaster(["modelV2", "cameraOdometry"])
@@ -165,43 +164,19 @@ def main():
   driving_style = np.array([1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0], dtype=np.float32)
   nav_features = np.zeros(ModelConstants.NAV_FEATURE_LEN, dtype=np.float32)
   nav_instructions = np.zeros(ModelConstants.NAV_INSTRUCTION_LEN, dtype=np.float32)
-  buf_main, buf_extra = None, None
-  meta_main = FrameMeta()
-  meta_extra = FrameMeta()
 
   while True:
-    # Keep receiving frames until we are at least 1 frame ahead of previous extra frame
-    while meta_main.timestamp_sof < meta_extra.timestamp_sof + 25000000:
-      buf_main = vipc_client_main.recv()
-      meta_main = FrameMeta(vipc_client_main)
-      if buf_main is None:
-        break
-
-    if buf_main is None:
-      cloudlog.error("vipc_client_main no frame")
+    bufs = vipc_client.recv()
+    if bufs is None:
+      cloudlog.error("vipc_client no frame")
       continue
 
+    buf_main, meta_main = bufs[0], FrameMeta(vipc_client, 0)
     if use_extra_client:
-      # Keep receiving extra frames until frame id matches main camera
-      while True:
-        buf_extra = vipc_client_extra.recv()
-        meta_extra = FrameMeta(vipc_client_extra)
-        if buf_extra is None or meta_main.timestamp_sof < meta_extra.timestamp_sof + 25000000:
-          break
-
-      if buf_extra is None:
-        cloudlog.error("vipc_client_extra no frame")
-        continue
-
-      if abs(meta_main.timestamp_sof - meta_extra.timestamp_sof) > 10000000:
-        cloudlog.error("frames out of sync! main: {} ({:.5f}), extra: {} ({:.5f})".format(
-          meta_main.frame_id, meta_main.timestamp_sof / 1e9,
-          meta_extra.frame_id, meta_extra.timestamp_sof / 1e9))
-
+      buf_extra, meta_extra = bufs[1], FrameMeta(vipc_client, 1)
     else:
       # Use single camera
-      buf_extra = buf_main
-      meta_extra = meta_main
+      buf_extra, meta_extra = buf_main, meta_main
 
     # TODO: path planner timeout?
     sm.update(0)
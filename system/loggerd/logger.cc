@@ -1,5 +1,7 @@
 #include "system/loggerd/logger.h"
 
+#include <zstd.h>
+
 #include <fstream>
 #include <map>
 #include <vector>
@@ -8,6 +10,88 @@
 #include "common/swaglog.h"
 #include "common/version.h"
 
+const size_t ZSTD_FRAME_SIZE = 1024 * 1024;
+// write() blocks while this many frames wait to be compressed, like a raw write on a slow disk.
+// Bounds the memory, the events that back up meanwhile are dropped by msgq as with any slow reader
+const size_t ZSTD_MAX_QUEUED_FRAMES = 8;
+const int ZSTD_LEVEL = 3;
+const uint32_t ZSTD_SEEK_TABLE_MAGIC = 0x184D2A5E;  // skippable frame, ignored by regular zstd decoders
+const uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+
+// ***** seekable zstd file *****
+ZstdFile::ZstdFile(const std::string &path) : RawFile(path) {
+  frame.reserve(ZSTD_FRAME_SIZE * 2);
+  compress_thread = std::thread(&ZstdFile::compressThread, this);
+}
+
+ZstdFile::~ZstdFile() {
+  {
+    std::lock_guard lk(lock);
+    if (!frame.empty()) full_frames.push_back(std::move(frame));
+    closing = true;
+  }
+  cv.notify_one();
+  compress_thread.join();
+
+  // the seek table: skippable frame header, a size pair per frame and the footer
+  std::vector<uint32_t> table = {ZSTD_SEEK_TABLE_MAGIC, (uint32_t)(seek_table.size() * 8 + 9)};
+  for (auto &[compressed_size, size] : seek_table) {
+    table.push_back(compressed_size);
+    table.push_back(size);
+  }
+  table.push_back(seek_table.size());
+  uint8_t footer[5] = {0};  // descriptor: no checksums
+  memcpy(&footer[1], &ZSTD_SEEKABLE_MAGIC, sizeof(ZSTD_SEEKABLE_MAGIC));
+  RawFile::write(table.data(), table.size() * sizeof(uint32_t));
+  RawFile::write(footer, sizeof(footer));
+}
+
+void ZstdFile::write(void* data, size_t size) {
+  // frames are cut between writes, so every frame starts at an event
+  std::unique_lock lk(lock);
+  frame.append((const char *)data, size);
+  if (frame.size() >= ZSTD_FRAME_SIZE) {
+    space_cv.wait(lk, [this] { return full_frames.size() < ZSTD_MAX_QUEUED_FRAMES; });
+    full_frames.push_back(std::move(frame));
+    frame.clear();
+    if (!free_frames.empty()) {
+      frame = std::move(free_frames.back());
+      free_frames.pop_back();
+    }
+    cv.notify_one();
+  }
+}
+
+void ZstdFile::compressThread() {
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  assert(cctx != nullptr);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+
+  std::string out;
+  while (true) {
+    std::string in;
+    {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [this] { return !full_frames.empty() || closing; });
+      if (full_frames.empty()) break;
+      in = std::move(full_frames.front());
+      full_frames.pop_front();
+    }
+    space_cv.notify_one();
+
+    out.resize(ZSTD_compressBound(in.size()));
+    size_t compressed_size = ZSTD_compress2(cctx, out.data(), out.size(), in.data(), in.size());
+    assert(!ZSTD_isError(compressed_size));
+    RawFile::write(out.data(), compressed_size);
+    seek_table.push_back({(uint32_t)compressed_size, (uint32_t)in.size()});
+
+    in.clear();
+    std::lock_guard lk(lock);
+    free_frames.push_back(std::move(in));
+  }
+  ZSTD_freeCCtx(cctx);
+}
+
 // ***** log metadata *****
 kj::Array<capnp::word> logger_build_init_data() {
   uint64_t wall_time = nanos_since_epoch();
@@ -102,7 +186,7 @@ static void log_sentinel(LoggerState *log, SentinelType type, int eixt_signal =
   log->write(msg.toBytes(), true);
 }
 
-LoggerState::LoggerState(const std::string &log_root) {
+LoggerState::LoggerState(const std::string &log_root, bool zstd) : compress(zstd) {
   route_name = logger_get_route_name();
   route_path = log_root + "/" + route_name;
   init_data = logger_build_init_data();
@@ -111,6 +195,9 @@ LoggerState::LoggerState(const std::string &log_root) {
 LoggerState::~LoggerState() {
   if (rlog) {
     log_sentinel(this, SentinelType::END_OF_ROUTE, exit_signal);
+    // closing a zstd log writes its last frame and seek table, only then is the segment done
+    rlog.reset();
+    qlog.reset();
     std::remove(lock_file.c_str());
   }
 }
@@ -118,6 +205,8 @@ LoggerState::~LoggerState() {
 bool LoggerState::next() {
   if (rlog) {
     log_sentinel(this, SentinelType::END_OF_SEGMENT);
+    rlog.reset();
+    qlog.reset();
     std::remove(lock_file.c_str());
   }
 
@@ -129,8 +218,13 @@ bool LoggerState::next() {
   lock_file = rlog_path + ".lock";
   std::ofstream{lock_file};
 
-  rlog.reset(new RawFile(rlog_path));
-  qlog.reset(new RawFile(segment_path + "/qlog"));
+  if (compress) {
+    rlog.reset(new ZstdFile(rlog_path + ".zst"));
+    qlog.reset(new ZstdFile(segment_path + "/qlog.zst"));
+  } else {
+    rlog.reset(new RawFile(rlog_path));
+    qlog.reset(new RawFile(segment_path + "/qlog"));
+  }
 
   // log init data & sentinel type.
   write(init_data.asBytes(), true);
@@ -1,8 +1,14 @@
 #pragma once
 
 #include <cassert>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "common/util.h"
@@ -14,12 +20,12 @@ class RawFile {
     file = util::safe_fopen(path.c_str(), "wb");
     assert(file != nullptr);
   }
-  ~RawFile() {
+  virtual ~RawFile() {
     util::safe_fflush(file);
     int err = fclose(file);
     assert(err == 0);
   }
-  inline void write(void* data, size_t size) {
+  virtual void write(void* data, size_t size) {
     int written = util::safe_fwrite(data, 1, size, file);
     assert(written == size);
   }
@@ -29,12 +35,38 @@ class RawFile {
   FILE* file = nullptr;
 };
 
+// Writes a log in the zstd seekable format: independent frames of about 1MB that
+// each start at an event, followed by a seek table listing their sizes, so readers
+// can decompress the frames in parallel. Frames are compressed on a separate thread,
+// write() only copies the data into the current frame.
+class ZstdFile : public RawFile {
+ public:
+  ZstdFile(const std::string &path);
+  ~ZstdFile();
+  void write(void* data, size_t size) override;
+  using RawFile::write;
+
+ private:
+  void compressThread();
+
+  std::mutex lock;
+  std::condition_variable cv;  // a full frame or closing, for the compress thread
+  std::condition_variable space_cv;  // a frame was taken off full_frames, for write()
+  std::string frame;  // filled by write()
+  std::deque<std::string> full_frames;  // waiting for the compress thread, at most ZSTD_MAX_QUEUED_FRAMES
+  std::vector<std::string> free_frames;  // compressed, reused to avoid allocations in write()
+  bool closing = false;
+  std::vector<std::pair<uint32_t, uint32_t>> seek_table;  // compressed and decompressed size of each frame
+  std::thread compress_thread;
+};
+
 typedef cereal::Sentinel::SentinelType SentinelType;
 
 
 class LoggerState {
 public:
-  LoggerState(const std::string& log_root = Path::log_root());
+  // With zstd, the rlog and qlog are written as seekable zstd (rlog.zst, qlog.zst).
+  LoggerState(const std::string& log_root = Path::log_root(), bool zstd = false);
   ~LoggerState();
   bool next();
   void write(uint8_t* data, size_t size, bool in_qlog);
@@ -46,6 +78,7 @@ public:
 
 protected:
   int part = -1, exit_signal = 0;
+  const bool compress;
   std::string route_path, route_name, segment_path, lock_file;
   kj::Array<capnp::word> init_data;
   std::unique_ptr<RawFile> rlog, qlog;
@@ -13,7 +13,7 @@
 ExitHandler do_exit;
 
 struct LoggerdState {
-  LoggerState logger;
+  LoggerState logger{Path::log_root(), LOGGERD_ZSTD};
   std::atomic<double> last_camera_seen_tms;
   std::atomic<int> ready_to_rotate;  // count of encoders ready to rotate
   int max_waiting = 0;
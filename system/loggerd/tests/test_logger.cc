@@ -1,18 +1,26 @@
+#include <zstd.h>
+
 #include "catch2/catch.hpp"
 #include "system/loggerd/logger.h"
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
-void verify_segment(const std::string &route_path, int segment, int max_segment, int required_event_cnt) {
+void verify_segment(const std::string &route_path, int segment, int max_segment, int required_event_cnt, bool zstd) {
   const std::string segment_path = route_path + "--" + std::to_string(segment);
   SentinelType begin_sentinel = segment == 0 ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT;
   SentinelType end_sentinel = segment == max_segment - 1 ? SentinelType::END_OF_ROUTE : SentinelType::END_OF_SEGMENT;
 
   REQUIRE(!util::file_exists(segment_path + "/rlog.lock"));
   for (const char *fn : {"/rlog", "/qlog"}) {
-    const std::string log_file = segment_path + fn;
+    const std::string log_file = segment_path + fn + (zstd ? ".zst" : "");
     std::string log = util::read_file(log_file);
     REQUIRE(!log.empty());
+    if (zstd) {
+      // the frames add up to the log, the seek table is a skippable frame
+      std::string decompressed(ZSTD_findDecompressedSize(log.data(), log.size()), '\0');
+      REQUIRE(ZSTD_decompress(decompressed.data(), decompressed.size(), log.data(), log.size()) == decompressed.size());
+      log = decompressed;
+    }
     int event_cnt = 0, i = 0;
     kj::ArrayPtr<const capnp::word> words((capnp::word *)log.data(), log.size() / sizeof(capnp::word));
     while (words.size() > 0) {
@@ -54,11 +62,12 @@ void write_msg(LoggerState *logger) {
 
 TEST_CASE("logger") {
   const int segment_cnt = 100;
+  const bool zstd = GENERATE(false, true);
   const std::string log_root = "/tmp/test_logger";
   system(("rm " + log_root + " -rf").c_str());
   std::string route_name;
   {
-    LoggerState logger(log_root);
+    LoggerState logger(log_root, zstd);
     route_name = logger.routeName();
     for (int i = 0; i < segment_cnt; ++i) {
       REQUIRE(logger.next());
@@ -69,6 +78,6 @@ TEST_CASE("logger") {
     logger.setExitSignal(1);
   }
   for (int i = 0; i < segment_cnt; ++i) {
-    verify_segment(log_root + "/" + route_name, i, segment_cnt, 1);
+    verify_segment(log_root + "/" + route_name, i, segment_cnt, 1, zstd);
   }
 }
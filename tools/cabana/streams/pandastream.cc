@@ -91,7 +91,7 @@ void PandaStream::streamThread() {
     for (uint i = 0; i<raw_can_data.size(); i++) {
       canData[i].setAddress(raw_can_data[i].address);
       canData[i].setBusTime(raw_can_data[i].busTime);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
+      canData[i].setDat(kj::arrayPtr(raw_can_data[i].dat, raw_can_data[i].len));
       canData[i].setSrc(raw_can_data[i].src);
     }
 
@@ -2,6 +2,8 @@
 import os
 import sys
 import bz2
+import ctypes
+import ctypes.util
 import urllib.parse
 import capnp
 import warnings
@@ -14,6 +16,35 @@ from openpilot.tools.lib.route import Route, SegmentName
 
 LogIterable = Iterable[capnp._DynamicStructReader]
 
+ZSTD_MAGIC = b'\x28\xb5\x2f\xfd'
+_libzstd = None
+
+def zstd_decompress(dat):
+  # loggerd's seekable zstd logs are plain zstd frames followed by a skippable seek table frame,
+  # every frame has its content size so a single ZSTD_decompress call gets the whole log
+  global _libzstd
+  if _libzstd is None:
+    lib = ctypes.util.find_library('zstd')
+    if lib is None:
+      raise Exception("libzstd is needed to read .zst logs")
+    _libzstd = ctypes.CDLL(lib)
+    _libzstd.ZSTD_decompressBound.restype = ctypes.c_ulonglong
+    _libzstd.ZSTD_decompressBound.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+    _libzstd.ZSTD_decompress.restype = ctypes.c_size_t
+    _libzstd.ZSTD_decompress.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_size_t]
+    _libzstd.ZSTD_isError.argtypes = [ctypes.c_size_t]
+    _libzstd.ZSTD_getErrorName.restype = ctypes.c_char_p
+    _libzstd.ZSTD_getErrorName.argtypes = [ctypes.c_size_t]
+
+  bound = _libzstd.ZSTD_decompressBound(dat, len(dat))
+  if bound >= 2**63:  # ZSTD_CONTENTSIZE_ERROR, or a frame without its content size
+    raise Exception("invalid zstd log")
+  out = ctypes.create_string_buffer(max(bound, 1))
+  n = _libzstd.ZSTD_decompress(out, bound, dat, len(dat))
+  if _libzstd.ZSTD_isError(n):
+    raise Exception(f"invalid zstd log: {_libzstd.ZSTD_getErrorName(n).decode()}")
+  return out.raw[:n]
+
 # this is an iterator itself, and uses private variables from LogReader
 class MultiLogIterator:
   def __init__(self, log_paths, sort_by_time=False):
@@ -84,7 +115,7 @@ class LogReader:
     ext = None
     if not dat:
       _, ext = os.path.splitext(urllib.parse.urlparse(fn).path)
-      if ext not in ('', '.bz2'):
+      if ext not in ('', '.bz2', '.zst'):
         # old rlogs weren't bz2 compressed
         raise Exception(f"unknown extension {ext}")
 
@@ -93,6 +124,8 @@ class LogReader:
 
     if ext == ".bz2" or dat.startswith(b'BZh9'):
       dat = bz2.decompress(dat)
+    elif ext == ".zst" or dat.startswith(ZSTD_MAGIC):
+      dat = zstd_decompress(dat)
 
     ents = capnp_log.Event.read_multiple_bytes(dat)
 
@@ -1,8 +1,10 @@
 #include "tools/replay/camera.h"
 
+#include <algorithm>
 #include <cassert>
 #include <tuple>
 
+#include "common/timing.h"
 #include "third_party/linux/include/msm_media_info.h"
 #include "tools/replay/util.h"
 
@@ -57,7 +59,7 @@ void CameraServer::cameraThread(Camera &cam) {
   };
 
   while (true) {
-    const auto [fr, eidx] = cam.queue.pop();
+    const auto [fr, eidx, push_ts] = cam.queue.pop();
     if (!fr) break;
 
     const int id = eidx.getSegmentId();
@@ -74,12 +76,21 @@ void CameraServer::cameraThread(Camera &cam) {
     } else {
       rError("camera[%d] failed to get frame: %lu", cam.type, eidx.getSegmentId());
     }
+    const uint64_t latency_ns = nanos_since_boot() - push_ts;
 
     cam.cached_id = id + 1;
     cam.cached_seg = eidx.getSegmentNum();
     cam.cached_buf = read_frame(fr, cam.cached_id);
 
-    --publishing_;
+    {
+      std::lock_guard lk(publish_lock_);
+      --cam.queued;
+      --publishing_;
+      ++stats_.frames;
+      latency_sum_ns_ += latency_ns;
+      stats_.max_latency_ms = std::max(stats_.max_latency_ms, latency_ns / 1e6);
+    }
+    publish_cv_.notify_all();
   }
 }
 
@@ -92,12 +103,26 @@ void CameraServer::pushFrame(CameraType type, FrameReader *fr, const cereal::Enc
     startVipcServer();
   }
 
-  ++publishing_;
-  cam.queue.push({fr, eidx});
+  {
+    // bounded, the stream waits for the camera instead of queueing up frames
+    std::unique_lock lk(publish_lock_);
+    publish_cv_.wait(lk, [&]() { return cam.queued < MAX_QUEUED_FRAMES; });
+    ++cam.queued;
+    ++publishing_;
+  }
+  cam.queue.push({fr, eidx, nanos_since_boot()});
 }
 
 void CameraServer::waitForSent() {
-  while (publishing_ > 0) {
-    std::this_thread::yield();
-  }
+  std::unique_lock lk(publish_lock_);
+  publish_cv_.wait(lk, [this]() { return publishing_ == 0; });
+}
+
+CameraServer::Stats CameraServer::takeStats() {
+  std::lock_guard lk(publish_lock_);
+  Stats stats = stats_;
+  stats.latency_ms = stats.frames > 0 ? latency_sum_ns_ / 1e6 / stats.frames : 0;
+  stats_ = {};
+  latency_sum_ns_ = 0;
+  return stats;
 }
@@ -2,7 +2,9 @@
 
 #include <unistd.h>
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <tuple>
 #include <utility>
 
@@ -13,6 +15,9 @@
 
 std::tuple<size_t, size_t, size_t> get_nv12_info(int width, int height);
 
+// frames pushed to a camera that weren't sent yet, pushFrame blocks beyond it
+const int MAX_QUEUED_FRAMES = 2;
+
 class CameraServer {
 public:
   CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS] = nullptr);
@@ -20,6 +25,14 @@ public:
   void pushFrame(CameraType type, FrameReader* fr, const cereal::EncodeIndex::Reader& eidx);
   void waitForSent();
 
+  struct Stats {
+    uint64_t frames = 0;
+    double latency_ms = 0;  // from pushFrame to sent, average
+    double max_latency_ms = 0;
+  };
+  // the frames sent since the last call
+  Stats takeStats();
+
 protected:
   struct Camera {
     CameraType type;
@@ -27,7 +40,8 @@ protected:
     int width;
     int height;
     std::thread thread;
-    SafeQueue<std::pair<FrameReader*, const cereal::EncodeIndex::Reader>> queue;
+    SafeQueue<std::tuple<FrameReader*, const cereal::EncodeIndex::Reader, uint64_t>> queue;
+    int queued = 0;  // guarded by publish_lock_
     int cached_id = -1;
     int cached_seg = -1;
     VisionBuf * cached_buf;
@@ -40,6 +54,10 @@ protected:
       {.type = DriverCam, .stream_type = VISION_STREAM_DRIVER},
       {.type = WideRoadCam, .stream_type = VISION_STREAM_WIDE_ROAD},
   };
-  std::atomic<int> publishing_ = 0;
+  std::mutex publish_lock_;
+  std::condition_variable publish_cv_;
+  int publishing_ = 0;
+  Stats stats_;
+  uint64_t latency_sum_ns_ = 0;
   std::unique_ptr<VisionIpcServer> vipc_server_;
 };
@@ -1,5 +1,7 @@
 #include "tools/replay/consoleui.h"
 
+#include <sys/resource.h>
+
 #include <initializer_list>
 #include <string>
 #include <tuple>
@@ -7,6 +9,7 @@
 
 #include <QApplication>
 
+#include "common/timing.h"
 #include "common/version.h"
 
 namespace {
@@ -110,7 +113,7 @@ void ConsoleUI::initWindows() {
   w[Win::Stats] = newwin(2, max_width - 2 * BORDER_SIZE, 2, BORDER_SIZE);
   w[Win::Timeline] = newwin(4, max_width - 2 * BORDER_SIZE, 5, BORDER_SIZE);
   w[Win::TimelineDesc] = newwin(1, 100, 10, BORDER_SIZE);
-  w[Win::CarState] = newwin(3, 100, 12, BORDER_SIZE);
+  w[Win::CarState] = newwin(4, 100, 12, BORDER_SIZE);
   w[Win::DownloadBar] = newwin(1, 100, 16, BORDER_SIZE);
   if (int log_height = max_height - 27; log_height > 4) {
     w[Win::LogBorder] = newwin(log_height, max_width - 2 * (BORDER_SIZE - 1), 17, BORDER_SIZE - 1);
@@ -186,6 +189,21 @@ void ConsoleUI::updateStatus() {
   auto angle_offsets = util::string_format("%.2f|%.2f", p.getAngleOffsetAverageDeg(), p.getAngleOffsetDeg());
   write_item(2, 25, "ANGLE OFFSET(AVG|INSTANT): ", angle_offsets, " deg");
 
+  if (double ts = millis_since_boot(); ts - usage_ts >= 1000) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+                          (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+    frame_stats = replay->takeFrameStats();
+    cpu_usage = usage_ts > 0 ? (cpu_ms - usage_cpu_ms) / (ts - usage_ts) * 100 : 0;
+    frame_rate = usage_ts > 0 ? frame_stats.frames * 1000.0 / (ts - usage_ts) : 0;
+    usage_ts = ts;
+    usage_cpu_ms = cpu_ms;
+  }
+  write_item(3, 0, "CPU: ", util::string_format("%.0f", cpu_usage), " %     ");
+  auto latency = util::string_format("%.1f|%.1f", frame_stats.latency_ms, frame_stats.max_latency_ms);
+  write_item(3, 25, "FRAME LATENCY(AVG|MAX): ", latency, util::string_format(" ms, %.0f fps  ", frame_rate));
+
   wrefresh(w[Win::CarState]);
 }
 
@@ -38,6 +38,10 @@ private:
   QSocketNotifier notifier{0, QSocketNotifier::Read, this};
   int max_width, max_height;
   Status status = Status::Waiting;
+  // cpu usage and frame latency, updated every second
+  double usage_ts = 0, usage_cpu_ms = 0;
+  double cpu_usage = 0, frame_rate = 0;
+  CameraServer::Stats frame_stats;
 
 signals:
   void updateProgressBarSignal(uint64_t cur, uint64_t total, bool success);
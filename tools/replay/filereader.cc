@@ -1,38 +1,115 @@
 #include "tools/replay/filereader.h"
 
-#include <fstream>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <tuple>
+#include <vector>
 
 #include "common/util.h"
 #include "system/hardware/hw.h"
 #include "tools/replay/util.h"
 
-std::string cacheFilePath(const std::string &url) {
+namespace {
+
+const std::string &cache_dir() {
   static std::string cache_path = [] {
     const std::string comma_cache = Path::download_cache_root();
     util::create_directories(comma_cache, 0755);
     return comma_cache.back() == '/' ? comma_cache : comma_cache + "/";
   }();
+  return cache_path;
+}
 
-  return cache_path + sha256(getUrlWithoutQuery(url));
+bool ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// The downloader holds the lock of its partial file, one that can be locked was abandoned.
+void removeAbandonedPartial(const std::string &part_file) {
+  int fd = open(part_file.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) return;
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+    const std::string local_file = part_file.substr(0, part_file.size() - strlen(".part"));
+    unlink(part_file.c_str());
+    unlink((local_file + ".ranges").c_str());
+  }
+  close(fd);
+}
+
+}  // namespace
+
+std::string cacheFilePath(const std::string &url) {
+  return cache_dir() + sha256(getUrlWithoutQuery(url));
+}
+
+void evictCacheFiles(const std::string &dir, size_t limit) {
+  // the modification time is the last use, downloads in progress are left alone
+  std::vector<std::tuple<std::filesystem::file_time_type, size_t, std::filesystem::path>> files;
+  size_t total = 0;
+  std::error_code ec;
+  const auto partial_expiry = std::filesystem::file_time_type::clock::now() - std::chrono::seconds(CACHE_PARTIAL_MAX_AGE);
+  for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+    const std::string name = entry.path().filename();
+    if (!entry.is_regular_file(ec)) continue;
+
+    if (ends_with(name, ".part")) {
+      // the partial file is written as the download goes, its ranges file goes with it
+      if (entry.last_write_time(ec) < partial_expiry) {
+        removeAbandonedPartial(entry.path());
+      }
+      continue;
+    }
+    if (ends_with(name, ".ranges") || name.find(".tmp") != std::string::npos) continue;
+
+    const size_t size = entry.file_size(ec);
+    files.push_back({entry.last_write_time(ec), size, entry.path()});
+    total += size;
+  }
+
+  std::sort(files.begin(), files.end());
+  for (auto it = files.begin(); it != files.end() && total > limit; ++it) {
+    if (std::filesystem::remove(std::get<2>(*it), ec)) {
+      total -= std::get<1>(*it);
+    }
+  }
 }
 
 std::string FileReader::read(const std::string &file, std::atomic<bool> *abort) {
-  const bool is_remote = file.find("https://") == 0;
-  const std::string local_file = is_remote ? cacheFilePath(file) : file;
+  const bool is_remote = isRemoteUrl(file);
   std::string result;
 
-  if ((!is_remote || cache_to_local_) && util::file_exists(local_file)) {
-    result = util::read_file(local_file);
-  } else if (is_remote) {
-    result = download(file, abort);
-    if (cache_to_local_ && !result.empty()) {
-      std::ofstream fs(local_file, std::ios::binary | std::ios::out);
-      fs.write(result.data(), result.size());
+  if (!is_remote || cache_to_local_) {
+    if (std::string local_file = localFile(file, abort); !local_file.empty()) {
+      result = util::read_file(local_file);
     }
+  } else {
+    result = download(file, abort);
   }
   return result;
 }
 
+std::string FileReader::localFile(const std::string &file, std::atomic<bool> *abort) {
+  if (!isRemoteUrl(file)) {
+    return util::file_exists(file) ? file : "";
+  }
+
+  const std::string local_file = cacheFilePath(file);
+  if (!util::file_exists(local_file) && !(cache_to_local_ && downloadToCache(file, local_file, abort))) {
+    return "";
+  }
+  utimes(local_file.c_str(), nullptr);  // used now, for the LRU eviction
+  return local_file;
+}
+
 std::string FileReader::download(const std::string &url, std::atomic<bool> *abort) {
   for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
     if (i > 0) rWarning("download failed, retrying %d", i);
@@ -44,3 +121,95 @@ std::string FileReader::download(const std::string &url, std::atomic<bool> *abor
   }
   return {};
 }
+
+bool FileReader::downloadToCache(const std::string &url, const std::string &local_file, std::atomic<bool> *abort) {
+  // the partial file is locked, readers of the same url wait for one download instead of starting another
+  const std::string part_file = local_file + ".part";
+  const std::string ranges_file = local_file + ".ranges";
+  int fd = -1;
+  while (true) {
+    fd = open(part_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    flock(fd, LOCK_EX);
+    // the partial file may have been evicted or renamed into place while we waited for the lock
+    struct stat fd_st, path_st;
+    if (fstat(fd, &fd_st) == 0 && stat(part_file.c_str(), &path_st) == 0 && fd_st.st_ino == path_st.st_ino) break;
+    close(fd);
+  }
+
+  bool ret = util::file_exists(local_file);
+  if (ret) {
+    // downloaded while waiting for the lock
+    unlink(part_file.c_str());
+  }
+  for (int i = 0; i <= max_retries_ && !ret && !(abort && *abort); ++i) {
+    if (i > 0) rWarning("download failed, retrying %d", i);
+    ret = resumeDownload(url, fd, ranges_file, abort) && rename(part_file.c_str(), local_file.c_str()) == 0;
+  }
+  if (ret) {
+    unlink(ranges_file.c_str());
+  }
+  close(fd);
+
+  if (ret) {
+    evictCacheFiles(cache_dir(), cache_limit);
+  }
+  return ret && util::file_exists(local_file);
+}
+
+// The ranges file has the size of the file and of its ranges, then a byte per range
+// that is set once the range is in the partial file.
+bool FileReader::resumeDownload(const std::string &url, int fd, const std::string &ranges_file, std::atomic<bool> *abort) {
+  const size_t size = getRemoteFileSize(url, abort);
+  if (size == 0) return false;
+
+  int ranges_fd = open(ranges_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (ranges_fd < 0) return false;
+
+  const uint64_t header[2] = {size, CACHE_RANGE_SIZE};
+  const size_t num_ranges = (size + CACHE_RANGE_SIZE - 1) / CACHE_RANGE_SIZE;
+  uint64_t saved_header[2] = {};
+  std::vector<uint8_t> done(num_ranges, 0);
+  if (pread(ranges_fd, saved_header, sizeof(saved_header), 0) != sizeof(saved_header) ||
+      memcmp(header, saved_header, sizeof(header)) != 0 ||
+      pread(ranges_fd, done.data(), num_ranges, sizeof(header)) != (ssize_t)num_ranges) {
+    // a new download, or the remote file changed
+    std::fill(done.begin(), done.end(), 0);
+    if (ftruncate(ranges_fd, 0) != 0 || pwrite(ranges_fd, header, sizeof(header), 0) != sizeof(header) ||
+        pwrite(ranges_fd, done.data(), num_ranges, sizeof(header)) != (ssize_t)num_ranges) {
+      close(ranges_fd);
+      return false;
+    }
+  }
+
+  std::vector<std::pair<size_t, size_t>> ranges;
+  std::vector<size_t> range_ids;
+  size_t remaining = 0;
+  for (size_t i = 0; i < num_ranges; ++i) {
+    if (!done[i]) {
+      ranges.push_back({i * CACHE_RANGE_SIZE, std::min((i + 1) * CACHE_RANGE_SIZE, size)});
+      range_ids.push_back(i);
+      remaining += ranges.back().second - ranges.back().first;
+    }
+  }
+  if (ranges.size() < num_ranges) {
+    rInfo("resuming download of %s, %s of %s left", url.c_str(), formattedDataSize(remaining).c_str(), formattedDataSize(size).c_str());
+  }
+
+  // written in place through a shared mapping. a range is marked done after its data is in
+  // the page cache, so it survives the process being killed.
+  void *mem = ftruncate(fd, size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  if (mem == MAP_FAILED) {
+    close(ranges_fd);
+    return false;
+  }
+  bool ret = httpDownloadRanges(url, (char *)mem, ranges, [&](size_t i) {
+    const uint8_t range_done = 1;
+    if (pwrite(ranges_fd, &range_done, 1, sizeof(header) + range_ids[i]) != 1) {
+      rWarning("failed to write %s", ranges_file.c_str());
+    }
+  }, abort);
+  munmap(mem, size);
+  close(ranges_fd);
+  return ret;
+}
@@ -3,18 +3,35 @@
 #include <atomic>
 #include <string>
 
+// downloaded files are evicted least recently used first beyond this
+const size_t DEFAULT_CACHE_LIMIT = 20ULL * 1024 * 1024 * 1024;
+// the unit of resuming a cache download
+const size_t CACHE_RANGE_SIZE = 4 * 1024 * 1024;
+// partial downloads untouched for this many seconds were abandoned, the eviction removes them
+const int CACHE_PARTIAL_MAX_AGE = 24 * 60 * 60;
+
 class FileReader {
 public:
   FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3)
       : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
   virtual ~FileReader() {}
   std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // The path of a local file, or of a remote one in the cache, downloaded first if it isn't
+  // there. Empty if it doesn't exist or the download failed.
+  std::string localFile(const std::string &file, std::atomic<bool> *abort = nullptr);
+  static void setCacheLimit(size_t bytes) { cache_limit = bytes; }
 
 private:
   std::string download(const std::string &url, std::atomic<bool> *abort);
+  bool downloadToCache(const std::string &url, const std::string &local_file, std::atomic<bool> *abort);
+  bool resumeDownload(const std::string &url, int fd, const std::string &ranges_file, std::atomic<bool> *abort);
   size_t chunk_size_;
   int max_retries_;
   bool cache_to_local_;
+  inline static std::atomic<size_t> cache_limit = DEFAULT_CACHE_LIMIT;
 };
 
 std::string cacheFilePath(const std::string &url);
+// Removes the least recently used files of dir until they add up to at most limit bytes,
+// and the partial downloads older than CACHE_PARTIAL_MAX_AGE that nobody is downloading.
+void evictCacheFiles(const std::string &dir, size_t limit);
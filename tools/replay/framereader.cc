@@ -3,6 +3,14 @@
 
 #include <cassert>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <thread>
+#include <utility>
+
 #include "third_party/libyuv/include/libyuv.h"
 
 #ifdef __APPLE__
@@ -43,13 +51,146 @@ enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *
   return AV_PIX_FMT_YUV420P;
 }
 
+// Decoded NV12 frames keyed by (reader, frame), each reader is one segment's video.
+class FrameCache {
+public:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Frame;
+
+  Frame get(uint64_t reader, int idx) {
+    std::lock_guard lk(lock);
+    auto it = index.find({reader, idx});
+    if (it == index.end()) return nullptr;
+    frames.splice(frames.begin(), frames, it->second);
+    return it->second->second;
+  }
+
+  void put(uint64_t reader, int idx, Frame frame) {
+    std::lock_guard lk(lock);
+    auto it = index.find({reader, idx});
+    if (it != index.end()) {
+      size -= it->second->second->size();
+      frames.erase(it->second);
+    }
+    size += frame->size();
+    frames.push_front({{reader, idx}, std::move(frame)});
+    index[{reader, idx}] = frames.begin();
+    evict();
+  }
+
+  void erase(uint64_t reader) {
+    std::lock_guard lk(lock);
+    for (auto it = index.lower_bound({reader, 0}); it != index.end() && it->first.first == reader;) {
+      size -= it->second->second->size();
+      frames.erase(it->second);
+      it = index.erase(it);
+    }
+  }
+
+  void setMaxSize(size_t bytes) {
+    std::lock_guard lk(lock);
+    max_size = bytes;
+    evict();
+  }
+
+  size_t maxSize() {
+    std::lock_guard lk(lock);
+    return max_size;
+  }
+
+private:
+  void evict() {
+    while (size > max_size && !frames.empty()) {
+      size -= frames.back().second->size();
+      index.erase(frames.back().first);
+      frames.pop_back();
+    }
+  }
+
+  std::mutex lock;
+  std::list<std::pair<std::pair<uint64_t, int>, Frame>> frames;  // most recently used first
+  std::map<std::pair<uint64_t, int>, decltype(frames)::iterator> index;
+  size_t size = 0;
+  size_t max_size = DEFAULT_FRAME_CACHE_SIZE;
+};
+
+FrameCache frame_cache;
+
+// Worker threads for the look-ahead decoding of all readers.
+class DecodePool {
+public:
+  DecodePool(int num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([this]() {
+        while (true) {
+          std::packaged_task<void()> task;
+          {
+            std::unique_lock lk(lock);
+            cv.wait(lk, [this]() { return stop || !tasks.empty(); });
+            if (tasks.empty()) break;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  ~DecodePool() {
+    {
+      std::lock_guard lk(lock);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  std::future<void> push(std::function<void()> &&f) {
+    std::packaged_task<void()> task(std::move(f));
+    auto future = task.get_future();
+    {
+      std::lock_guard lk(lock);
+      tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+    return future;
+  }
+
+private:
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::packaged_task<void()>> tasks;
+  std::vector<std::thread> threads;
+  bool stop = false;
+};
+
+DecodePool &decode_pool() {
+  static DecodePool pool(std::max(2u, std::thread::hardware_concurrency() / 2));
+  return pool;
+}
+
+void copy_nv12(const uint8_t *src, int width, int height, VisionBuf *buf) {
+  libyuv::CopyPlane(src, width, buf->y, buf->stride, width, height);
+  libyuv::CopyPlane(src + width * height, width, buf->uv, buf->stride, width, height / 2);
+}
+
+std::atomic<uint64_t> next_reader_id = 0;
+
 }  // namespace
 
-FrameReader::FrameReader() {
+FrameReader::FrameReader() : id_(next_reader_id++) {
   av_log_set_level(AV_LOG_QUIET);
 }
 
 FrameReader::~FrameReader() {
+  exit_ = true;
+  if (lookahead_.valid()) {
+    lookahead_.wait();
+  }
+  frame_cache.erase(id_);
+
   for (AVPacket *pkt : packets) {
     av_packet_free(&pkt);
   }
@@ -123,6 +264,10 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_hw_decoder, s
       rWarning("No device with hardware decoder found. fallback to CPU decoding.");
     }
   }
+  if (hw_pix_fmt == AV_PIX_FMT_NONE) {
+    decoder_ctx->thread_count = decoder_threads;
+    decoder_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
 
   ret = avcodec_open2(decoder_ctx, decoder, nullptr);
   if (ret < 0) {
@@ -139,14 +284,22 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_hw_decoder, s
       valid_ = (ret == AVERROR_EOF);
       break;
     }
+    // frames are matched to their packet by pts, they may come out of a threaded decoder later
+    pkt->pts = packets.size();
     packets.push_back(pkt);
     // some stream seems to contain no keyframes
     key_frames_count_ += pkt->flags & AV_PKT_FLAG_KEY;
   }
   valid_ = valid_ && !packets.empty();
+  av_frame_.reset(av_frame_alloc());
+  hw_frame.reset(av_frame_alloc());
   return valid_;
 }
 
+void FrameReader::setCacheSize(size_t bytes) {
+  frame_cache.setMaxSize(bytes);
+}
+
 bool FrameReader::initHardwareDecoder(AVHWDeviceType hw_device_type) {
   for (int i = 0;; i++) {
     const AVCodecHWConfig *config = avcodec_get_hw_config(decoder_ctx->codec, i);
@@ -180,72 +333,125 @@ bool FrameReader::get(int idx, VisionBuf *buf) {
   if (!valid_ || idx < 0 || idx >= packets.size()) {
     return false;
   }
-  return decode(idx, buf);
-}
 
-bool FrameReader::decode(int idx, VisionBuf *buf) {
-  int from_idx = idx;
-  if (idx != prev_idx + 1 && key_frames_count_ > 1) {
-    // seeking to the nearest key frame
-    for (int i = idx; i >= 0; --i) {
-      if (packets[i]->flags & AV_PKT_FLAG_KEY) {
-        from_idx = i;
-        break;
-      }
-    }
+  bool ret = false;
+  if (auto frame = frame_cache.get(id_, idx)) {
+    copy_nv12(frame->data(), width, height, buf);
+    ret = true;
+  } else {
+    ret = decode(idx, buf);
   }
-  prev_idx = idx;
 
-  for (int i = from_idx; i <= idx; ++i) {
-    AVFrame *f = decodeFrame(packets[i]);
-    if (f && i == idx) {
-      return copyBuffers(f, buf);
+  // a cache smaller than a frame would evict everything the look-ahead decodes
+  if (ret && lookahead_frames > 0 && frame_cache.maxSize() >= (size_t)getYUVSize()) {
+    lookahead_to_ = std::min<int>(idx + lookahead_frames, packets.size() - 1);
+    if (!lookahead_.valid() || lookahead_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      lookahead_ = decode_pool().push([this]() { lookahead(); });
     }
   }
-  return false;
+  return ret;
 }
 
-AVFrame *FrameReader::decodeFrame(AVPacket *pkt) {
-  int ret = avcodec_send_packet(decoder_ctx, pkt);
-  if (ret < 0) {
-    rError("Error sending a packet for decoding: %d", ret);
-    return nullptr;
+bool FrameReader::decode(int idx, VisionBuf *buf) {
+  std::lock_guard lk(decode_lock_);
+  // the look-ahead may have decoded it while waiting for the lock
+  if (auto frame = frame_cache.get(id_, idx)) {
+    copy_nv12(frame->data(), width, height, buf);
+    return true;
   }
+  return decodeTo(idx, buf);
+}
 
-  av_frame_.reset(av_frame_alloc());
-  ret = avcodec_receive_frame(decoder_ctx, av_frame_.get());
-  if (ret != 0) {
-    rError("avcodec_receive_frame error: %d", ret);
-    return nullptr;
+void FrameReader::lookahead() {
+  while (!exit_) {
+    std::lock_guard lk(decode_lock_);
+    const int target = lookahead_to_;
+    if (target < 0 || frame_cache.get(id_, target)) break;
+
+    // one frame at a time, so get() isn't kept waiting for the lock
+    const int idx = next_frame_ <= target ? next_frame_ : target;
+    if (!decodeTo(idx, nullptr)) break;
+    // done even if the cache already evicted the target, unless get() asked for more meanwhile
+    if (idx == target && lookahead_to_ == target) break;
+  }
+}
+
+// Decodes up to frame idx, caching every frame on the way. Continues from the decoder's
+// position if idx is ahead in the same GOP, otherwise starts over at the key frame.
+bool FrameReader::decodeTo(int idx, VisionBuf *buf) {
+  int key_idx = idx;
+  if (key_frames_count_ > 1) {
+    while (key_idx > 0 && !(packets[key_idx]->flags & AV_PKT_FLAG_KEY)) --key_idx;
+  }
+  if (idx < next_frame_ || key_idx > next_frame_) {
+    avcodec_flush_buffers(decoder_ctx);
+    next_packet_ = next_frame_ = key_idx;
   }
 
-  if (av_frame_->format == hw_pix_fmt) {
-    hw_frame.reset(av_frame_alloc());
-    if ((ret = av_hwframe_transfer_data(hw_frame.get(), av_frame_.get(), 0)) < 0) {
-      rError("error transferring the data from GPU to CPU");
-      return nullptr;
+  const bool cache_frames = frame_cache.maxSize() >= (size_t)getYUVSize();
+  bool found = false;
+  while (next_frame_ <= idx) {
+    int ret = avcodec_receive_frame(decoder_ctx, av_frame_.get());
+    if (ret == AVERROR(EAGAIN)) {
+      // nullptr drains the decoder at the end of the stream
+      AVPacket *pkt = next_packet_ < packets.size() ? packets[next_packet_++] : nullptr;
+      ret = avcodec_send_packet(decoder_ctx, pkt);
+      if (ret < 0 && pkt) {
+        rError("Error sending a packet for decoding: %d", ret);
+      } else if (ret < 0) {
+        break;
+      }
+      continue;
+    } else if (ret != 0) {
+      if (ret != AVERROR_EOF) {
+        rError("avcodec_receive_frame error: %d", ret);
+      }
+      break;
+    }
+
+    AVFrame *f = av_frame_.get();
+    if (av_frame_->format == hw_pix_fmt) {
+      av_frame_unref(hw_frame.get());
+      if ((ret = av_hwframe_transfer_data(hw_frame.get(), av_frame_.get(), 0)) < 0) {
+        rError("error transferring the data from GPU to CPU");
+        break;
+      }
+      f = hw_frame.get();
+    }
+
+    const int frame_idx = av_frame_->pts != AV_NOPTS_VALUE ? av_frame_->pts : next_frame_;
+    next_frame_ = frame_idx + 1;
+    found = found || frame_idx == idx;
+    if (!cache_frames && !(frame_idx == idx && buf)) continue;
+
+    auto frame = std::make_shared<std::vector<uint8_t>>(getYUVSize());
+    toNV12(f, frame->data(), frame->data() + width * height, width);
+    if (frame_idx == idx && buf) {
+      copy_nv12(frame->data(), width, height, buf);
+    }
+    if (cache_frames) {
+      frame_cache.put(id_, frame_idx, std::move(frame));
     }
-    return hw_frame.get();
-  } else {
-    return av_frame_.get();
   }
+
+  if (!found && next_frame_ <= idx) {
+    // the decoder is in an unknown state, start over next time
+    next_packet_ = next_frame_ = packets.size();
+  }
+  return found;
 }
 
-bool FrameReader::copyBuffers(AVFrame *f, VisionBuf *buf) {
-  assert(f != nullptr && buf != nullptr);
+void FrameReader::toNV12(AVFrame *f, uint8_t *y, uint8_t *uv, int stride) {
+  assert(f != nullptr);
   if (hw_pix_fmt == HW_PIX_FMT) {
-    for (int i = 0; i < height/2; i++) {
-      memcpy(buf->y + (i*2 + 0)*buf->stride, f->data[0] + (i*2 + 0)*f->linesize[0], width);
-      memcpy(buf->y + (i*2 + 1)*buf->stride, f->data[0] + (i*2 + 1)*f->linesize[0], width);
-      memcpy(buf->uv + i*buf->stride, f->data[1] + i*f->linesize[1], width);
-    }
+    libyuv::CopyPlane(f->data[0], f->linesize[0], y, stride, width, height);
+    libyuv::CopyPlane(f->data[1], f->linesize[1], uv, stride, width, height / 2);
   } else {
     libyuv::I420ToNV12(f->data[0], f->linesize[0],
                        f->data[1], f->linesize[1],
                        f->data[2], f->linesize[2],
-                       buf->y, buf->stride,
-                       buf->uv, buf->stride,
+                       y, stride,
+                       uv, stride,
                        width, height);
   }
-  return true;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -16,6 +19,9 @@ struct AVFrameDeleter {
   void operator()(AVFrame* frame) const { av_frame_free(&frame); }
 };
 
+const size_t DEFAULT_FRAME_CACHE_SIZE = 512 * 1024 * 1024;
+const int DEFAULT_FRAME_LOOKAHEAD = 8;
+
 class FrameReader {
 public:
   FrameReader();
@@ -28,13 +34,22 @@ public:
   size_t getFrameCount() const { return packets.size(); }
   bool valid() const { return valid_; }
 
+  // Decoded frames of all readers are kept in an LRU cache of this many bytes, so
+  // seeking back or stepping through a GOP doesn't decode it again.
+  static void setCacheSize(size_t bytes);
+  // Threads of the software decoder, 0 lets libavcodec pick one per core.
+  static void setDecoderThreads(int n) { decoder_threads = n; }
+  // Frames decoded in the background ahead of the last one read.
+  static void setLookahead(int frames) { lookahead_frames = frames; }
+
   int width = 0, height = 0;
 
 private:
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
   bool decode(int idx, VisionBuf *buf);
-  AVFrame * decodeFrame(AVPacket *pkt);
-  bool copyBuffers(AVFrame *f, VisionBuf *buf);
+  bool decodeTo(int idx, VisionBuf *buf);
+  void lookahead();
+  void toNV12(AVFrame *f, uint8_t *y, uint8_t *uv, int stride);
 
   std::vector<AVPacket*> packets;
   std::unique_ptr<AVFrame, AVFrameDeleter>av_frame_, hw_frame;
@@ -46,6 +61,15 @@ private:
 
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
   AVBufferRef *hw_device_ctx = nullptr;
-  int prev_idx = -1;
   inline static std::atomic<bool> has_hw_decoder = true;
+  inline static std::atomic<int> decoder_threads = 1;
+  inline static std::atomic<int> lookahead_frames = DEFAULT_FRAME_LOOKAHEAD;
+
+  const uint64_t id_;  // the cache key of this reader's frames
+  std::mutex decode_lock_;  // the decoder state below is used by get() and the look-ahead
+  int next_packet_ = 0;  // sent to the decoder next
+  int next_frame_ = 0;  // comes out of the decoder next
+  std::atomic<int> lookahead_to_ = -1;
+  std::atomic<bool> exit_ = false;
+  std::future<void> lookahead_;
 };
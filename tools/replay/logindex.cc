@@ -0,0 +1,182 @@
+#include "tools/replay/logindex.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <utility>
+
+#include "common/util.h"
+#include "tools/replay/filereader.h"
+#include "tools/replay/util.h"
+
+// The index file is fixed size records after the header, in this order: the controlsStates,
+// the user flags and a table of NUL terminated strings. Bump LOG_INDEX_VERSION when the
+// layout changes.
+
+#define LOG_INDEX_MAGIC 0x58444952  // "RIDX"
+#define LOG_INDEX_VERSION 2
+
+struct LogIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_size;  // local logs only, remote ones never change
+  int64_t source_mtime;
+  uint64_t start_mono_time;
+  uint64_t end_mono_time;
+  uint32_t num_controls_states;
+  uint32_t num_user_flags;
+  uint32_t strings_size;
+};
+
+struct LogIndexControlsState {
+  uint64_t mono_time;
+  uint32_t alert_type;  // offset into the string table
+  uint8_t enabled;
+  uint8_t alert_status;
+  uint8_t alert_size;
+  uint8_t pad;
+};
+
+bool LogIndex::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  const bool is_remote = isRemoteUrl(url);
+  struct stat st = {};
+  if (!is_remote && stat(url.c_str(), &st) != 0) return false;
+
+  const std::string index_file = cacheFilePath(url) + ".idx";
+  if (local_cache && read(index_file, st.st_size, st.st_mtime)) return true;
+
+  LogStream stream;
+  FileReader reader(local_cache, chunk_size, retries);
+  if (!is_remote || local_cache) {
+    const std::string local_file = reader.localFile(url, abort);
+    if (local_file.empty() || !stream.openFile(local_file)) return false;
+  } else {
+    std::string data = reader.read(url, abort);
+    if (data.empty() || !stream.openData(std::move(data))) return false;
+  }
+  if (!build(stream, abort)) return false;
+
+  if (local_cache && !write(index_file, st.st_size, st.st_mtime)) {
+    rWarning("failed to write log index %s", index_file.c_str());
+  }
+  return true;
+}
+
+bool LogIndex::build(LogStream &stream, std::atomic<bool> *abort) {
+  uint64_t offset = 0;
+  try {
+    kj::ArrayPtr<const capnp::word> words;
+    while (stream.next(words, abort)) {
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      const uint64_t mono_time = event.getLogMonoTime();
+      if (offset == 0) {
+        start_mono_time = end_mono_time = mono_time;
+      }
+      end_mono_time = std::max(end_mono_time, mono_time);
+
+      if (event.which() == cereal::Event::CONTROLS_STATE) {
+        auto cs = event.getControlsState();
+        ControlsState state = {mono_time, cs.getEnabled(), cs.getAlertStatus(), cs.getAlertSize(), cs.getAlertType().cStr()};
+        if (controls_states.empty() || controls_states.back().enabled != state.enabled ||
+            controls_states.back().alert_type != state.alert_type || controls_states.back().alert_status != state.alert_status) {
+          controls_states.push_back(std::move(state));
+        }
+      } else if (event.which() == cereal::Event::USER_FLAG) {
+        user_flags.push_back(mono_time);
+      }
+      offset += words.asBytes().size();
+    }
+  } catch (const kj::Exception &e) {
+    rWarning("failed to parse log : %s", e.getDescription().cStr());
+  }
+  return offset > 0 && !(abort && *abort);
+}
+
+bool LogIndex::read(const std::string &file, uint64_t source_size, int64_t source_mtime) {
+  const std::string data = util::read_file(file);
+  LogIndexHeader h;
+  if (data.size() < sizeof(h)) return false;
+
+  memcpy(&h, data.data(), sizeof(h));
+  if (h.magic != LOG_INDEX_MAGIC || h.version != LOG_INDEX_VERSION ||
+      h.source_size != source_size || h.source_mtime != source_mtime) {
+    return false;
+  }
+
+  size_t pos = sizeof(h);
+  auto read_array = [&](auto &out, size_t n) {
+    const size_t size = sizeof(out[0]);
+    if (n > (data.size() - pos) / size) return false;
+    out.resize(n);
+    memcpy(out.data(), data.data() + pos, n * size);
+    pos += n * size;
+    return true;
+  };
+  std::vector<uint64_t> flags;
+  std::vector<LogIndexControlsState> states;
+  std::string strings;
+  if (!read_array(states, h.num_controls_states) || !read_array(flags, h.num_user_flags) ||
+      !read_array(strings, h.strings_size) || pos != data.size() || strings.empty() || strings.back() != '\0') {
+    return false;
+  }
+
+  controls_states.clear();
+  for (const auto &s : states) {
+    controls_states.push_back({s.mono_time, (bool)s.enabled, (cereal::ControlsState::AlertStatus)s.alert_status,
+                               (cereal::ControlsState::AlertSize)s.alert_size,
+                               strings.c_str() + std::min<size_t>(s.alert_type, strings.size() - 1)});
+  }
+  start_mono_time = h.start_mono_time;
+  end_mono_time = h.end_mono_time;
+  user_flags = std::move(flags);
+  return true;
+}
+
+bool LogIndex::write(const std::string &file, uint64_t source_size, int64_t source_mtime) const {
+  std::string strings(1, '\0');
+  std::map<std::string, uint32_t> string_offsets = {{"", 0}};
+  std::vector<LogIndexControlsState> states;
+  for (const auto &s : controls_states) {
+    auto [it, inserted] = string_offsets.insert({s.alert_type, strings.size()});
+    if (inserted) {
+      strings.append(s.alert_type.c_str(), s.alert_type.size() + 1);
+    }
+    states.push_back({s.mono_time, it->second, s.enabled, (uint8_t)s.alert_status, (uint8_t)s.alert_size, 0});
+  }
+
+  LogIndexHeader h = {
+    .magic = LOG_INDEX_MAGIC,
+    .version = LOG_INDEX_VERSION,
+    .source_size = source_size,
+    .source_mtime = source_mtime,
+    .start_mono_time = start_mono_time,
+    .end_mono_time = end_mono_time,
+    .num_controls_states = (uint32_t)states.size(),
+    .num_user_flags = (uint32_t)user_flags.size(),
+    .strings_size = (uint32_t)strings.size(),
+  };
+
+  // several replays may index the same log at once, write a private file and rename it into place
+  const std::string tmp_file = file + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream f(tmp_file, std::ios::binary | std::ios::trunc);
+    f.write((const char *)&h, sizeof(h));
+    f.write((const char *)states.data(), states.size() * sizeof(LogIndexControlsState));
+    f.write((const char *)user_flags.data(), user_flags.size() * sizeof(uint64_t));
+    f.write(strings.data(), strings.size());
+    if (!f.good()) {
+      f.close();
+      unlink(tmp_file.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp_file.c_str(), file.c_str()) != 0) {
+    unlink(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
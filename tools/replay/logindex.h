@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "tools/replay/logreader.h"
+
+// A summary of a segment's log: its time span and the engagement and alert changes. Built in
+// one pass over the log and cached next to the downloaded files, so the timeline doesn't need
+// to load the logs.
+class LogIndex {
+public:
+  struct ControlsState {
+    uint64_t mono_time;
+    bool enabled;
+    cereal::ControlsState::AlertStatus alert_status;
+    cereal::ControlsState::AlertSize alert_size;
+    std::string alert_type;
+  };
+
+  // Reads the cached index of the log, or builds it and writes it to the cache.
+  bool load(const std::string &url, std::atomic<bool> *abort = nullptr,
+            bool local_cache = false, int chunk_size = -1, int retries = 0);
+  bool build(LogStream &stream, std::atomic<bool> *abort = nullptr);
+
+  uint64_t start_mono_time = 0;
+  uint64_t end_mono_time = 0;
+  // the first controlsState and every one that changed engagement or alert
+  std::vector<ControlsState> controls_states;
+  std::vector<uint64_t> user_flags;  // mono times
+
+private:
+  bool read(const std::string &file, uint64_t source_size, int64_t source_mtime);
+  bool write(const std::string &file, uint64_t source_size, int64_t source_mtime) const;
+};
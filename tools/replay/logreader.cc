@@ -1,9 +1,26 @@
 #include "tools/replay/logreader.h"
 
+#include <bzlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
 #include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include "common/util.h"
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
 
+const size_t LOG_BLOCK_SIZE = 4 * 1024 * 1024;
+const uint32_t ZSTD_SEEK_TABLE_MAGIC = 0x184D2A5E;
+const uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+
 Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(amsg), frame(frame) {
   words = kj::ArrayPtr<const capnp::word>(amsg.begin(), reader.getEnd());
   event = reader.getRoot<cereal::Event>();
@@ -25,9 +42,307 @@ Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(a
   }
 }
 
+// class LogStream
+
+struct LogStream::Decompressor {
+  virtual ~Decompressor() {}
+  // Decompresses up to size bytes into out. Returns the number of bytes written, or -1 on an error.
+  virtual ssize_t read(char *out, size_t size) = 0;
+  bool done = false;
+};
+
+class BZ2Decompressor : public LogStream::Decompressor {
+public:
+  BZ2Decompressor(const char *in, size_t in_size) {
+    int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
+    assert(bzerror == BZ_OK);
+    strm.next_in = (char *)in;
+    strm.avail_in = in_size;
+  }
+  ~BZ2Decompressor() { BZ2_bzDecompressEnd(&strm); }
+
+  ssize_t read(char *out, size_t size) override {
+    strm.next_out = out;
+    strm.avail_out = size;
+    int bzerror = BZ2_bzDecompress(&strm);
+    const size_t written = size - strm.avail_out;
+    if (bzerror == BZ_STREAM_END) {
+      done = true;
+    } else if (bzerror != BZ_OK || (written == 0 && strm.avail_in == 0)) {
+      rWarning("decompressBZ2 error : content is corrupt");
+      return -1;
+    }
+    return written;
+  }
+
+private:
+  bz_stream strm = {};
+};
+
+class ZstdDecompressor : public LogStream::Decompressor {
+public:
+  ZstdDecompressor(const char *in, size_t in_size) : dctx(ZSTD_createDCtx()), input({in, in_size, 0}) {
+    assert(dctx != nullptr);
+  }
+  ~ZstdDecompressor() { ZSTD_freeDCtx(dctx); }
+
+  ssize_t read(char *out, size_t size) override {
+    ZSTD_outBuffer output = {out, size, 0};
+    while (output.pos < output.size && !done) {
+      const size_t in_pos = input.pos, out_pos = output.pos;
+      const size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+      if (ZSTD_isError(ret)) {
+        rWarning("zstd error : %s", ZSTD_getErrorName(ret));
+        return -1;
+      }
+      if (ret == 0 && input.pos == input.size) {
+        done = true;
+      } else if (input.pos == in_pos && output.pos == out_pos) {
+        rWarning("zstd error : content is truncated");
+        return output.pos > 0 ? output.pos : -1;
+      }
+    }
+    return output.pos;
+  }
+
+private:
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer input;
+};
+
+// Reads the seek table of the zstd seekable format, the compressed and decompressed
+// size of every frame. It's a skippable frame at the end, regular decoders ignore it.
+static bool read_seek_table(const char *data, size_t size, std::vector<std::pair<uint32_t, uint32_t>> &table) {
+  const size_t header_size = 8, footer_size = 9;
+  if (size < header_size + footer_size) return false;
+
+  uint32_t num_frames, magic;
+  memcpy(&num_frames, data + size - footer_size, sizeof(num_frames));
+  const uint8_t descriptor = data[size - 5];
+  memcpy(&magic, data + size - 4, sizeof(magic));
+  if (magic != ZSTD_SEEKABLE_MAGIC || (descriptor & 0x7c) != 0 || num_frames == 0) return false;
+
+  const size_t entry_size = (descriptor & 0x80) ? 12 : 8;  // with or without checksums
+  const uint64_t table_size = (uint64_t)num_frames * entry_size + footer_size;
+  if (size < table_size + header_size) return false;
+
+  const char *p = data + size - table_size - header_size;
+  uint32_t header[2];
+  memcpy(header, p, sizeof(header));
+  if (header[0] != ZSTD_SEEK_TABLE_MAGIC || header[1] != table_size) return false;
+
+  table.resize(num_frames);
+  p += header_size;
+  for (auto &entry : table) {
+    uint32_t sizes[2];
+    memcpy(sizes, p, sizeof(sizes));
+    entry = {sizes[0], sizes[1]};
+    p += entry_size;
+  }
+  return true;
+}
+
+LogStream::LogStream(bool keep_data) : keep_data_(keep_data) {}
+
+LogStream::~LogStream() {
+  close();
+}
+
+void LogStream::close() {
+  releaseInput();
+  blocks_.clear();
+  block_pos_ = block_end_ = 0;
+  words_ = {};
+  frames_.clear();
+}
+
+// frees the compressed log once nothing is read from it anymore
+void LogStream::releaseInput() {
+  decompressor_.reset();
+  if (mmap_) {
+    munmap(mmap_, mmap_size_);
+    mmap_ = nullptr;
+  }
+  data_.clear();
+  data_.shrink_to_fit();
+}
+
+bool LogStream::openFile(const std::string &file) {
+  close();
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem != MAP_FAILED) {
+      madvise(mem, st.st_size, MADV_SEQUENTIAL);
+      mmap_ = mem;
+      mmap_size_ = st.st_size;
+    }
+  }
+  ::close(fd);
+  if (!mmap_) return false;
+
+  return start((const char *)mmap_, mmap_size_);
+}
+
+bool LogStream::openData(std::string &&data) {
+  close();
+  data_ = std::move(data);
+  return start(data_.data(), data_.size());
+}
+
+bool LogStream::start(const char *data, size_t size) {
+  std::vector<std::pair<uint32_t, uint32_t>> seek_table;
+  if (size >= 3 && memcmp(data, "BZh", 3) == 0) {
+    decompressor_ = std::make_unique<BZ2Decompressor>(data, size);
+  } else if (size >= 4 && memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0) {
+    // all events are kept anyway, so seekable logs are decompressed at once by frame
+    if (keep_data_ && read_seek_table(data, size, seek_table)) {
+      size_t offset = 0, out_offset = 0;
+      for (auto &[frame_size, out_size] : seek_table) {
+        frames_.push_back({offset, frame_size, out_offset, out_size});
+        offset += frame_size;
+        out_offset += out_size;
+      }
+      if (offset > size) frames_.clear();
+    }
+    if (frames_.empty()) {
+      decompressor_ = std::make_unique<ZstdDecompressor>(data, size);
+    }
+  } else {
+    words_ = kj::arrayPtr((const capnp::word *)data, size / sizeof(capnp::word));
+  }
+  return size > 0;
+}
+
+bool LogStream::decompressFrames(std::atomic<bool> *abort) {
+  const char *in = mmap_ ? (const char *)mmap_ : data_.data();
+  const size_t in_size = mmap_ ? mmap_size_ : data_.size();
+  const size_t out_size = frames_.back().out_offset + frames_.back().out_size;
+  auto out = kj::heapArray<capnp::word>((out_size + sizeof(capnp::word) - 1) / sizeof(capnp::word));
+
+  // every thread takes the next frame until all are done
+  std::atomic<size_t> next_frame = 0;
+  std::atomic<bool> failed = false;
+  auto decompress = [&]() {
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    for (size_t i = next_frame++; i < frames_.size() && !failed && !(abort && *abort); i = next_frame++) {
+      const Frame &f = frames_[i];
+      const size_t ret = ZSTD_decompressDCtx(dctx, (char *)out.begin() + f.out_offset, f.out_size, in + f.offset, f.size);
+      if (ZSTD_isError(ret) || ret != f.out_size) {
+        failed = true;
+      }
+    }
+    ZSTD_freeDCtx(dctx);
+  };
+  const size_t num_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), frames_.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(decompress);
+  }
+  decompress();
+  for (auto &t : threads) {
+    t.join();
+  }
+  frames_.clear();
+
+  if (abort && *abort) {
+    releaseInput();
+    return false;
+  }
+  if (failed) {
+    // stream it instead, to get the events before the corrupt frame
+    rWarning("zstd error : content is corrupt");
+    decompressor_ = std::make_unique<ZstdDecompressor>(in, in_size);
+    return true;
+  }
+  blocks_.push_back(std::move(out));
+  words_ = blocks_.back().slice(0, out_size / sizeof(capnp::word)).asConst();
+  releaseInput();
+  return true;
+}
+
+bool LogStream::readBlock(size_t min_words) {
+  // start a new block if the current one can't hold the next event, carrying over its beginning
+  const size_t pos_bytes = block_pos_ * sizeof(capnp::word);
+  if (blocks_.empty() || (blocks_.back().size() - block_pos_) < min_words || block_end_ == blocks_.back().asBytes().size()) {
+    const size_t partial = block_end_ - pos_bytes;
+    const size_t block_words = std::max(LOG_BLOCK_SIZE / sizeof(capnp::word), 2 * min_words);
+    if (keep_data_ || blocks_.empty() || blocks_.back().size() < block_words) {
+      // earlier blocks are kept if the events read from them must stay valid
+      auto block = kj::heapArray<capnp::word>(block_words);
+      if (partial > 0) {
+        memcpy(block.begin(), blocks_.back().asBytes().begin() + pos_bytes, partial);
+      }
+      if (!keep_data_) blocks_.clear();
+      blocks_.push_back(std::move(block));
+    } else {
+      memmove(blocks_.back().asBytes().begin(), blocks_.back().asBytes().begin() + pos_bytes, partial);
+    }
+    block_pos_ = 0;
+    block_end_ = partial;
+  }
+
+  auto block = blocks_.back().asBytes();
+  ssize_t n = decompressor_->read((char *)block.begin() + block_end_, block.size() - block_end_);
+  if (n < 0) return false;
+  block_end_ += n;
+  return true;
+}
+
+bool LogStream::next(kj::ArrayPtr<const capnp::word> &words, std::atomic<bool> *abort) {
+  if (!frames_.empty() && !decompressFrames(abort)) {
+    return false;
+  }
+
+  if (!decompressor_) {
+    if (words_.size() == 0) return false;
+    const size_t size = capnp::expectedSizeInWordsFromPrefix(words_);
+    if (size > words_.size()) {
+      rWarning("log is truncated, %zu bytes left", words_.asBytes().size());
+      words_ = {};
+      return false;
+    }
+    words = words_.slice(0, size);
+    words_ = words_.slice(size, words_.size());
+    return true;
+  }
+
+  while (!(abort && *abort)) {
+    size_t size = 1;
+    if (!blocks_.empty()) {
+      auto available = blocks_.back().slice(block_pos_, block_end_ / sizeof(capnp::word)).asConst();
+      if (available.size() > 0) {
+        size = capnp::expectedSizeInWordsFromPrefix(available);
+        if (size <= available.size()) {
+          words = available.slice(0, size);
+          block_pos_ += size;
+          return true;
+        }
+      }
+    }
+
+    if (decompressor_->done) {
+      if (block_end_ > block_pos_ * sizeof(capnp::word)) {
+        rWarning("log is truncated, %zu bytes left", block_end_ - block_pos_ * sizeof(capnp::word));
+      }
+      break;
+    }
+    if (!readBlock(size)) break;
+  }
+
+  // nothing is read from the compressed data anymore
+  releaseInput();
+  if (!keep_data_) blocks_.clear();
+  block_pos_ = block_end_ = 0;
+  return false;
+}
+
 // class LogReader
 
-LogReader::LogReader(size_t memory_pool_block_size) {
+LogReader::LogReader(size_t memory_pool_block_size) : stream_(true) {
 #ifdef HAS_MEMORY_RESOURCE
   const size_t buf_size = sizeof(Event) * memory_pool_block_size;
   mbr_ = std::make_unique<std::pmr::monotonic_buffer_resource>(buf_size);
@@ -42,25 +357,29 @@ LogReader::~LogReader() {
 }
 
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  raw_ = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (raw_.empty()) return false;
-
-  if (url.find(".bz2") != std::string::npos) {
-    raw_ = decompressBZ2(raw_, abort);
-    if (raw_.empty()) return false;
+  // local logs, and remote ones downloaded to the cache, are mmapped instead of read into memory
+  const bool is_remote = isRemoteUrl(url);
+  FileReader reader(local_cache, chunk_size, retries);
+  if (!is_remote || local_cache) {
+    const std::string local_file = reader.localFile(url, abort);
+    if (local_file.empty() || !stream_.openFile(local_file)) return false;
+  } else {
+    std::string data = reader.read(url, abort);
+    if (data.empty()) return false;
+    stream_.openData(std::move(data));
   }
   return parse(abort);
 }
 
 bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abort) {
-  raw_.assign((const char *)data, size);
+  stream_.openData(std::string((const char *)data, size));
   return parse(abort);
 }
 
 bool LogReader::parse(std::atomic<bool> *abort) {
   try {
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw_.data(), raw_.size() / sizeof(capnp::word));
-    while (words.size() > 0 && !(abort && *abort)) {
+    kj::ArrayPtr<const capnp::word> words;
+    while (stream_.next(words, abort)) {
 #ifdef HAS_MEMORY_RESOURCE
       Event *evt = new (mbr_.get()) Event(words);
 #else
@@ -80,7 +399,6 @@ bool LogReader::parse(std::atomic<bool> *abort) {
         events.push_back(frame_evt);
       }
 
-      words = kj::arrayPtr(evt->reader.getEnd(), words.end());
       events.push_back(evt);
     }
   } catch (const kj::Exception &e) {
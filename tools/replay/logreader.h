@@ -5,6 +5,7 @@
 #include <memory_resource>
 #endif
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -49,6 +50,48 @@ public:
   bool frame;
 };
 
+// Reads the events of a log one at a time. Local uncompressed logs are mmapped and read
+// in place, bz2 and zstd logs are decompressed block by block as the events are consumed.
+// Seekable zstd logs read with keep_data are decompressed frame-parallel on all cores.
+class LogStream {
+public:
+  // With keep_data, every event stays valid for the lifetime of the stream,
+  // otherwise only the last one returned by next() is, and memory is bounded by a block.
+  LogStream(bool keep_data = false);
+  ~LogStream();
+  // The compression is detected from the data.
+  bool openFile(const std::string &file);
+  bool openData(std::string &&data);
+  // Returns false at the end of the log, on an error or when aborted.
+  bool next(kj::ArrayPtr<const capnp::word> &words, std::atomic<bool> *abort = nullptr);
+
+  struct Decompressor;
+
+private:
+  struct Frame {
+    size_t offset, size;  // compressed
+    size_t out_offset, out_size;  // decompressed
+  };
+
+  void close();
+  void releaseInput();
+  bool start(const char *data, size_t size);
+  bool readBlock(size_t min_words);
+  bool decompressFrames(std::atomic<bool> *abort);
+
+  const bool keep_data_;
+  std::string data_;
+  void *mmap_ = nullptr;
+  size_t mmap_size_ = 0;
+  kj::ArrayPtr<const capnp::word> words_;  // not yet returned, uncompressed logs only
+  std::vector<Frame> frames_;  // seekable zstd, decompressed by the first next()
+
+  std::unique_ptr<Decompressor> decompressor_;
+  std::vector<kj::Array<capnp::word>> blocks_;  // decompressed blocks, events are read from the last one
+  size_t block_pos_ = 0;  // in words
+  size_t block_end_ = 0;  // in bytes
+};
+
 class LogReader {
 public:
   LogReader(size_t memory_pool_block_size = DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE);
@@ -60,7 +103,7 @@ public:
 
 private:
   bool parse(std::atomic<bool> *abort);
-  std::string raw_;
+  LogStream stream_;
 #ifdef HAS_MEMORY_RESOURCE
   std::unique_ptr<std::pmr::monotonic_buffer_resource> mbr_;
 #endif
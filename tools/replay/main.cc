@@ -3,6 +3,7 @@
 
 #include "common/prefix.h"
 #include "tools/replay/consoleui.h"
+#include "tools/replay/filereader.h"
 #include "tools/replay/replay.h"
 
 int main(int argc, char *argv[]) {
@@ -21,6 +22,7 @@ int main(int argc, char *argv[]) {
       {"qcam", REPLAY_FLAG_QCAMERA, "load qcamera"},
       {"no-hw-decoder", REPLAY_FLAG_NO_HW_DECODER, "disable HW video decoding"},
       {"no-vipc", REPLAY_FLAG_NO_VIPC, "do not output video"},
+      {"flood", REPLAY_FLAG_FLOOD, "headless. publish as fast as the subscribers read, quit at the end of the route"},
       {"all", REPLAY_FLAG_ALL_SERVICES, "do output all messages including uiDebug, userFlag"
                                         ". this may causes issues when used along with UI"}
   };
@@ -32,6 +34,10 @@ int main(int argc, char *argv[]) {
   parser.addOption({{"a", "allow"}, "whitelist of services to send", "allow"});
   parser.addOption({{"b", "block"}, "blacklist of services to send", "block"});
   parser.addOption({{"c", "cache"}, "cache <n> segments in memory. default is 5", "n"});
+  parser.addOption({"prefetch", "load <n> segments at once. default is 2", "n"});
+  parser.addOption({"frame-cache", "keep <mb> of decoded frames. default is 512", "mb"});
+  parser.addOption({"disk-cache", "keep <gb> of downloaded files. default is 20", "gb"});
+  parser.addOption({"decode-threads", "decode video with <n> threads, 0 for one per core. default is 1", "n"});
   parser.addOption({{"s", "start"}, "start from <seconds>", "seconds"});
   parser.addOption({"x", QString("playback <speed>. between %1 - %2")
                         .arg(ConsoleUI::speed_array.front()).arg(ConsoleUI::speed_array.back()), "speed"});
@@ -65,10 +71,23 @@ int main(int argc, char *argv[]) {
     op_prefix.reset(new OpenpilotPrefix(prefix.toStdString()));
   }
 
+  if (!parser.value("frame-cache").isEmpty()) {
+    FrameReader::setCacheSize(parser.value("frame-cache").toULongLong() * 1024 * 1024);
+  }
+  if (!parser.value("disk-cache").isEmpty()) {
+    FileReader::setCacheLimit(parser.value("disk-cache").toDouble() * 1024 * 1024 * 1024);
+  }
+  if (!parser.value("decode-threads").isEmpty()) {
+    FrameReader::setDecoderThreads(parser.value("decode-threads").toInt());
+  }
+
   Replay *replay = new Replay(route, allow, block, nullptr, replay_flags, parser.value("data_dir"), &app);
   if (!parser.value("c").isEmpty()) {
     replay->setSegmentCacheLimit(parser.value("c").toInt());
   }
+  if (!parser.value("prefetch").isEmpty()) {
+    replay->setSegmentPrefetch(parser.value("prefetch").toInt());
+  }
   if (!parser.value("x").isEmpty()) {
     replay->setSpeed(std::clamp(parser.value("x").toFloat(),
                                 ConsoleUI::speed_array.front(), ConsoleUI::speed_array.back()));
@@ -77,7 +96,13 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  ConsoleUI console_ui(replay);
+  std::unique_ptr<ConsoleUI> console_ui;
+  if (replay->hasFlag(REPLAY_FLAG_FLOOD)) {
+    replay->addFlag(REPLAY_FLAG_NO_LOOP);
+    QObject::connect(replay, &Replay::streamFinished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+  } else {
+    console_ui = std::make_unique<ConsoleUI>(replay);
+  }
   replay->start(parser.value("start").toInt());
   return app.exec();
 }
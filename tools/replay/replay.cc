@@ -3,12 +3,72 @@
 #include <QDebug>
 #include <QtConcurrent>
 
+#include <thread>
+
 #include <capnp/dynamic.h>
 #include "cereal/services.h"
 #include "common/params.h"
 #include "common/timing.h"
 #include "tools/replay/util.h"
 
+// class MergedEvents
+
+MergedEvents::iterator &MergedEvents::iterator::operator++() {
+  auto &range = ranges_[cur_range_];
+  if (++range.first == range.second) {
+    ranges_.erase(ranges_.begin() + cur_range_);
+  }
+  findNext();
+  return *this;
+}
+
+void MergedEvents::iterator::findNext() {
+  // the earliest event of all segments, on a tie the one of the earlier segment
+  cur_ = nullptr;
+  for (size_t i = 0; i < ranges_.size(); ++i) {
+    if (!cur_ || Event::lessThan()(*ranges_[i].first, *cur_)) {
+      cur_ = ranges_[i].first;
+      cur_range_ = i;
+    }
+  }
+}
+
+MergedEvents::iterator MergedEvents::upper_bound(const Event *e) const {
+  iterator it;
+  for (const auto &[_, events] : segments_) {
+    auto first = e ? std::upper_bound(events.begin(), events.end(), e, Event::lessThan()) : events.begin();
+    if (first != events.end()) {
+      it.ranges_.push_back({&*first, events.data() + events.size()});
+    }
+  }
+  it.findNext();
+  return it;
+}
+
+bool MergedEvents::empty() const {
+  return std::all_of(segments_.begin(), segments_.end(), [](auto &s) { return s.second.empty(); });
+}
+
+size_t MergedEvents::size() const {
+  size_t size = 0;
+  for (const auto &[_, events] : segments_) {
+    size += events.size();
+  }
+  return size;
+}
+
+const Event *MergedEvents::back() const {
+  const Event *last = nullptr;
+  for (const auto &[_, events] : segments_) {
+    if (!events.empty() && (!last || !Event::lessThan()(events.back(), last))) {
+      last = events.back();
+    }
+  }
+  return last;
+}
+
+// class Replay
+
 Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *sm_,
                uint32_t flags, QString data_dir, QObject *parent) : sm(sm_), flags_(flags), QObject(parent) {
   if (!(flags_ & REPLAY_FLAG_ALL_SERVICES)) {
@@ -32,9 +92,13 @@ Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *s
   if (sm == nullptr) {
     pm = std::make_unique<PubMaster>(s);
   }
+  if (hasFlag(REPLAY_FLAG_FLOOD) && pm && messaging_use_zmq()) {
+    rWarning("flood mode can't wait for ZMQ subscribers, messages may be dropped");
+  }
+  flood_wait_ = pm != nullptr && !messaging_use_zmq();
+  flood_retry_ts_.resize(sockets_.size(), 0);
   route_ = std::make_unique<Route>(route, data_dir);
-  events_ = std::make_unique<std::vector<Event *>>();
-  new_events_ = std::make_unique<std::vector<Event *>>();
+  setSegmentPrefetch(DEFAULT_SEGMENT_PREFETCH);
 }
 
 Replay::~Replay() {
@@ -95,6 +159,12 @@ void Replay::updateEvents(const std::function<bool()> &lambda) {
   stream_cv_.notify_one();
 }
 
+void Replay::setSegmentPrefetch(int n) {
+  segment_prefetch_ = std::max(1, n);
+  // enough threads to load every file of the prefetched segments at once
+  segment_pool_.setMaxThreadCount(segment_prefetch_ * (MAX_CAMERAS + 1));
+}
+
 void Replay::seekTo(double seconds, bool relative) {
   seconds = relative ? seconds + currentSeconds() : seconds;
   updateEvents([&]() {
@@ -106,6 +176,8 @@ void Replay::seekTo(double seconds, bool relative) {
     }
 
     rInfo("seeking to %d s, segment %d", (int)seconds, seg);
+    travel_direction_ = seg < current_segment_ ? -1 : 1;
+    seek_ts_ = millis_since_boot();
     current_segment_ = seg;
     cur_mono_time_ = route_start_ts_ + seconds * 1e9;
     emit seekedTo(seconds);
@@ -135,63 +207,65 @@ void Replay::buildTimeline() {
     [(int)cereal::ControlsState::AlertStatus::CRITICAL] = TimelineType::AlertCritical,
   };
 
+  // built from the segments' log indexes, the qlogs are only read the first time
   const auto &route_segments = route_->segments();
   for (auto it = route_segments.cbegin(); it != route_segments.cend() && !exit_; ++it) {
-    std::shared_ptr<LogReader> log(new LogReader());
-    if (!log->load(it->second.qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3)) continue;
-
-    for (const Event *e : log->events) {
-      if (e->which == cereal::Event::Which::CONTROLS_STATE) {
-        auto cs = e->event.getControlsState();
-
-        if (engaged != cs.getEnabled()) {
-          if (engaged) {
-            std::lock_guard lk(timeline_lock);
-            timeline.push_back({toSeconds(engaged_begin), toSeconds(e->mono_time), TimelineType::Engaged});
-          }
-          engaged_begin = e->mono_time;
-          engaged = cs.getEnabled();
+    LogIndex index;
+    if (!index.load(it->second.qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3)) continue;
+
+    std::vector<std::tuple<double, double, TimelineType>> entries;
+    for (const auto &cs : index.controls_states) {
+      if (engaged != cs.enabled) {
+        if (engaged) {
+          entries.push_back({toSeconds(engaged_begin), toSeconds(cs.mono_time), TimelineType::Engaged});
         }
+        engaged_begin = cs.mono_time;
+        engaged = cs.enabled;
+      }
 
-        if (alert_type != cs.getAlertType().cStr() || alert_status != cs.getAlertStatus()) {
-          if (!alert_type.empty() && alert_size != cereal::ControlsState::AlertSize::NONE) {
-            std::lock_guard lk(timeline_lock);
-            timeline.push_back({toSeconds(alert_begin), toSeconds(e->mono_time), timeline_types[(int)alert_status]});
-          }
-          alert_begin = e->mono_time;
-          alert_type = cs.getAlertType().cStr();
-          alert_size = cs.getAlertSize();
-          alert_status = cs.getAlertStatus();
+      if (alert_type != cs.alert_type || alert_status != cs.alert_status) {
+        if (!alert_type.empty() && alert_size != cereal::ControlsState::AlertSize::NONE) {
+          entries.push_back({toSeconds(alert_begin), toSeconds(cs.mono_time), timeline_types[(int)alert_status]});
         }
-      } else if (e->which == cereal::Event::Which::USER_FLAG) {
-        std::lock_guard lk(timeline_lock);
-        timeline.push_back({toSeconds(e->mono_time), toSeconds(e->mono_time), TimelineType::UserFlag});
+        alert_begin = cs.mono_time;
+        alert_type = cs.alert_type;
+        alert_size = cs.alert_size;
+        alert_status = cs.alert_status;
       }
     }
-    std::sort(timeline.begin(), timeline.end(), [](auto &l, auto &r) { return std::get<2>(l) < std::get<2>(r); });
-    emit qLogLoaded(it->first, log);
+    for (uint64_t mono_time : index.user_flags) {
+      entries.push_back({toSeconds(mono_time), toSeconds(mono_time), TimelineType::UserFlag});
+    }
+
+    std::lock_guard lk(timeline_lock);
+    timeline.insert(timeline.end(), entries.begin(), entries.end());
+    // by type, then by time for find()
+    std::sort(timeline.begin(), timeline.end(), [](auto &l, auto &r) {
+      return std::tie(std::get<2>(l), std::get<0>(l)) < std::tie(std::get<2>(r), std::get<0>(r));
+    });
   }
 }
 
 std::optional<uint64_t> Replay::find(FindFlag flag) {
+  const TimelineType flag_types[] = {
+    [(int)FindFlag::nextEngagement] = TimelineType::Engaged,
+    [(int)FindFlag::nextDisEngagement] = TimelineType::Engaged,
+    [(int)FindFlag::nextUserFlag] = TimelineType::UserFlag,
+    [(int)FindFlag::nextInfo] = TimelineType::AlertInfo,
+    [(int)FindFlag::nextWarning] = TimelineType::AlertWarning,
+    [(int)FindFlag::nextCritical] = TimelineType::AlertCritical,
+  };
+  const TimelineType type = flag_types[(int)flag];
+  const bool find_end = flag == FindFlag::nextDisEngagement;
   int cur_ts = currentSeconds();
-  for (auto [start_ts, end_ts, type] : getTimeline()) {
-    if (type == TimelineType::Engaged) {
-      if (flag == FindFlag::nextEngagement && start_ts > cur_ts) {
-        return start_ts;
-      } else if (flag == FindFlag::nextDisEngagement && end_ts > cur_ts) {
-        return end_ts;
-      }
-    } else if (start_ts > cur_ts) {
-      if ((flag == FindFlag::nextUserFlag && type == TimelineType::UserFlag) ||
-          (flag == FindFlag::nextInfo && type == TimelineType::AlertInfo) ||
-          (flag == FindFlag::nextWarning && type == TimelineType::AlertWarning) ||
-          (flag == FindFlag::nextCritical && type == TimelineType::AlertCritical)) {
-        return start_ts;
-      }
-    }
-  }
-  return std::nullopt;
+
+  // engagements don't overlap, so their ends are sorted too
+  std::lock_guard lk(timeline_lock);
+  auto begin = std::partition_point(timeline.begin(), timeline.end(), [&](auto &t) { return std::get<2>(t) < type; });
+  auto end = std::partition_point(begin, timeline.end(), [&](auto &t) { return std::get<2>(t) == type; });
+  auto it = std::partition_point(begin, end, [&](auto &t) { return (find_end ? std::get<1>(t) : std::get<0>(t)) <= cur_ts; });
+  if (it == end) return std::nullopt;
+  return find_end ? std::get<1>(*it) : std::get<0>(*it);
 }
 
 void Replay::pause(bool pause) {
@@ -203,17 +277,18 @@ void Replay::pause(bool pause) {
 }
 
 void Replay::setCurrentSegment(int n) {
-  if (current_segment_.exchange(n) != n) {
+  const int prev = current_segment_.exchange(n);
+  if (prev != n) {
+    travel_direction_ = n < prev ? -1 : 1;
     QMetaObject::invokeMethod(this, &Replay::queueSegment, Qt::QueuedConnection);
   }
 }
 
-void Replay::segmentLoadFinished(bool success) {
+void Replay::segmentLoadFinished(int n, bool success) {
   if (!success) {
-    Segment *seg = qobject_cast<Segment *>(sender());
-    rWarning("failed to load segment %d, removing it from current replay list", seg->seg_num);
+    rWarning("failed to load segment %d, removing it from current replay list", n);
     updateEvents([&]() {
-      segments_.erase(seg->seg_num);
+      segments_.erase(n);
       return true;
     });
   }
@@ -226,12 +301,31 @@ void Replay::queueSegment() {
 
   auto begin = std::prev(cur, std::min<int>(segment_cache_limit / 2, std::distance(segments_.begin(), cur)));
   auto end = std::next(begin, std::min<int>(segment_cache_limit, segments_.size()));
-  // load one segment at a time
-  auto it = std::find_if(cur, end, [](auto &it) { return !it.second || !it.second->isLoaded(); });
-  if (it != end && !it->second) {
-    rDebug("loading segment %d...", it->first);
-    it->second = std::make_unique<Segment>(it->first, route_->at(it->first), flags_);
-    QObject::connect(it->second.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
+
+  // load up to segment_prefetch_ segments at once: the current one first, then the ones in
+  // the direction of travel, then the others. loads that fell out of that set after a seek
+  // are canceled so they don't hold up the segments around the playhead.
+  std::vector<SegmentMap::iterator> pending;
+  for (auto it = begin; it != end; ++it) {
+    if (!it->second || !it->second->isLoaded()) pending.push_back(it);
+  }
+  auto priority = [&](int n) {
+    const int distance = (n - cur->first) * travel_direction_;
+    return distance >= 0 ? distance : segment_cache_limit - distance;
+  };
+  std::sort(pending.begin(), pending.end(), [&](auto &l, auto &r) { return priority(l->first) < priority(r->first); });
+  for (int i = 0; i < pending.size(); ++i) {
+    auto &[n, segment] = *pending[i];
+    if (i < segment_prefetch_ && !segment) {
+      rDebug("loading segment %d...", n);
+      segment = std::make_unique<Segment>(n, route_->at(n), flags_, &segment_pool_);
+      QObject::connect(segment.get(), &Segment::loadFinished, this, [this, seg_num = n](bool success) {
+        segmentLoadFinished(seg_num, success);
+      });
+    } else if (i >= segment_prefetch_ && segment) {
+      rDebug("cancel loading segment %d", n);
+      segment.reset(nullptr);
+    }
   }
 
   mergeSegments(begin, end);
@@ -250,11 +344,9 @@ void Replay::queueSegment() {
 
 void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   std::vector<int> segments_need_merge;
-  size_t new_events_size = 0;
   for (auto it = begin; it != end; ++it) {
     if (it->second && it->second->isLoaded()) {
       segments_need_merge.push_back(it->first);
-      new_events_size += it->second->log->events.size();
     }
   }
 
@@ -265,21 +357,31 @@ void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::
       if (i != segments_need_merge.size() - 1) s += ", ";
     }
     rDebug("merge segments %s", s.c_str());
-    new_events_->clear();
-    new_events_->reserve(new_events_size);
+
+    // only the newly merged segments are filtered, the others are kept as they are
+    std::vector<std::pair<int, std::vector<Event *>>> new_segments;
     for (int n : segments_need_merge) {
-      size_t size = new_events_->size();
+      if (isSegmentMerged(n)) continue;
+
       const auto &events = segments_[n]->log->events;
-      std::copy_if(events.begin(), events.end(), std::back_inserter(*new_events_),
+      auto &filtered = new_segments.emplace_back(n, std::vector<Event *>()).second;
+      filtered.reserve(events.size());
+      std::copy_if(events.begin(), events.end(), std::back_inserter(filtered),
                    [this](auto e) { return e->which < sockets_.size() && sockets_[e->which] != nullptr; });
-      std::inplace_merge(new_events_->begin(), new_events_->begin() + size, new_events_->end(), Event::lessThan());
     }
 
     if (stream_thread_) {
       emit segmentsMerged();
     }
     updateEvents([&]() {
-      events_.swap(new_events_);
+      for (int n : segments_merged_) {
+        if (std::find(segments_need_merge.begin(), segments_need_merge.end(), n) == segments_need_merge.end()) {
+          events_.erase(n);
+        }
+      }
+      for (auto &[n, events] : new_segments) {
+        events_.insert(n, std::move(events));
+      }
       segments_merged_ = segments_need_merge;
       // Do not wake up the stream thread if the current segment has not been merged.
       return isSegmentMerged(current_segment_) || (segments_.count(current_segment_) == 0);
@@ -338,10 +440,55 @@ void Replay::publishMessage(const Event *e) {
     if (ret == -1) {
       rWarning("stop publishing %s due to multiple publishers error", sockets_[e->which]);
       sockets_[e->which] = nullptr;
+      return;
     }
   } else {
     sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], e->event}});
   }
+  ++published_events_;
+}
+
+void Replay::waitForReaders(cereal::Event::Which which) {
+  // a socket without readers never reports them updated, it's checked again on its next message
+  // since a subscriber may come up any time
+  if (!flood_wait_ || !pm->has_readers(sockets_[which]) ||
+      (flood_retry_ts_[which] > 0 && nanos_since_boot() < flood_retry_ts_[which])) {
+    ++flood_unwaited_;
+    return;
+  }
+
+  const uint64_t start_ts = nanos_since_boot();
+  while (!pm->all_readers_updated(sockets_[which]) && !updating_events_) {
+    const uint64_t ts = nanos_since_boot();
+    if (ts - start_ts > FLOOD_READER_TIMEOUT_NS) {
+      rWarning("a reader doesn't keep up with %s, publishing it without waiting for %.0f s",
+               sockets_[which], FLOOD_READER_RETRY_NS / 1e9);
+      flood_retry_ts_[which] = ts + FLOOD_READER_RETRY_NS;
+      ++flood_unwaited_;
+      break;
+    }
+    std::this_thread::yield();
+  }
+}
+
+void Replay::logFloodStats(bool final) {
+  const uint64_t ts = nanos_since_boot();
+  if (final) {
+    const double secs = (ts - flood_start_ts_) / 1e9;
+    rInfo("flood: %lu events, %lu frames in %.1f s. %.0f events/s, %.1f frames/s, %.1fx realtime, %lu events not waited for",
+          published_events_.load(), published_frames_.load(), secs, published_events_ / secs,
+          published_frames_ / secs, (cur_mono_time_ - flood_start_mono_time_) / 1e9 / secs, flood_unwaited_);
+  } else if (ts - flood_stats_ts_ >= FLOOD_STATS_INTERVAL_NS) {
+    const double secs = (ts - flood_stats_ts_) / 1e9;
+    rInfo("flood: %.0f events/s, %.1f frames/s at %.0f s, %lu events not waited for", (published_events_ - flood_stats_events_) / secs,
+          (published_frames_ - flood_stats_frames_) / secs, currentSeconds(), flood_unwaited_ - flood_stats_unwaited_);
+  } else {
+    return;
+  }
+  flood_stats_ts_ = ts;
+  flood_stats_events_ = published_events_;
+  flood_stats_frames_ = published_frames_;
+  flood_stats_unwaited_ = flood_unwaited_;
 }
 
 void Replay::publishFrame(const Event *e) {
@@ -358,13 +505,17 @@ void Replay::publishFrame(const Event *e) {
   if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C && isSegmentMerged(eidx.getSegmentNum())) {
     CameraType cam = cam_types.at(e->which);
     camera_server_->pushFrame(cam, segments_[eidx.getSegmentNum()]->frames[cam].get(), eidx);
+    ++published_frames_;
   }
 }
 
 void Replay::stream() {
   cereal::Event::Which cur_which = cereal::Event::Which::INIT_DATA;
   double prev_replay_speed = speed_;
+  const bool flood = hasFlag(REPLAY_FLAG_FLOOD);
   std::unique_lock lk(stream_lock_);
+  flood_start_ts_ = flood_stats_ts_ = nanos_since_boot();
+  flood_start_mono_time_ = cur_mono_time_;
 
   while (true) {
     stream_cv_.wait(lk, [=]() { return exit_ || (events_updated_ && !paused_); });
@@ -372,8 +523,8 @@ void Replay::stream() {
     if (exit_) break;
 
     Event cur_event(cur_which, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    auto eit = events_.upper_bound(&cur_event);
+    if (eit == events_.end()) {
       rInfo("waiting for events...");
       continue;
     }
@@ -381,35 +532,48 @@ void Replay::stream() {
     uint64_t evt_start_ts = cur_mono_time_;
     uint64_t loop_start_ts = nanos_since_boot();
 
-    for (auto end = events_->end(); !updating_events_ && eit != end; ++eit) {
+    for (auto end = events_.end(); !updating_events_ && eit != end; ++eit) {
       const Event *evt = (*eit);
       cur_which = evt->which;
       cur_mono_time_ = evt->mono_time;
       setCurrentSegment(toSeconds(cur_mono_time_) / 60);
 
       if (sockets_[cur_which] != nullptr) {
-        // keep time
-        long etime = (cur_mono_time_ - evt_start_ts) / speed_;
-        long rtime = nanos_since_boot() - loop_start_ts;
-        long behind_ns = etime - rtime;
-        // if behind_ns is greater than 1 second, it means that an invalid segment is skipped by seeking/replaying
-        if (behind_ns >= 1 * 1e9 || speed_ != prev_replay_speed) {
-          // reset event start times
-          evt_start_ts = cur_mono_time_;
-          loop_start_ts = nanos_since_boot();
-          prev_replay_speed = speed_;
-        } else if (behind_ns > 0) {
-          precise_nano_sleep(behind_ns);
+        if (flood) {
+          // no pacing, each message waits until its subscribers read the previous one
+          if (!evt->frame) {
+            waitForReaders(cur_which);
+          }
+          logFloodStats(false);
+        } else {
+          // keep time
+          long etime = (cur_mono_time_ - evt_start_ts) / speed_;
+          long rtime = nanos_since_boot() - loop_start_ts;
+          long behind_ns = etime - rtime;
+          // if behind_ns is greater than 1 second, it means that an invalid segment is skipped by seeking/replaying
+          if (behind_ns >= 1 * 1e9 || speed_ != prev_replay_speed) {
+            // reset event start times
+            evt_start_ts = cur_mono_time_;
+            loop_start_ts = nanos_since_boot();
+            prev_replay_speed = speed_;
+          } else if (behind_ns > 0) {
+            precise_nano_sleep(behind_ns);
+          }
         }
 
         if (!evt->frame) {
           publishMessage(evt);
         } else if (camera_server_) {
-          if (speed_ > 1.0) {
+          if (flood || speed_ > 1.0) {
             camera_server_->waitForSent();
           }
           publishFrame(evt);
         }
+
+        if (seek_ts_ > 0 && (evt->frame || !camera_server_)) {
+          time_to_first_frame_ = millis_since_boot() - seek_ts_.exchange(0);
+          rInfo("first frame sent %.0f ms after seeking", time_to_first_frame_.load());
+        }
       }
     }
     // wait for frame to be sent before unlock.(frameReader may be deleted after unlock)
@@ -417,11 +581,18 @@ void Replay::stream() {
       camera_server_->waitForSent();
     }
 
-    if (eit == events_->end() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
+    if (eit == events_.end()) {
       int last_segment = segments_.empty() ? 0 : segments_.rbegin()->first;
       if (current_segment_ >= last_segment && isSegmentMerged(last_segment)) {
-        rInfo("reaches the end of route, restart from beginning");
-        QMetaObject::invokeMethod(this, std::bind(&Replay::seekTo, this, 0, false), Qt::QueuedConnection);
+        if (flood) {
+          logFloodStats(true);
+        }
+        if (!hasFlag(REPLAY_FLAG_NO_LOOP)) {
+          rInfo("reaches the end of route, restart from beginning");
+          QMetaObject::invokeMethod(this, std::bind(&Replay::seekTo, this, 0, false), Qt::QueuedConnection);
+        } else {
+          emit streamFinished();
+        }
       }
     }
   }
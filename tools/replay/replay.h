@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <optional>
@@ -12,12 +13,20 @@
 #include <QThread>
 
 #include "tools/replay/camera.h"
+#include "tools/replay/logindex.h"
 #include "tools/replay/route.h"
 
 const QString DEMO_ROUTE = "a2a0ccea32023010|2023-07-27--13-01-19";
 
 // one segment uses about 100M of memory
 constexpr int MIN_SEGMENTS_CACHE = 5;
+// segments loaded at the same time
+constexpr int DEFAULT_SEGMENT_PREFETCH = 2;
+// in flood mode, a socket whose readers don't catch up within this is published without waiting
+constexpr uint64_t FLOOD_READER_TIMEOUT_NS = 100 * 1e6;
+// and isn't waited on again for this long
+constexpr uint64_t FLOOD_READER_RETRY_NS = 1 * 1e9;
+constexpr uint64_t FLOOD_STATS_INTERVAL_NS = 10 * 1e9;
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -29,6 +38,7 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_NO_HW_DECODER = 0x0100,
   REPLAY_FLAG_NO_VIPC = 0x0400,
   REPLAY_FLAG_ALL_SERVICES = 0x0800,
+  REPLAY_FLAG_FLOOD = 0x1000,
 };
 
 enum class FindFlag {
@@ -42,6 +52,51 @@ enum class FindFlag {
 
 enum class TimelineType { None, Engaged, AlertInfo, AlertWarning, AlertCritical, UserFlag };
 typedef bool (*replayEventFilter)(const Event *, void *);
+
+// The events of the merged segments, a sorted array per segment. Merging or evicting a
+// segment only touches its own events. Segments overlap a little at their boundaries,
+// the iterator merges the arrays as it goes.
+class MergedEvents {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Event *;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Event *const *;
+    using reference = Event *const &;
+
+    inline reference operator*() const { return *cur_; }
+    inline bool operator==(const iterator &other) const { return cur_ == other.cur_; }
+    inline bool operator!=(const iterator &other) const { return cur_ != other.cur_; }
+    iterator &operator++();
+    inline iterator operator++(int) {
+      iterator it = *this;
+      ++*this;
+      return it;
+    }
+
+  private:
+    friend class MergedEvents;
+    void findNext();
+    std::vector<std::pair<Event *const *, Event *const *>> ranges_;  // what's left of each segment
+    Event *const *cur_ = nullptr;  // nullptr at the end
+    size_t cur_range_ = 0;
+  };
+
+  // the first event after e
+  iterator upper_bound(const Event *e) const;
+  inline iterator begin() const { return upper_bound(nullptr); }
+  inline iterator end() const { return iterator(); }
+  bool empty() const;
+  size_t size() const;
+  const Event *back() const;
+  inline void insert(int n, std::vector<Event *> &&events) { segments_[n] = std::move(events); }
+  inline void erase(int n) { segments_.erase(n); }
+
+private:
+  std::map<int, std::vector<Event *>> segments_;
+};
 Q_DECLARE_METATYPE(std::shared_ptr<LogReader>);
 
 class Replay : public QObject {
@@ -67,6 +122,14 @@ public:
   }
   inline int segmentCacheLimit() const { return segment_cache_limit; }
   inline void setSegmentCacheLimit(int n) { segment_cache_limit = std::max(MIN_SEGMENTS_CACHE, n); }
+  inline int segmentPrefetch() const { return segment_prefetch_; }
+  void setSegmentPrefetch(int n);
+  // milliseconds from the last seek until its first frame was sent, -1 if it wasn't yet
+  inline double timeToFirstFrame() const { return time_to_first_frame_; }
+  inline uint64_t publishedEvents() const { return published_events_; }
+  inline uint64_t publishedFrames() const { return published_frames_; }
+  // the frames sent since the last call, call it from the main thread
+  inline CameraServer::Stats takeFrameStats() { return camera_server_ ? camera_server_->takeStats() : CameraServer::Stats{}; }
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   inline void addFlag(REPLAY_FLAGS flag) { flags_ |= flag; }
   inline void removeFlag(REPLAY_FLAGS flag) { flags_ &= ~flag; }
@@ -78,7 +141,7 @@ public:
   inline int totalSeconds() const { return (!segments_.empty()) ? (segments_.rbegin()->first + 1) * 60 : 0; }
   inline void setSpeed(float speed) { speed_ = speed; }
   inline float getSpeed() const { return speed_; }
-  inline const std::vector<Event *> *events() const { return events_.get(); }
+  inline const MergedEvents *events() const { return &events_; }
   inline const std::map<int, std::unique_ptr<Segment>> &segments() const { return segments_; }
   inline const std::string &carFingerprint() const { return car_fingerprint_; }
   inline const std::vector<std::tuple<double, double, TimelineType>> getTimeline() {
@@ -90,10 +153,10 @@ signals:
   void streamStarted();
   void segmentsMerged();
   void seekedTo(double sec);
-  void qLogLoaded(int segnum, std::shared_ptr<LogReader> qlog);
+  void streamFinished();
 
 protected slots:
-  void segmentLoadFinished(bool success);
+  void segmentLoadFinished(int n, bool success);
 
 protected:
   typedef std::map<int, std::unique_ptr<Segment>> SegmentMap;
@@ -106,6 +169,8 @@ protected:
   void updateEvents(const std::function<bool()>& lambda);
   void publishMessage(const Event *e);
   void publishFrame(const Event *e);
+  void waitForReaders(cereal::Event::Which which);
+  void logFloodStats(bool final);
   void buildTimeline();
   inline bool isSegmentMerged(int n) {
     return std::find(segments_merged_.begin(), segments_merged_.end(), n) != segments_merged_.end();
@@ -116,15 +181,26 @@ protected:
   std::condition_variable stream_cv_;
   std::atomic<bool> updating_events_ = false;
   std::atomic<int> current_segment_ = 0;
+  std::atomic<int> travel_direction_ = 1;  // 1 forward, -1 backward
   SegmentMap segments_;
+  QThreadPool segment_pool_;
+  int segment_prefetch_ = DEFAULT_SEGMENT_PREFETCH;
+  std::atomic<double> seek_ts_ = 0;  // time of the seek whose first frame wasn't sent yet
+  std::atomic<double> time_to_first_frame_ = -1;
+  std::atomic<uint64_t> published_events_ = 0;
+  std::atomic<uint64_t> published_frames_ = 0;
+  bool flood_wait_ = false;  // ZMQ and SubMaster output can't tell when the readers are done
+  std::vector<uint64_t> flood_retry_ts_;  // sockets whose readers timed out aren't waited on until then
+  uint64_t flood_unwaited_ = 0;  // messages published without waiting for their readers
+  uint64_t flood_start_ts_ = 0, flood_stats_ts_ = 0, flood_start_mono_time_ = 0;
+  uint64_t flood_stats_events_ = 0, flood_stats_frames_ = 0, flood_stats_unwaited_ = 0;
   // the following variables must be protected with stream_lock_
   std::atomic<bool> exit_ = false;
   bool paused_ = false;
   bool events_updated_ = false;
   uint64_t route_start_ts_ = 0;
   std::atomic<uint64_t> cur_mono_time_ = 0;
-  std::unique_ptr<std::vector<Event *>> events_;
-  std::unique_ptr<std::vector<Event *>> new_events_;
+  MergedEvents events_;
   std::vector<int> segments_merged_;
 
   // messaging
@@ -6,6 +6,7 @@
 
 #include <QDateTime>
 #include <QFutureSynchronizer>
+#include <QThreadPool>
 
 #include "tools/replay/framereader.h"
 #include "tools/replay/logreader.h"
@@ -54,7 +55,7 @@ class Segment : public QObject {
   Q_OBJECT
 
 public:
-  Segment(int n, const SegmentFile &files, uint32_t flags);
+  Segment(int n, const SegmentFile &files, uint32_t flags, QThreadPool *pool = QThreadPool::globalInstance());
   ~Segment();
   inline bool isLoaded() const { return !loading_ && !abort_; }
 
@@ -1,11 +1,28 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <zstd.h>
+
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
 #include <thread>
 
 #include <QDebug>
 #include <QEventLoop>
 
 #include "catch2/catch.hpp"
+#include "common/timing.h"
 #include "common/util.h"
+#include "tools/replay/filereader.h"
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
 
@@ -58,6 +75,206 @@ TEST_CASE("FileReader") {
   }
 }
 
+// Serves one file over plain http on localhost: HEAD and range GETs, a connection per request.
+class TestHttpServer {
+public:
+  TestHttpServer(const std::string &content) : content_(content) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    socklen_t len = sizeof(addr);
+    REQUIRE(bind(fd_, (sockaddr *)&addr, len) == 0);
+    REQUIRE(listen(fd_, 64) == 0);
+    REQUIRE(getsockname(fd_, (sockaddr *)&addr, &len) == 0);
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&TestHttpServer::serve, this);
+  }
+  ~TestHttpServer() {
+    exit_ = true;
+    thread_.join();
+    close(fd_);
+  }
+  std::string url(const std::string &name) const {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/" + name;
+  }
+
+  std::atomic<int> range_requests = 0;
+  // range requests served before the rest get their connection closed, -1 for all
+  std::atomic<int> fail_after = -1;
+
+private:
+  void serve() {
+    while (!exit_) {
+      pollfd pfd = {.fd = fd_, .events = POLLIN};
+      if (poll(&pfd, 1, 100) <= 0) continue;
+
+      int conn = accept(fd_, nullptr, nullptr);
+      if (conn < 0) continue;
+
+      std::string request;
+      char buf[4096];
+      ssize_t n;
+      while (request.find("\r\n\r\n") == std::string::npos && (n = recv(conn, buf, sizeof(buf), 0)) > 0) {
+        request.append(buf, n);
+      }
+      respond(conn, request);
+      close(conn);
+    }
+  }
+
+  void respond(int conn, const std::string &request) {
+    std::string header = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(content_.size()) + "\r\nConnection: close\r\n\r\n";
+    if (request.find("HEAD ") == 0) {
+      send(conn, header.data(), header.size(), MSG_NOSIGNAL);
+      return;
+    }
+
+    size_t begin = 0, end = 0;
+    const size_t pos = request.find("Range: bytes=");
+    if (pos == std::string::npos || sscanf(request.c_str() + pos, "Range: bytes=%zu-%zu", &begin, &end) != 2 ||
+        begin > end || end >= content_.size()) {
+      header = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      send(conn, header.data(), header.size(), MSG_NOSIGNAL);
+      return;
+    }
+    if (fail_after >= 0 && range_requests >= fail_after) return;
+
+    ++range_requests;
+    header = util::string_format("HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %zu-%zu/%zu\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", begin, end, content_.size(), end - begin + 1);
+    std::string response = header + content_.substr(begin, end - begin + 1);
+    for (size_t sent = 0; sent < response.size();) {
+      ssize_t n = send(conn, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+  }
+
+  const std::string content_;
+  int fd_;
+  int port_;
+  std::atomic<bool> exit_ = false;
+  std::thread thread_;
+};
+
+std::string random_content(size_t size) {
+  std::string content(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    content[i] = (char)(rand() & 0xff);
+  }
+  return content;
+}
+
+TEST_CASE("httpGet local server") {
+  const std::string content = random_content(10 * 1024 * 1024 + 123);
+  TestHttpServer server(content);
+
+  const size_t chunk_size = GENERATE(0, 1024 * 1024);
+  REQUIRE(getRemoteFileSize(server.url("file")) == content.size());
+  REQUIRE(httpGet(server.url("file"), chunk_size) == content);
+  REQUIRE(server.range_requests == (chunk_size ? 11 : 1));
+}
+
+TEST_CASE("FileReader download cache") {
+  const std::string content = random_content(3 * CACHE_RANGE_SIZE + 123);
+  const int num_ranges = 4;
+  TestHttpServer server(content);
+  const std::string url = server.url("rlog.zst?sig=" + std::to_string(rand()));
+  const std::string cache_file = cacheFilePath(url);
+  for (auto ext : {"", ".part", ".ranges"}) {
+    std::remove((cache_file + ext).c_str());
+  }
+
+  SECTION("download") {
+    REQUIRE(FileReader(true, 0, 0).read(url) == content);
+    REQUIRE(server.range_requests == num_ranges);
+  }
+  SECTION("resume") {
+    // the download stops after two ranges, the next one only gets the ranges that are missing
+    server.fail_after = 2;
+    REQUIRE(FileReader(true, 0, 0).read(url).empty());
+    REQUIRE(util::file_exists(cache_file + ".part"));
+    const std::string ranges = util::read_file(cache_file + ".ranges");
+    REQUIRE(ranges.size() == 2 * sizeof(uint64_t) + num_ranges);
+    const int done = std::count(ranges.begin() + 2 * sizeof(uint64_t), ranges.end(), 1);
+    REQUIRE(done < num_ranges);
+
+    server.fail_after = -1;
+    server.range_requests = 0;
+    REQUIRE(FileReader(true, 0, 0).read(url) == content);
+    REQUIRE(server.range_requests == num_ranges - done);
+  }
+
+  // complete files only, read from the cache from now on
+  REQUIRE(util::read_file(cache_file) == content);
+  REQUIRE_FALSE(util::file_exists(cache_file + ".part"));
+  REQUIRE_FALSE(util::file_exists(cache_file + ".ranges"));
+  server.range_requests = 0;
+  REQUIRE(FileReader(true, 0, 0).read(url) == content);
+  REQUIRE(server.range_requests == 0);
+  std::remove(cache_file.c_str());
+}
+
+TEST_CASE("evictCacheFiles") {
+  char dir[] = "/tmp/test_cache_XXXXXX";
+  REQUIRE(mkdtemp(dir));
+  auto create = [&](const std::string &name, time_t mtime) {
+    const std::string path = std::string(dir) + "/" + name;
+    std::ofstream(path) << std::string(100, 'x');
+    timeval times[2] = {{mtime, 0}, {mtime, 0}};
+    utimes(path.c_str(), times);
+    return path;
+  };
+  const std::string oldest = create("a", 1000), older = create("b", 2000), newest = create("c", 3000);
+  const time_t now = time(nullptr);
+  const std::string part = create("d.part", now), ranges = create("d.ranges", now);
+  const std::string abandoned_part = create("e.part", 0), abandoned_ranges = create("e.ranges", 0);
+  const std::string locked_part = create("f.part", 0), locked_ranges = create("f.ranges", 0);
+  // an old partial file is still being downloaded as long as it's locked
+  int fd = open(locked_part.c_str(), O_RDWR);
+  REQUIRE(flock(fd, LOCK_EX) == 0);
+
+  // the least recently used go first, recent or locked partial downloads stay
+  evictCacheFiles(dir, 250);
+  REQUIRE_FALSE(util::file_exists(oldest));
+  REQUIRE(util::file_exists(older));
+  REQUIRE(util::file_exists(newest));
+  REQUIRE(util::file_exists(part));
+  REQUIRE(util::file_exists(ranges));
+  REQUIRE_FALSE(util::file_exists(abandoned_part));
+  REQUIRE_FALSE(util::file_exists(abandoned_ranges));
+  REQUIRE(util::file_exists(locked_part));
+  REQUIRE(util::file_exists(locked_ranges));
+
+  close(fd);
+  evictCacheFiles(dir, 0);
+  REQUIRE_FALSE(util::file_exists(older));
+  REQUIRE_FALSE(util::file_exists(newest));
+  REQUIRE(util::file_exists(part));
+  REQUIRE_FALSE(util::file_exists(locked_part));
+  REQUIRE_FALSE(util::file_exists(locked_ranges));
+  system((std::string("rm -rf ") + dir).c_str());
+}
+
+// Compresses the log like loggerd does: independent zstd frames and the seekable format's seek table.
+std::string compress_zstd_seekable(const std::string &log, size_t frame_size = 1024 * 1024) {
+  std::string out;
+  std::vector<uint32_t> table = {0x184D2A5E, 0};
+  for (size_t pos = 0; pos < log.size(); pos += frame_size) {
+    const size_t size = std::min(frame_size, log.size() - pos);
+    std::string frame(ZSTD_compressBound(size), '\0');
+    const size_t compressed_size = ZSTD_compress(frame.data(), frame.size(), log.data() + pos, size, 3);
+    REQUIRE(!ZSTD_isError(compressed_size));
+    out.append(frame.data(), compressed_size);
+    table.insert(table.end(), {(uint32_t)compressed_size, (uint32_t)size});
+  }
+  const uint32_t num_frames = (table.size() - 2) / 2;
+  table[1] = num_frames * 8 + 9;
+  table.push_back(num_frames);
+  out.append((const char *)table.data(), table.size() * sizeof(uint32_t));
+  out.append("\0\xb1\xea\x92\x8f", 5);  // no checksums, seekable magic
+  return out;
+}
+
 TEST_CASE("LogReader") {
   SECTION("corrupt log") {
     FileReader reader(true);
@@ -68,6 +285,134 @@ TEST_CASE("LogReader") {
     REQUIRE(log.load((std::byte *)corrupt_content.data(), corrupt_content.size()));
     REQUIRE(log.events.size() > 0);
   }
+  SECTION("stream bz2 log") {
+    FileReader reader(true);
+    std::string content = reader.read(TEST_RLOG_URL);
+    const std::string decompressed = decompressBZ2(content);
+
+    // decompressed block by block, the events add up to the whole log
+    LogStream stream;
+    REQUIRE(stream.openData(std::move(content)));
+    kj::ArrayPtr<const capnp::word> words;
+    size_t offset = 0;
+    while (stream.next(words)) {
+      auto bytes = words.asBytes();
+      REQUIRE(offset + bytes.size() <= decompressed.size());
+      REQUIRE(memcmp(bytes.begin(), decompressed.data() + offset, bytes.size()) == 0);
+      offset += bytes.size();
+    }
+    REQUIRE(offset == decompressed.size());
+  }
+  SECTION("zstd log") {
+    FileReader reader(true);
+    const std::string decompressed = decompressBZ2(reader.read(TEST_RLOG_URL));
+    const std::string zstd_file = "/tmp/test_replay_rlog.zst";
+    std::ofstream(zstd_file, std::ios::binary) << compress_zstd_seekable(decompressed);
+
+    // streamed frame by frame
+    LogStream stream;
+    REQUIRE(stream.openFile(zstd_file));
+    kj::ArrayPtr<const capnp::word> words;
+    size_t offset = 0;
+    while (stream.next(words)) {
+      auto bytes = words.asBytes();
+      REQUIRE(offset + bytes.size() <= decompressed.size());
+      REQUIRE(memcmp(bytes.begin(), decompressed.data() + offset, bytes.size()) == 0);
+      offset += bytes.size();
+    }
+    REQUIRE(offset == decompressed.size());
+
+    // decompressed frame-parallel by LogReader
+    LogReader log, raw_log;
+    REQUIRE(log.load(zstd_file));
+    REQUIRE(raw_log.load((std::byte *)decompressed.data(), decompressed.size()));
+    REQUIRE(log.events.size() == raw_log.events.size());
+    for (size_t i = 0; i < log.events.size(); ++i) {
+      REQUIRE(log.events[i]->bytes() == raw_log.events[i]->bytes());
+    }
+    std::remove(zstd_file.c_str());
+  }
+}
+
+// run with: tests/test_replay "[benchmark]"
+TEST_CASE("LogReader bz2 vs zstd", "[.][benchmark]") {
+  FileReader reader(true);
+  const std::string bz2_file = cacheFilePath(TEST_RLOG_URL);
+  const std::string zstd_file = "/tmp/benchmark_rlog.zst";
+  const std::string bz2_content = reader.read(TEST_RLOG_URL);
+  const std::string decompressed = decompressBZ2(bz2_content);
+  const std::string zstd_content = compress_zstd_seekable(decompressed);
+  std::ofstream(zstd_file, std::ios::binary) << zstd_content;
+
+  auto cpu_ms = []() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+  };
+  for (auto &[name, file, size] : {std::tuple{"bz2", bz2_file, bz2_content.size()},
+                                   std::tuple{"zstd", zstd_file, zstd_content.size()}}) {
+    const int iterations = 5;
+    size_t events = 0;
+    const double cpu_start = cpu_ms();
+    const double start = millis_since_boot();
+    for (int i = 0; i < iterations; ++i) {
+      LogReader log;
+      REQUIRE(log.load(file));
+      events = log.events.size();
+    }
+    const double wall = (millis_since_boot() - start) / iterations;
+    const double cpu = (cpu_ms() - cpu_start) / iterations;
+    printf("%-4s %5.1f MB, %zu events: load %7.1f ms, cpu %7.1f ms\n", name, size / 1e6, events, wall, cpu);
+  }
+  std::remove(zstd_file.c_str());
+}
+
+TEST_CASE("LogIndex") {
+  FileReader reader(true);
+  const std::string decompressed = decompressBZ2(reader.read(TEST_RLOG_URL));
+  const std::string log_file = "/tmp/test_replay_rlog";
+  std::ofstream(log_file, std::ios::binary) << decompressed;
+  std::remove((cacheFilePath(log_file) + ".idx").c_str());
+
+  // built from the log, then read from the cache
+  LogIndex built, cached;
+  REQUIRE(built.load(log_file, nullptr, true));
+  REQUIRE(util::file_exists(cacheFilePath(log_file) + ".idx"));
+  REQUIRE(cached.load(log_file, nullptr, true));
+
+  for (const LogIndex *index : {&built, &cached}) {
+    LogReader log;
+    REQUIRE(log.load((std::byte *)decompressed.data(), decompressed.size()));
+    uint64_t start_mono_time = UINT64_MAX, end_mono_time = 0;
+    size_t num_user_flags = 0;
+    std::vector<std::tuple<bool, std::string, int>> states;
+    for (const Event *e : log.events) {
+      if (e->frame) continue;
+      start_mono_time = std::min(start_mono_time, e->mono_time);
+      end_mono_time = std::max(end_mono_time, e->mono_time);
+      num_user_flags += e->which == cereal::Event::USER_FLAG;
+      if (e->which == cereal::Event::CONTROLS_STATE) {
+        auto cs = e->event.getControlsState();
+        std::tuple state{cs.getEnabled(), std::string(cs.getAlertType().cStr()), (int)cs.getAlertStatus()};
+        if (states.empty() || states.back() != state) states.push_back(state);
+      }
+    }
+    REQUIRE(index->start_mono_time >= start_mono_time);
+    REQUIRE(index->end_mono_time == end_mono_time);
+    REQUIRE(index->user_flags.size() == num_user_flags);
+    REQUIRE(index->controls_states.size() == states.size());
+    for (size_t i = 0; i < states.size(); ++i) {
+      const auto &cs = index->controls_states[i];
+      REQUIRE(states[i] == std::tuple{cs.enabled, cs.alert_type, (int)cs.alert_status});
+    }
+  }
+
+  // the index is rebuilt when the log changes
+  std::ofstream(log_file, std::ios::binary) << decompressed.substr(0, decompressed.size() / 2);
+  LogIndex changed;
+  REQUIRE(changed.load(log_file, nullptr, true));
+  REQUIRE(changed.end_mono_time < built.end_mono_time);
+  std::remove(log_file.c_str());
 }
 
 void read_segment(int n, const SegmentFile &segment_file, uint32_t flags) {
@@ -107,6 +452,47 @@ void read_segment(int n, const SegmentFile &segment_file, uint32_t flags) {
   loop.exec();
 }
 
+TEST_CASE("FrameReader") {
+  Route route(DEMO_ROUTE);
+  REQUIRE(route.load());
+  const std::string url = route.at(0).qcamera.toStdString();
+
+  auto read_frames = [](FrameReader &fr, const std::vector<int> &order) {
+    VisionBuf buf;
+    buf.allocate(fr.getYUVSize());
+    buf.init_yuv(fr.width, fr.height, fr.width, fr.width * fr.height);
+    std::vector<std::vector<uint8_t>> frames(fr.getFrameCount());
+    for (int idx : order) {
+      REQUIRE(fr.get(idx, &buf));
+      frames[idx].assign((uint8_t *)buf.addr, (uint8_t *)buf.addr + fr.getYUVSize());
+    }
+    buf.free();
+    return frames;
+  };
+
+  // decoded in order with nothing cached, the decoder just keeps going
+  FrameReader::setCacheSize(0);
+  FrameReader sequential;
+  REQUIRE(sequential.load(url, true));
+  const int count = std::min<int>(sequential.getFrameCount(), 300);
+  std::vector<int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  const auto expected = read_frames(sequential, order);
+
+  // a cache smaller than a frame disables caching and the look-ahead
+  const size_t cache_frames = GENERATE(0, 1, 16, 1000);
+  FrameReader::setCacheSize(cache_frames * sequential.getYUVSize());
+  FrameReader fr;
+  REQUIRE(fr.load(url, true));
+  std::shuffle(order.begin(), order.end(), std::mt19937(cache_frames));
+  const auto frames = read_frames(fr, order);
+  for (int i = 0; i < count; ++i) {
+    INFO("cache frames " << cache_frames << " frame " << i);
+    REQUIRE(frames[i] == expected[i]);
+  }
+  FrameReader::setCacheSize(DEFAULT_FRAME_CACHE_SIZE);
+}
+
 TEST_CASE("Route") {
   // Create a local route from remote for testing
   Route remote_route(DEMO_ROUTE);
@@ -144,11 +530,51 @@ TEST_CASE("Route") {
   };
 }
 
+TEST_CASE("MergedEvents") {
+  // three segments, the middle one overlaps both neighbours
+  std::vector<std::unique_ptr<Event>> storage;
+  auto make_events = [&](std::vector<uint64_t> times) {
+    std::vector<Event *> events;
+    for (uint64_t t : times) {
+      events.push_back(storage.emplace_back(new Event(cereal::Event::Which::CAN, t)).get());
+    }
+    return events;
+  };
+  MergedEvents merged;
+  REQUIRE(merged.empty());
+  REQUIRE(merged.begin() == merged.end());
+  merged.insert(0, make_events({1, 2, 3, 10}));
+  merged.insert(2, make_events({20, 21, 30}));
+  merged.insert(1, make_events({4, 10, 11, 20, 25}));
+
+  auto mono_times = [](auto begin, auto end) {
+    std::vector<uint64_t> times;
+    for (auto it = begin; it != end; ++it) times.push_back((*it)->mono_time);
+    return times;
+  };
+  REQUIRE(merged.size() == 12);
+  REQUIRE(merged.back()->mono_time == 30);
+  REQUIRE(mono_times(merged.begin(), merged.end()) == std::vector<uint64_t>{1, 2, 3, 4, 10, 10, 11, 20, 20, 21, 25, 30});
+  REQUIRE(std::is_sorted(merged.begin(), merged.end(), Event::lessThan()));
+
+  Event ten(cereal::Event::Which::CAN, 10);
+  REQUIRE(mono_times(merged.upper_bound(&ten), merged.end()) == std::vector<uint64_t>{11, 20, 20, 21, 25, 30});
+
+  // evicting a segment leaves the others as they are
+  merged.erase(1);
+  REQUIRE(mono_times(merged.begin(), merged.end()) == std::vector<uint64_t>{1, 2, 3, 10, 20, 21, 30});
+  merged.erase(0);
+  merged.erase(2);
+  REQUIRE(merged.empty());
+  REQUIRE(merged.back() == nullptr);
+}
+
 // helper class for unit tests
 class TestReplay : public Replay {
  public:
   TestReplay(const QString &route, uint8_t flags = REPLAY_FLAG_NO_FILE_CACHE) : Replay(route, {}, {}, {}, nullptr, flags) {}
   void test_seek();
+  void test_prefetch();
   void testSeekTo(int seek_to);
 };
 
@@ -165,13 +591,13 @@ void TestReplay::testSeekTo(int seek_to) {
     }
 
     Event cur_event(cereal::Event::Which::INIT_DATA, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    auto eit = events_.upper_bound(&cur_event);
+    if (eit == events_.end()) {
       qDebug() << "waiting for events...";
       continue;
     }
 
-    REQUIRE(std::is_sorted(events_->begin(), events_->end(), Event::lessThan()));
+    REQUIRE(std::is_sorted(events_.begin(), events_.end(), Event::lessThan()));
     const int seek_to_segment = seek_to / 60;
     const int event_seconds = ((*eit)->mono_time - route_start_ts_) / 1e9;
     current_segment_ = event_seconds / 60;
@@ -199,8 +625,37 @@ void TestReplay::test_seek() {
   thread.join();
 }
 
+void TestReplay::test_prefetch() {
+  auto loading_segments = [this]() {
+    std::vector<int> segments;
+    for (auto &[n, segment] : segments_) {
+      if (segment) segments.push_back(n);
+    }
+    return segments;
+  };
+
+  // the segment under the playhead first, then in the direction of travel
+  setSegmentPrefetch(3);
+  current_segment_ = 5;
+  travel_direction_ = -1;
+  queueSegment();
+  REQUIRE(loading_segments() == std::vector<int>{3, 4, 5});
+
+  // seeking cancels the loads that aren't around the playhead anymore
+  current_segment_ = 8;
+  travel_direction_ = 1;
+  queueSegment();
+  REQUIRE(loading_segments() == std::vector<int>{8, 9, 10});
+}
+
 TEST_CASE("Replay") {
   TestReplay replay(DEMO_ROUTE);
   REQUIRE(replay.load());
   replay.test_seek();
 }
+
+TEST_CASE("Replay prefetch") {
+  TestReplay replay(DEMO_ROUTE);
+  REQUIRE(replay.load());
+  replay.test_prefetch();
+}
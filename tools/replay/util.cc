@@ -4,11 +4,15 @@
 #include <curl/curl.h>
 #include <openssl/sha.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <condition_variable>
 #include <cstdarg>
 #include <cstring>
 #include <cassert>
 #include <cmath>
-#include <fstream>
 #include <iostream>
 #include <map>
 #include <mutex>
@@ -58,34 +62,76 @@ struct CURLGlobalInitializer {
 
 static CURLGlobalInitializer curl_initializer;
 
-template <class T>
-struct MultiPartWriter {
-  T *buf;
-  size_t *total_written;
-  size_t offset;
-  size_t end;
+// Connections, DNS lookups and TLS sessions are shared by all downloads.
+struct CurlShare {
+  CurlShare() {
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  }
+  ~CurlShare() { curl_share_cleanup(share); }
+
+  static void lock(CURL *, curl_lock_data data, curl_lock_access, void *userp) {
+    ((CurlShare *)userp)->locks[data].lock();
+  }
+  static void unlock(CURL *, curl_lock_data data, void *userp) {
+    ((CurlShare *)userp)->locks[data].unlock();
+  }
+
+  CURLSH *share;
+  std::mutex locks[CURL_LOCK_DATA_LAST];
+};
 
-  size_t write(char *data, size_t size, size_t count) {
-    size_t bytes = size * count;
-    if ((offset + bytes) > end) return 0;
+static CurlShare curl_share;
 
-    if constexpr (std::is_same<T, std::string>::value) {
-      memcpy(buf->data() + offset, data, bytes);
-    } else if constexpr (std::is_same<T, std::ofstream>::value) {
-      buf->seekp(offset);
-      buf->write(data, bytes);
+// Limits the ranges downloaded at once over all downloads.
+struct ConnectionPool {
+  // waits for a free connection only if block is set, a download with nothing running must wait
+  bool acquire(bool block, std::atomic<bool> *abort) {
+    std::unique_lock lk(lock);
+    while (used >= MAX_HTTP_CONNECTIONS) {
+      if (!block || (abort && *abort)) return false;
+      cv.wait_for(lk, std::chrono::milliseconds(100));
     }
+    ++used;
+    return true;
+  }
 
-    offset += bytes;
-    *total_written += bytes;
-    return bytes;
+  void release() {
+    {
+      std::lock_guard lk(lock);
+      --used;
+    }
+    cv.notify_one();
   }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  int used = 0;
+};
+
+static ConnectionPool connection_pool;
+
+struct RangeWriter {
+  char *dst;
+  size_t offset;
+  size_t end;
+  size_t *total_written;
 };
 
-template <class T>
 size_t write_cb(char *data, size_t size, size_t count, void *userp) {
-  auto w = (MultiPartWriter<T> *)userp;
-  return w->write(data, size, count);
+  auto w = (RangeWriter *)userp;
+  size_t bytes = size * count;
+  if ((w->offset + bytes) > w->end) return 0;
+
+  memcpy(w->dst + w->offset, data, bytes);
+  w->offset += bytes;
+  *w->total_written += bytes;
+  return bytes;
 }
 
 size_t dumy_write_cb(char *data, size_t size, size_t count, void *userp) { return size * count; }
@@ -148,6 +194,7 @@ size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort) {
   CURL *curl = curl_easy_init();
   if (!curl) return -1;
 
+  curl_easy_setopt(curl, CURLOPT_SHARE, curl_share.share);
   curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dumy_write_cb);
   curl_easy_setopt(curl, CURLOPT_HEADER, 1);
@@ -174,75 +221,93 @@ std::string getUrlWithoutQuery(const std::string &url) {
   return (idx == std::string::npos ? url : url.substr(0, idx));
 }
 
-template <class T>
-bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t content_length, std::atomic<bool> *abort) {
-  download_stats.add(url, content_length);
+bool isRemoteUrl(const std::string &url) {
+  return url.find("https://") == 0 || url.find("http://") == 0;
+}
 
-  int parts = 1;
-  if (chunk_size > 0 && content_length > 10 * 1024 * 1024) {
-    parts = std::nearbyint(content_length / (float)chunk_size);
-    parts = std::clamp(parts, 1, 5);
+std::vector<std::pair<size_t, size_t>> splitRanges(size_t size, size_t chunk_size) {
+  std::vector<std::pair<size_t, size_t>> ranges;
+  const size_t step = chunk_size > 0 ? chunk_size : size;
+  for (size_t begin = 0; begin < size; begin += step) {
+    ranges.push_back({begin, std::min(begin + step, size)});
   }
+  return ranges;
+}
+
+bool httpDownloadRanges(const std::string &url, char *dst, const std::vector<std::pair<size_t, size_t>> &ranges,
+                        const std::function<void(size_t)> &range_done, std::atomic<bool> *abort) {
+  const size_t total = std::accumulate(ranges.begin(), ranges.end(), (size_t)0,
+                                       [](size_t sum, auto &r) { return sum + r.second - r.first; });
+  download_stats.add(url, total);
 
   CURLM *cm = curl_multi_init();
   size_t written = 0;
-  std::map<CURL *, MultiPartWriter<T>> writers;
-  const int part_size = content_length / parts;
-  for (int i = 0; i < parts; ++i) {
-    CURL *eh = curl_easy_init();
-    writers[eh] = {
-        .buf = &buf,
-        .total_written = &written,
-        .offset = (size_t)(i * part_size),
-        .end = i == parts - 1 ? content_length : (i + 1) * part_size,
-    };
-    curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb<T>);
-    curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void *)(&writers[eh]));
-    curl_easy_setopt(eh, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(eh, CURLOPT_RANGE, util::string_format("%d-%d", writers[eh].offset, writers[eh].end - 1).c_str());
-    curl_easy_setopt(eh, CURLOPT_HTTPGET, 1);
-    curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt(eh, CURLOPT_FOLLOWLOCATION, 1);
-
-    curl_multi_add_handle(cm, eh);
-  }
+  std::vector<RangeWriter> writers(ranges.size());
+  std::map<CURL *, size_t> running;  // handle -> range
+  size_t next = 0, complete = 0;
+  bool failed = false;
+  while (!failed && complete < ranges.size() && !(abort && *abort)) {
+    // start as many ranges as there are free connections
+    while (next < ranges.size() && connection_pool.acquire(running.empty(), abort)) {
+      auto [begin, end] = ranges[next];
+      writers[next] = {.dst = dst, .offset = begin, .end = end, .total_written = &written};
+      CURL *eh = curl_easy_init();
+      curl_easy_setopt(eh, CURLOPT_SHARE, curl_share.share);
+      curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb);
+      curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void *)(&writers[next]));
+      curl_easy_setopt(eh, CURLOPT_URL, url.c_str());
+      curl_easy_setopt(eh, CURLOPT_RANGE, util::string_format("%zu-%zu", begin, end - 1).c_str());
+      curl_easy_setopt(eh, CURLOPT_HTTPGET, 1);
+      curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1);
+      curl_easy_setopt(eh, CURLOPT_FOLLOWLOCATION, 1);
+      curl_multi_add_handle(cm, eh);
+      running[eh] = next++;
+    }
+    if (running.empty()) continue;
 
-  int still_running = 1;
-  while (still_running > 0 && !(abort && *abort)) {
-    curl_multi_wait(cm, nullptr, 0, 1000, nullptr);
+    int still_running = 0;
     curl_multi_perform(cm, &still_running);
-    download_stats.update(url, written);
-  }
 
-  CURLMsg *msg;
-  int msgs_left = -1;
-  int complete = 0;
-  while ((msg = curl_multi_info_read(cm, &msgs_left)) && !(abort && *abort)) {
-    if (msg->msg == CURLMSG_DONE) {
-      if (msg->data.result == CURLE_OK) {
-        long res_status = 0;
-        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &res_status);
-        if (res_status == 206) {
-          complete++;
-        } else {
-          rWarning("Download failed: http error code: %d", res_status);
-        }
+    CURLMsg *msg;
+    int msgs_left = -1;
+    while ((msg = curl_multi_info_read(cm, &msgs_left))) {
+      if (msg->msg != CURLMSG_DONE) continue;
+
+      CURL *eh = msg->easy_handle;
+      const size_t i = running[eh];
+      long res_status = 0;
+      curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &res_status);
+      if (msg->data.result != CURLE_OK) {
+        rWarning("Download failed: connection failure: %d", msg->data.result);
+        failed = true;
+      } else if (res_status != 206 || writers[i].offset != writers[i].end) {
+        rWarning("Download failed: http error code: %d", res_status);
+        failed = true;
       } else {
-        rWarning("Download failed: connection failure: %d",  msg->data.result);
+        ++complete;
+        if (range_done) range_done(i);
       }
+      curl_multi_remove_handle(cm, eh);
+      curl_easy_cleanup(eh);
+      running.erase(eh);
+      connection_pool.release();
+    }
+    download_stats.update(url, written);
+    if (still_running > 0) {
+      curl_multi_wait(cm, nullptr, 0, 1000, nullptr);
     }
   }
 
-  bool success = complete == parts;
-  download_stats.update(url, written, success);
-  download_stats.remove(url);
-
-  for (const auto &[e, w] : writers) {
-    curl_multi_remove_handle(cm, e);
-    curl_easy_cleanup(e);
+  for (const auto &[eh, _] : running) {
+    curl_multi_remove_handle(cm, eh);
+    curl_easy_cleanup(eh);
+    connection_pool.release();
   }
   curl_multi_cleanup(cm);
 
+  bool success = complete == ranges.size();
+  download_stats.update(url, written, success);
+  download_stats.remove(url);
   return success;
 }
 
@@ -251,16 +316,23 @@ std::string httpGet(const std::string &url, size_t chunk_size, std::atomic<bool>
   if (size == 0) return {};
 
   std::string result(size, '\0');
-  return httpDownload(url, result, chunk_size, size, abort) ? result : "";
+  return httpDownloadRanges(url, result.data(), splitRanges(size, chunk_size), nullptr, abort) ? result : "";
 }
 
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size, std::atomic<bool> *abort) {
   size_t size = getRemoteFileSize(url, abort);
   if (size == 0) return false;
 
-  std::ofstream of(file, std::ios::binary | std::ios::out);
-  of.seekp(size - 1).write("\0", 1);
-  return httpDownload(url, of, chunk_size, size, abort);
+  // written in place through a shared mapping, the ranges land in the file as they arrive
+  int fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  void *mem = ftruncate(fd, size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (mem == MAP_FAILED) return false;
+
+  bool ret = httpDownloadRanges(url, (char *)mem, splitRanges(size, chunk_size), nullptr, abort);
+  munmap(mem, size);
+  return ret;
 }
 
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort) {
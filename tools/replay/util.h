@@ -3,6 +3,11 @@
 #include <atomic>
 #include <functional>
 #include <string>
+#include <utility>
+#include <vector>
+
+// ranges downloaded at once over all downloads, each on its own connection
+const int MAX_HTTP_CONNECTIONS = 8;
 
 enum class ReplyMsgType {
   Info,
@@ -25,10 +30,17 @@ void precise_nano_sleep(long sleep_ns);
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
 std::string getUrlWithoutQuery(const std::string &url);
+bool isRemoteUrl(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);
 
 typedef std::function<void(uint64_t cur, uint64_t total, bool success)> DownloadProgressHandler;
 void installDownloadProgressHandler(DownloadProgressHandler);
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);
+// [begin, end) ranges of chunk_size, a single range if it's 0
+std::vector<std::pair<size_t, size_t>> splitRanges(size_t size, size_t chunk_size);
+// Downloads the ranges of url into dst in parallel, on connections shared by all downloads.
+// range_done is called with the index of each range as it completes.
+bool httpDownloadRanges(const std::string &url, char *dst, const std::vector<std::pair<size_t, size_t>> &ranges,
+                        const std::function<void(size_t)> &range_done = nullptr, std::atomic<bool> *abort = nullptr);
 std::string formattedDataSize(size_t size);
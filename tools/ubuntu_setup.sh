@@ -35,6 +35,7 @@ function install_ubuntu_common_requirements() {
     liblzma-dev \
     libarchive-dev \
     libbz2-dev \
+    libzstd-dev \
     capnproto \
     libcapnp-dev \
     curl \